@@ -1,46 +1,177 @@
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
 #include <cutils/properties.h>
 #include <cutils/log.h>
 
 #define LOG_TAG "bdaddr"
-#define RIL_BDADDR_PATH "/data/radio/bt.txt"
+#define RIL_BDADDR_DIR "/data/radio"
+#define RIL_BDADDR_NAME "bt.txt"
+#define RIL_BDADDR_PATH RIL_BDADDR_DIR "/" RIL_BDADDR_NAME
 #define BDADDR_PATH "/data/bdaddr"
 
+/* Default time to wait for RIL, can be overridden by the first argument */
+#define DEFAULT_TIMEOUT_MS (30*1000)
+#define MAX_TIMEOUT_S 3600
+
 /* Read bluetooth MAC from RIL_BDADDR_PATH ,
  * write it to BDADDR_PATH, and set ro.bt.bdaddr_path to BDADDR_PATH
  *
  * Adapted from bdaddr_read.c of thunderg
  */
 
-int main() {
-    char bdaddr[18];
+static long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Expects "xx:xx:xx:xx:xx:xx" followed by a newline or NUL */
+static int valid_bdaddr(const char *bdaddr)
+{
+    int i;
+
+    for (i = 0; i < 17; i++) {
+        if (i % 3 == 2) {
+            if (bdaddr[i] != ':')
+                return 0;
+        } else if (!((bdaddr[i] >= '0' && bdaddr[i] <= '9') ||
+                     (bdaddr[i] >= 'a' && bdaddr[i] <= 'f') ||
+                     (bdaddr[i] >= 'A' && bdaddr[i] <= 'F'))) {
+            return 0;
+        }
+    }
+    return bdaddr[17] == '\n' || bdaddr[17] == '\0';
+}
+
+/* Returns 0 on success, -ENOENT if the file is not there (yet),
+ * -EAGAIN if it is incomplete and other negative errno values on error */
+static int read_bdaddr(char *bdaddr)
+{
     int count;
     int fd;
 
-    //waiting while RIL will create file with MAC adress
-    usleep (1000*1000*5);
-
     fd = open(RIL_BDADDR_PATH, O_RDONLY);
-    if(fd < 0) {
-        fprintf(stderr, "open(%s) failed\n", RIL_BDADDR_PATH);
-        ALOGE("Can't open %s\n", RIL_BDADDR_PATH);
-        return -1;
+    if (fd < 0)
+        return -errno;
+
+    count = read(fd, bdaddr, 18);
+    close(fd);
+    if (count < 0)
+        return -errno;
+    if (count != 18 || !valid_bdaddr(bdaddr))
+        return -EAGAIN;
+
+    return 0;
+}
+
+/* Waits for RIL to write RIL_BDADDR_PATH, re-reading it every time a
+ * file in RIL_BDADDR_DIR is closed after writing or moved in */
+static int wait_bdaddr(char *bdaddr, int timeout_ms)
+{
+    struct pollfd pfd;
+    char buf[512];
+    long long deadline;
+    ssize_t count;
+    int ret;
+
+    pfd.fd = inotify_init();
+    if (pfd.fd < 0) {
+        ALOGE("inotify_init failed: %s\n", strerror(errno));
+        return -errno;
     }
+    pfd.events = POLLIN;
 
-    count = read(fd, bdaddr, sizeof(bdaddr));
-    if (count < 0) {
-        fprintf(stderr, "read(%s) failed\n", RIL_BDADDR_PATH);
-        ALOGE("Can't read %s\n", RIL_BDADDR_PATH);
-        return -1;
+    if (inotify_add_watch(pfd.fd, RIL_BDADDR_DIR, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        ALOGE("Can't watch %s: %s\n", RIL_BDADDR_DIR, strerror(errno));
+        close(pfd.fd);
+        return -errno;
     }
-    else if (count != sizeof(bdaddr)) {
-        fprintf(stderr, "read(%s) unexpected size %d\n", RIL_BDADDR_PATH, count);
-        ALOGE("Error reading %s (unexpected size %d)\n", RIL_BDADDR_PATH, count);
+
+    deadline = now_ms() + timeout_ms;
+
+    /* the file may have been written before the watch was added */
+    ret = read_bdaddr(bdaddr);
+    while (ret == -ENOENT || ret == -EAGAIN) {
+        int remaining = (int)(deadline - now_ms());
+
+        if (remaining <= 0) {
+            ret = -ETIMEDOUT;
+            break;
+        }
+        if (poll(&pfd, 1, remaining) > 0) {
+            /* drain the events, only the file matters */
+            do {
+                count = read(pfd.fd, buf, sizeof(buf));
+            } while (count < 0 && errno == EINTR);
+            if (count < 0) {
+                ALOGE("inotify read failed: %s\n", strerror(errno));
+                ret = -errno;
+                break;
+            }
+        }
+
+        ret = read_bdaddr(bdaddr);
+    }
+
+    close(pfd.fd);
+    return ret;
+}
+
+/* Timeout in seconds from the command line, DEFAULT_TIMEOUT_MS if it is
+ * not a number from 1 to MAX_TIMEOUT_S */
+static int parse_timeout(const char *arg)
+{
+    char *end;
+    long seconds;
+
+    errno = 0;
+    seconds = strtol(arg, &end, 10);
+    if (errno || end == arg || *end != '\0' ||
+            seconds < 1 || seconds > MAX_TIMEOUT_S) {
+        ALOGW("Invalid timeout '%s', waiting %d s\n", arg, DEFAULT_TIMEOUT_MS / 1000);
+        return DEFAULT_TIMEOUT_MS;
+    }
+    return (int)seconds * 1000;
+}
+
+int main(int argc, char **argv) {
+    char bdaddr[18];
+    int timeout_ms = DEFAULT_TIMEOUT_MS;
+    long long start;
+    int fd;
+    int ret;
+
+    if (argc > 1)
+        timeout_ms = parse_timeout(argv[1]);
+
+    start = now_ms();
+
+    ret = read_bdaddr(bdaddr);
+    if (ret < 0)
+        ret = wait_bdaddr(bdaddr, timeout_ms);
+
+    if (ret < 0) {
+        fprintf(stderr, "read(%s) failed after %lld ms: %s\n",
+                RIL_BDADDR_PATH, now_ms() - start, strerror(-ret));
+        ALOGE("Can't read %s after %lld ms: %s\n",
+                RIL_BDADDR_PATH, now_ms() - start, strerror(-ret));
         return -1;
     }
 
-    fd = open(BDADDR_PATH, O_WRONLY|O_CREAT|O_TRUNC, 00600|00060|00006);
+    ALOGI("Got %s after %lld ms\n", RIL_BDADDR_PATH, now_ms() - start);
+
+    /* created fresh so it gets 0660 under init's zero umask */
+    unlink(BDADDR_PATH);
+    fd = open(BDADDR_PATH, O_WRONLY|O_CREAT|O_TRUNC, 0660);
     if (fd < 0) {
         fprintf(stderr, "open(%s) failed\n", BDADDR_PATH);
         ALOGE("Can't open %s\n", BDADDR_PATH);
@@ -48,9 +179,8 @@ int main() {
     }
     write(fd, bdaddr, 18);
 
-    // Set bluetooth owner and permission
+    // Set bluetooth owner
     fchown(fd, 1002, 1002);
-    fchmod(fd, 0660);
 
     close(fd);
     property_set("ro.bt.bdaddr_path", BDADDR_PATH);
@@ -114,6 +114,7 @@ PRODUCT_PACKAGES += \
 	hwcomposer.s5pc110 \
 	camera.wave \
 	gps.wave \
+	flp.wave \
 	audio.primary.wave \
 	audio.a2dp.default \
 	audio.usb.default \
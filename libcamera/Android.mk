@@ -21,6 +21,7 @@ LOCAL_SRC_FILES:= \
 	SecCamera.cpp \
 	SecCameraHWInterface.cpp \
 	SecCameraUtils.cpp \
+	SecCameraImage.cpp \
 
 LOCAL_SHARED_LIBRARIES:= libutils libcutils libbinder liblog libcamera_client libhardware
 LOCAL_SHARED_LIBRARIES+= libs3cjpeg
@@ -39,4 +40,74 @@ endif
 
 include $(BUILD_SHARED_LIBRARY)
 
+# pixel kernel checks and timings: camera_image_test [iterations].
+# the host build runs the C paths, the device build the NEON ones.
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	SecCameraImage.cpp \
+	tests/SecCameraImageTest.cpp \
+
+LOCAL_MODULE := camera_image_test
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	SecCameraImage.cpp \
+	tests/SecCameraImageTest.cpp \
+
+LOCAL_MODULE := camera_image_test
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
+
+# dump bookkeeping checks: camera_metrics_test
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	SecCameraUtils.cpp \
+	tests/SecCameraMetricsTest.cpp \
+
+LOCAL_STATIC_LIBRARIES:= libutils libcutils liblog
+
+LOCAL_MODULE := camera_metrics_test
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	SecCameraUtils.cpp \
+	tests/SecCameraMetricsTest.cpp \
+
+LOCAL_SHARED_LIBRARIES:= libutils libcutils liblog
+
+LOCAL_MODULE := camera_metrics_test
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
+
+# setParameters() cost through the HAL module, on the device only:
+# camera_params_bench [camera id] [iterations]
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	tests/CameraParamsBench.cpp \
+
+LOCAL_SHARED_LIBRARIES:= libutils libcutils libhardware libcamera_client
+
+LOCAL_MODULE := camera_params_bench
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
+
 endif
@@ -33,7 +33,10 @@
 #include <string.h>
 #include <stdlib.h>
 #include <sys/poll.h>
+#include <sys/eventfd.h>
+#include <utils/Timers.h>
 #include "SecCamera.h"
+#include "SecCameraUtils.h"
 #include "cutils/properties.h"
 
 using namespace android;
@@ -62,27 +65,6 @@ namespace android {
 // ======================================================================
 // Camera controls
 
-static struct timeval time_start;
-static struct timeval time_stop;
-
-unsigned long measure_time(struct timeval *start, struct timeval *stop)
-{
-    unsigned long sec, usec, time;
-
-    sec = stop->tv_sec - start->tv_sec;
-
-    if (stop->tv_usec >= start->tv_usec) {
-        usec = stop->tv_usec - start->tv_usec;
-    } else {
-        usec = stop->tv_usec + 1000000 - start->tv_usec;
-        sec--;
-    }
-
-    time = (sec * 1000000) + usec;
-
-    return time;
-}
-
 static int get_pixel_depth(unsigned int fmt)
 {
     int depth = 0;
@@ -321,14 +303,32 @@ static int fimc_v4l2_enum_fmt(int fp, unsigned int fmt)
     return 0;
 }
 
-static int fimc_v4l2_reqbufs(int fp, enum v4l2_buf_type type, int nr_bufs)
+/* every capture format the node offers, up to max */
+static int fimc_v4l2_enum_fmts(int fp, unsigned int *fmts, int max)
+{
+    struct v4l2_fmtdesc fmtdesc;
+    int count = 0;
+
+    fmtdesc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmtdesc.index = 0;
+
+    while (count < max && ioctl(fp, VIDIOC_ENUM_FMT, &fmtdesc) == 0) {
+        fmts[count++] = fmtdesc.pixelformat;
+        fmtdesc.index++;
+    }
+
+    return count;
+}
+
+static int fimc_v4l2_reqbufs(int fp, enum v4l2_buf_type type, int nr_bufs,
+                             enum v4l2_memory memory)
 {
     struct v4l2_requestbuffers req;
     int ret;
 
     req.count = nr_bufs;
     req.type = type;
-    req.memory = V4L2_MEMORY_MMAP;
+    req.memory = memory;
 
     ret = ioctl(fp, VIDIOC_REQBUFS, &req);
     if (ret < 0) {
@@ -339,7 +339,33 @@ static int fimc_v4l2_reqbufs(int fp, enum v4l2_buf_type type, int nr_bufs)
     return req.count;
 }
 
-static int fimc_v4l2_querybuf(int fp, struct fimc_buffer *buffer, enum v4l2_buf_type type)
+static int fimc_v4l2_reqbufs_try(int count, void *ctx)
+{
+    struct v4l2_requestbuffers req;
+
+    req.count = count;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+
+    if (ioctl(*(int *)ctx, VIDIOC_REQBUFS, &req) < 0)
+        return -1;
+    return req.count;
+}
+
+/* asks for count mmap buffers and steps down while the node's reserved
+ * memory cannot hold them
+ */
+static int fimc_v4l2_reqbufs_fit(int fp, int count, int min)
+{
+    int ret = fitBufferCount(count, min, fimc_v4l2_reqbufs_try, &fp);
+
+    if (ret < 0)
+        ALOGE("ERR(%s):cannot get %d buffers\n", __func__, min);
+    return ret;
+}
+
+static int fimc_v4l2_querybuf(int fp, struct fimc_buffer *buffer, enum v4l2_buf_type type,
+                              int index)
 {
     struct v4l2_buffer v4l2_buf;
     int ret;
@@ -348,7 +374,7 @@ static int fimc_v4l2_querybuf(int fp, struct fimc_buffer *buffer, enum v4l2_buf_
 
     v4l2_buf.type = type;
     v4l2_buf.memory = V4L2_MEMORY_MMAP;
-    v4l2_buf.index = 0;
+    v4l2_buf.index = index;
 
     ret = ioctl(fp , VIDIOC_QUERYBUF, &v4l2_buf);
     if (ret < 0) {
@@ -359,7 +385,7 @@ static int fimc_v4l2_querybuf(int fp, struct fimc_buffer *buffer, enum v4l2_buf_
     buffer->length = v4l2_buf.length;
     if ((buffer->start = (char *)mmap(0, v4l2_buf.length,
                                          PROT_READ | PROT_WRITE, MAP_SHARED,
-                                         fp, v4l2_buf.m.offset)) < 0) {
+                                         fp, v4l2_buf.m.offset)) == MAP_FAILED) {
          ALOGE("%s %d] mmap() failed\n",__func__, __LINE__);
          return -1;
     }
@@ -417,13 +443,13 @@ static int fimc_v4l2_qbuf(int fp, int index)
     return 0;
 }
 
-static int fimc_v4l2_dqbuf(int fp)
+static int fimc_v4l2_dqbuf_ts(int fp, enum v4l2_memory memory, nsecs_t *timestamp)
 {
     struct v4l2_buffer v4l2_buf;
     int ret;
 
     v4l2_buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    v4l2_buf.memory = V4L2_MEMORY_MMAP;
+    v4l2_buf.memory = memory;
 
     ret = ioctl(fp, VIDIOC_DQBUF, &v4l2_buf);
     if (ret < 0) {
@@ -431,9 +457,26 @@ static int fimc_v4l2_dqbuf(int fp)
         return ret;
     }
 
+    if (timestamp != NULL) {
+        *timestamp = (nsecs_t)v4l2_buf.timestamp.tv_sec * 1000000000LL +
+                     (nsecs_t)v4l2_buf.timestamp.tv_usec * 1000LL;
+#ifdef V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC
+        if (*timestamp != 0 && !(v4l2_buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC))
+#else
+        if (*timestamp != 0)
+#endif
+            /* FIMC stamps frames with the wall clock */
+            *timestamp += systemTime(SYSTEM_TIME_MONOTONIC) - systemTime(SYSTEM_TIME_REALTIME);
+    }
+
     return v4l2_buf.index;
 }
 
+static int fimc_v4l2_dqbuf(int fp, enum v4l2_memory memory)
+{
+    return fimc_v4l2_dqbuf_ts(fp, memory, NULL);
+}
+
 static int fimc_v4l2_g_ctrl(int fp, unsigned int id)
 {
     struct v4l2_control ctrl;
@@ -490,6 +533,101 @@ static int fimc_v4l2_s_ext_ctrl(int fp, unsigned int id, void *value)
     return ret;
 }
 
+static int fimc_v4l2_subscribe_ctrl(int fp, unsigned int id)
+{
+#ifdef V4L2_EVENT_CTRL
+    struct v4l2_event_subscription sub;
+
+    memset(&sub, 0, sizeof(sub));
+    sub.type = V4L2_EVENT_CTRL;
+    sub.id = id;
+
+    return ioctl(fp, VIDIOC_SUBSCRIBE_EVENT, &sub);
+#else
+    return -1;
+#endif
+}
+
+static void fimc_v4l2_drain_events(int fp)
+{
+#ifdef V4L2_EVENT_CTRL
+    struct v4l2_event ev;
+
+    do {
+        memset(&ev, 0, sizeof(ev));
+        if (ioctl(fp, VIDIOC_DQEVENT, &ev) < 0)
+            break;
+    } while (ev.pending > 0);
+#endif
+}
+
+SecCameraCtrlCache::SecCameraCtrlCache() :
+            m_cache_count(0),
+            m_written(0),
+            m_skipped(0)
+{
+}
+
+int SecCameraCtrlCache::find(unsigned int id) const
+{
+    for (int i = 0; i < m_cache_count; i++) {
+        if (m_cache_id[i] == id)
+            return i;
+    }
+    return -1;
+}
+
+/* the sensor's controls are private ids outside any V4L2 control
+ * class, which VIDIOC_S_EXT_CTRLS rejects, so each one is its own
+ * VIDIOC_S_CTRL
+ */
+int SecCameraCtrlCache::set(int fd, unsigned int id, int value)
+{
+    Mutex::Autolock lock(m_lock);
+
+    int i = find(id);
+    if (i >= 0 && m_cache_value[i] == value) {
+        m_skipped++;
+        return 0;
+    }
+
+    if (fimc_v4l2_s_ctrl(fd, id, value) < 0) {
+        /* what the sensor holds for this one is unknown now */
+        if (i >= 0) {
+            m_cache_count--;
+            m_cache_id[i] = m_cache_id[m_cache_count];
+            m_cache_value[i] = m_cache_value[m_cache_count];
+        }
+        return -1;
+    }
+    m_written++;
+
+    if (i < 0) {
+        if (m_cache_count == MAX_CTRLS)
+            return 0;
+        i = m_cache_count++;
+        m_cache_id[i] = id;
+    }
+    m_cache_value[i] = value;
+    return 0;
+}
+
+void SecCameraCtrlCache::invalidate(void)
+{
+    Mutex::Autolock lock(m_lock);
+    m_cache_count = 0;
+}
+
+void SecCameraCtrlCache::dump(String8 &result) const
+{
+    char buffer[256];
+    Mutex::Autolock lock(m_lock);
+
+    snprintf(buffer, 255, " controls: %u written, %u skipped as unchanged, %d cached\n",
+             m_written, m_skipped, m_cache_count);
+    result.append(buffer);
+}
+
 static int fimc_v4l2_g_parm(int fp, struct v4l2_streamparm *streamparm)
 {
     int ret;
@@ -569,11 +707,17 @@ SecCamera::SecCamera() :
             m_flag_camera_start(0),
             m_jpeg_thumbnail_width (0),
             m_jpeg_thumbnail_height(0),
-            m_jpeg_quality(100)
+            m_jpeg_quality(100),
 #ifdef ENABLE_ESD_PREVIEW_CHECK
-            ,
-            m_esd_check_count(0)
+            m_esd_check_count(0),
 #endif // ENABLE_ESD_PREVIEW_CHECK
+            m_snap_stop("snapshot stop"),
+            m_snap_prepare("snapshot prepare"),
+            m_snap_capture("snapshot capture"),
+            m_snap_post("snapshot post"),
+            m_af_time("autofocus"),
+            m_preview_clock("preview clock", "preview latency", "preview jitter"),
+            m_record_clock("record clock", "record latency", "record jitter")
 {
     m_params = (struct sec_cam_parm*)&m_streamparm.parm.raw_data;
     struct v4l2_captureparm capture;
@@ -592,6 +736,29 @@ SecCamera::SecCamera() :
     m_params->white_balance = -1;
 
     memset(&m_capture_buf, 0, sizeof(m_capture_buf));
+    m_snapshot_enc = NULL;
+    memset(m_burst_buf, 0, sizeof(m_burst_buf));
+    m_burst_count = 0;
+    memset(m_record_buf, 0, sizeof(m_record_buf));
+    memset(m_record_refs, 0, sizeof(m_record_refs));
+    m_record_nbufs_req = MAX_BUFFERS;
+    m_record_nbufs = 0;
+    memset(m_preview_refs, 0, sizeof(m_preview_refs));
+    m_preview_nbufs_req = MAX_BUFFERS;
+    m_preview_nbufs = MAX_BUFFERS;
+    m_preview_queued = 0;
+    m_preview_starved = 0;
+    memset(m_sensor_caps, 0, sizeof(m_sensor_caps));
+    memset(m_node_formats, 0, sizeof(m_node_formats));
+    m_caps_hits = 0;
+    m_caps_misses = 0;
+    m_af_cancel_fd = -1;
+    m_af_events = false;
+    m_af_cancel_time = 0;
+    m_af_searches = 0;
+    m_af_last_us = 0;
+    m_af_cancels = 0;
+    m_af_cancel_us = 0;
 
     ALOGV("%s :", __func__);
 }
@@ -622,12 +789,39 @@ int SecCamera::initCamera(int index)
 
         ALOGE("initCamera: m_cam_fd(%d), m_jpeg_fd(%d)", m_cam_fd, m_jpeg_fd);
 
-        ret = fimc_v4l2_querycap(m_cam_fd);
-        CHECK(ret);
-        if (!fimc_v4l2_enuminput(m_cam_fd, index))
+        if (index < CAMERA_ID_BACK || index > CAMERA_ID_FRONT) {
+            ALOGE("ERR(%s):Invalid camera id(%d)", __func__, index);
             return -1;
+        }
+        SensorCaps *caps = &m_sensor_caps[index];
+
+        /* the nodes and the sensor do not change under us, probe
+         * them on the first open only
+         */
+        if (!caps->valid) {
+            ret = fimc_v4l2_querycap(m_cam_fd);
+            CHECK(ret);
+            const __u8 *name = fimc_v4l2_enuminput(m_cam_fd, index);
+            if (!name)
+                return -1;
+            strncpy(caps->name, (const char *)name, sizeof(caps->name) - 1);
+            caps->name[sizeof(caps->name) - 1] = '\0';
+        }
         ret = fimc_v4l2_s_input(m_cam_fd, index);
         CHECK(ret);
+        /* the sensor was just powered up with its defaults */
+        m_ctrls.invalidate();
+
+        m_af_cancel_fd = eventfd(0, 0);
+        if (m_af_cancel_fd < 0)
+            ALOGW("WARN(%s):no eventfd (%s), autofocus cancels between polls",
+                 __func__, strerror(errno));
+        else
+            fcntl(m_af_cancel_fd, F_SETFL, O_NONBLOCK);
+        m_af_events = fimc_v4l2_subscribe_ctrl(m_cam_fd,
+                              V4L2_CID_CAMERA_AUTO_FOCUS_RESULT_FIRST) == 0;
+        ALOGV("%s: autofocus result %s", __func__,
+             m_af_events ? "events" : "polled");
 
         m_cam_fd2 = open(CAMERA_DEV_NAME2, O_RDWR);
         ALOGV("%s: open(%s) --> m_cam_fd2 = %d", __FUNCTION__, CAMERA_DEV_NAME2, m_cam_fd2);
@@ -638,12 +832,18 @@ int SecCamera::initCamera(int index)
 
         ALOGE("initCamera: m_cam_fd2(%d)", m_cam_fd2);
 
-        ret = fimc_v4l2_querycap(m_cam_fd2);
-        CHECK(ret);
-        if (!fimc_v4l2_enuminput(m_cam_fd2, index))
-            return -1;
+        if (!caps->valid) {
+            ret = fimc_v4l2_querycap(m_cam_fd2);
+            CHECK(ret);
+            if (!fimc_v4l2_enuminput(m_cam_fd2, index))
+                return -1;
+            m_caps_misses++;
+        } else {
+            m_caps_hits++;
+        }
         ret = fimc_v4l2_s_input(m_cam_fd2, index);
         CHECK(ret);
+        caps->valid = true;
 
         m_camera_id = index;
 
@@ -671,6 +871,31 @@ int SecCamera::initCamera(int index)
     return 0;
 }
 
+/* VIDIOC_ENUM_FMT once per node and process, later checks are a
+ * table lookup
+ */
+int SecCamera::checkFormat(int fd, unsigned int fmt)
+{
+    NodeFormats *node = &m_node_formats[fd == m_cam_fd2 ? 1 : 0];
+
+    if (!node->valid) {
+        node->count = fimc_v4l2_enum_fmts(fd, node->formats, MAX_CACHED_FORMATS);
+        node->valid = node->count > 0;
+    }
+
+    for (int i = 0; i < node->count; i++) {
+        if (node->formats[i] == fmt)
+            return 0;
+    }
+
+    /* a node with more formats than we keep */
+    if (node->count == MAX_CACHED_FORMATS)
+        return fimc_v4l2_enum_fmt(fd, fmt);
+
+    ALOGE("ERR(%s):unsupported pixel format %#x", __func__, fmt);
+    return -1;
+}
+
 void SecCamera::resetCamera()
 {
     ALOGV("%s :", __func__);
@@ -685,6 +910,7 @@ void SecCamera::DeinitCamera()
     if (m_flag_init) {
 
         stopRecord();
+        stopBurst();
 
         /* close m_cam_fd after stopRecord() because stopRecord()
          * uses m_cam_fd to change frame rate
@@ -695,6 +921,12 @@ void SecCamera::DeinitCamera()
             m_cam_fd = -1;
         }
 
+        if (m_af_cancel_fd > -1) {
+            close(m_af_cancel_fd);
+            m_af_cancel_fd = -1;
+        }
+        m_af_events = false;
+
         ALOGI("DeinitCamera: m_cam_fd2(%d)", m_cam_fd2);
         if (m_cam_fd2 > -1) {
             close(m_cam_fd2);
@@ -707,6 +939,18 @@ void SecCamera::DeinitCamera()
 }
 
 
+/* sensor state controls go through m_ctrls, so a value the sensor
+ * already holds is not written again
+ */
+int SecCamera::setCtrlCached(unsigned int id, int value)
+{
+    /* a scene mode rewrites the sensor's own settings behind our back */
+    if (id == V4L2_CID_CAMERA_SCENE_MODE)
+        m_ctrls.invalidate();
+
+    return m_ctrls.set(m_cam_fd, id, value);
+}
+
 int SecCamera::getCameraFd(void)
 {
     return m_cam_fd;
@@ -737,18 +981,24 @@ int SecCamera::startPreview(void)
     m_events_c.fd = m_cam_fd;
     m_events_c.events = POLLIN | POLLERR;
 
+    int v4lformat = m_preview_v4lformat;
+
     /* enum_fmt, s_fmt sample */
-    int ret = fimc_v4l2_enum_fmt(m_cam_fd,m_preview_v4lformat);
+    int ret = checkFormat(m_cam_fd, v4lformat);
     CHECK(ret);
 
     if (m_camera_id == CAMERA_ID_BACK)
-        ret = fimc_v4l2_s_fmt(m_cam_fd, m_preview_width,m_preview_height,m_preview_v4lformat, 0);
+        ret = fimc_v4l2_s_fmt(m_cam_fd, m_preview_width,m_preview_height, v4lformat, 0);
     else
-        ret = fimc_v4l2_s_fmt(m_cam_fd, m_preview_height,m_preview_width,m_preview_v4lformat, 0);
+        ret = fimc_v4l2_s_fmt(m_cam_fd, m_preview_height,m_preview_width, v4lformat, 0);
     CHECK(ret);
 
-    ret = fimc_v4l2_reqbufs(m_cam_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE, MAX_BUFFERS);
-    CHECK(ret);
+    int nbufs = fimc_v4l2_reqbufs_fit(m_cam_fd, m_preview_nbufs_req, MIN_STREAM_BUFFERS);
+    CHECK(nbufs);
+    if (nbufs > MAX_BUFFERS)
+        nbufs = MAX_BUFFERS;
+    if (nbufs < m_preview_nbufs_req)
+        ALOGW("%s: only %d of %d preview buffers fit", __func__, nbufs, m_preview_nbufs_req);
 
     ALOGV("%s : m_preview_width: %d m_preview_height: %d m_angle: %d\n",
             __func__, m_preview_width, m_preview_height, m_angle);
@@ -757,17 +1007,26 @@ int SecCamera::startPreview(void)
                            V4L2_CID_CAMERA_CHECK_DATALINE, m_chk_dataline);
     CHECK(ret);
 
-    if (m_camera_id == CAMERA_ID_FRONT) {
-        /* VT mode setting */
-        ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_VT_MODE, m_vtmode);
-        CHECK(ret);
-    }
-
-    /* start with all buffers in queue */
-    for (int i = 0; i < MAX_BUFFERS; i++) {
-        ret = fimc_v4l2_qbuf(m_cam_fd, i);
-        CHECK(ret);
+    /* start with all buffers in queue, except those a consumer still
+     * holds (ESD restart)
+     */
+    m_preview_lock.lock();
+    m_preview_nbufs = nbufs;
+    m_preview_queued = 0;
+    /* references to buffers that no longer exist are dropped */
+    for (int i = m_preview_nbufs; i < MAX_BUFFERS; i++)
+        m_preview_refs[i] = 0;
+    for (int i = 0; i < m_preview_nbufs; i++) {
+        if (m_preview_refs[i] > 0)
+            continue;
+
+        ret = queuePreviewBufferLocked(i);
+        if (ret < 0) {
+            m_preview_lock.unlock();
+            return -1;
+        }
     }
+    m_preview_lock.unlock();
 
     if (m_camera_id == CAMERA_ID_BACK) {
         // Init some parameters required for CE147
@@ -779,24 +1038,33 @@ int SecCamera::startPreview(void)
         // doesn't work because it needs to be set before the preview is started.
         m_video_gamma = GAMMA_ON;
         m_slow_ae = SLOW_AE_ON;
+    }
 
-        ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_ANTI_BANDING, m_anti_banding);
+    /* values the sensor still holds from the last preview are not
+     * sent again
+     */
+    if (m_camera_id == CAMERA_ID_FRONT) {
+        /* VT mode setting */
+        ret = setCtrlCached(V4L2_CID_CAMERA_VT_MODE, m_vtmode);
         CHECK(ret);
-        ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_ISO, m_params->iso);
+    } else {
+        ret = setCtrlCached(V4L2_CID_CAMERA_ANTI_BANDING, m_anti_banding);
         CHECK(ret);
-        ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_BRIGHTNESS, m_params->brightness);
+        ret = setCtrlCached(V4L2_CID_CAMERA_ISO, m_params->iso);
         CHECK(ret);
-        ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_FRAME_RATE, m_params->capture.timeperframe.denominator);
+        ret = setCtrlCached(V4L2_CID_CAMERA_BRIGHTNESS, m_params->brightness);
         CHECK(ret);
-        ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_METERING, m_params->metering);
+        ret = setCtrlCached(V4L2_CID_CAMERA_FRAME_RATE, m_params->capture.timeperframe.denominator);
         CHECK(ret);
-        ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_SET_GAMMA, m_video_gamma);
+        ret = setCtrlCached(V4L2_CID_CAMERA_METERING, m_params->metering);
         CHECK(ret);
-        ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_SET_SLOW_AE, m_slow_ae);
+        ret = setCtrlCached(V4L2_CID_CAMERA_SET_GAMMA, m_video_gamma);
         CHECK(ret);
-        ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_EFFECT, m_params->effects);
+        ret = setCtrlCached(V4L2_CID_CAMERA_SET_SLOW_AE, m_slow_ae);
         CHECK(ret);
-        ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_WHITE_BALANCE, m_params->white_balance);
+        ret = setCtrlCached(V4L2_CID_CAMERA_EFFECT, m_params->effects);
+        CHECK(ret);
+        ret = setCtrlCached(V4L2_CID_CAMERA_WHITE_BALANCE, m_params->white_balance);
         CHECK(ret);
     }
 
@@ -805,29 +1073,31 @@ int SecCamera::startPreview(void)
 
     if (m_camera_id == CAMERA_ID_BACK) {
         // More parameters for CE147
-        ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_FOCUS_MODE, m_params->focus_mode);
-        CHECK(ret);
         m_face_detect = 0;
-        ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_FACE_DETECTION, m_face_detect);
+        // TODO
+        m_beauty_shot = 0;
+        m_zoom_level = 0;
+
+        ret = setCtrlCached(V4L2_CID_CAMERA_FOCUS_MODE, m_params->focus_mode);
         CHECK(ret);
-        ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_SHARPNESS, m_params->sharpness);
+        ret = setCtrlCached(V4L2_CID_CAMERA_FACE_DETECTION, m_face_detect);
         CHECK(ret);
-        ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_SATURATION, m_params->saturation);
+        ret = setCtrlCached(V4L2_CID_CAMERA_SHARPNESS, m_params->sharpness);
         CHECK(ret);
-        ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_CONTRAST, m_params->contrast);
+        ret = setCtrlCached(V4L2_CID_CAMERA_SATURATION, m_params->saturation);
         CHECK(ret);
-        // TODO
-        m_beauty_shot = 0;
-        ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_BEAUTY_SHOT, m_beauty_shot);
+        ret = setCtrlCached(V4L2_CID_CAMERA_CONTRAST, m_params->contrast);
         CHECK(ret);
-        m_zoom_level = 0;
-        ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_ZOOM, m_zoom_level);
+        ret = setCtrlCached(V4L2_CID_CAMERA_BEAUTY_SHOT, m_beauty_shot);
+        CHECK(ret);
+        ret = setCtrlCached(V4L2_CID_CAMERA_ZOOM, m_zoom_level);
         CHECK(ret);
         ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_BATCH_REFLECTION, 1);
         CHECK(ret);
     }
 
     m_flag_camera_start = 1;
+    m_preview_clock.restart();
 
     ret = fimc_v4l2_s_parm(m_cam_fd, &m_streamparm);
     CHECK(ret);
@@ -835,13 +1105,12 @@ int SecCamera::startPreview(void)
     if (m_camera_id == CAMERA_ID_FRONT) {
         /* Blur setting */
         ALOGV("m_blur_level = %d", m_blur_level);
-        ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_VGA_BLUR,
-                               m_blur_level);
+        ret = setCtrlCached(V4L2_CID_CAMERA_VGA_BLUR, m_blur_level);
         CHECK(ret);
     }
 
 #ifdef HAVE_FLASH
-    ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_FLASH_MODE, m_params->flash_mode);
+    ret = setCtrlCached(V4L2_CID_CAMERA_FLASH_MODE, m_params->flash_mode);
     CHECK(ret);
 #endif
 
@@ -879,10 +1148,118 @@ int SecCamera::stopPreview(void)
     CHECK(ret);
 
     m_flag_camera_start = 0;
+    /* the sensor may reset focus and exposure when the stream stops */
+    m_ctrls.invalidate();
+
+    /* streamoff takes every buffer away from the driver.  references
+     * held by consumers are kept, so a restart only requeues the
+     * buffers that were with the driver.
+     */
+    m_preview_lock.lock();
+    m_preview_queued = 0;
+    m_preview_released.broadcast();
+    m_preview_lock.unlock();
 
     return ret;
 }
 
+/* forgets every consumer reference, for a fresh start of the preview */
+int SecCamera::clearPreviewFrames(void)
+{
+    if (m_flag_camera_start > 0) {
+        ALOGE("ERR(%s):Cannot clear frames while preview is running", __func__);
+        return -1;
+    }
+
+    Mutex::Autolock lock(m_preview_lock);
+    memset(m_preview_refs, 0, sizeof(m_preview_refs));
+    m_preview_queued = 0;
+
+    return 0;
+}
+
+int SecCamera::setPreviewBufferCount(int count)
+{
+    ALOGV("%s(count(%d))", __func__, count);
+
+    if (count < MIN_STREAM_BUFFERS || count > MAX_BUFFERS) {
+        ALOGE("ERR(%s):Invalid buffer count(%d)", __func__, count);
+        return -1;
+    }
+
+    /* takes effect on the next startPreview() */
+    m_preview_nbufs_req = count;
+    return 0;
+}
+
+/* buffers in use by the running preview */
+int SecCamera::getPreviewBufferCount(void)
+{
+    return m_preview_nbufs;
+}
+
+/* called with m_preview_lock held */
+int SecCamera::queuePreviewBufferLocked(int index)
+{
+    int ret = fimc_v4l2_qbuf(m_cam_fd, index);
+
+    if (ret == 0)
+        m_preview_queued++;
+
+    return ret;
+}
+
+/*
+ * Every frame returned by getPreview() starts with one reference owned
+ * by the caller.  Consumers that keep the frame past the caller (display,
+ * callbacks, encoders) take their own with acquirePreviewFrame(); the
+ * buffer goes back to FIMC when the last one is dropped.
+ */
+int SecCamera::acquirePreviewFrame(int index)
+{
+    if (index < 0 || index >= m_preview_nbufs) {
+        ALOGE("ERR(%s):Invalid index(%d)", __func__, index);
+        return -1;
+    }
+
+    Mutex::Autolock lock(m_preview_lock);
+    if (m_preview_refs[index] <= 0) {
+        ALOGE("ERR(%s):buffer %d is owned by the driver", __func__, index);
+        return -1;
+    }
+    m_preview_refs[index]++;
+
+    return 0;
+}
+
+int SecCamera::releasePreviewFrame(int index)
+{
+    if (index < 0 || index >= m_preview_nbufs) {
+        ALOGE("ERR(%s):Invalid index(%d)", __func__, index);
+        return -1;
+    }
+
+    Mutex::Autolock lock(m_preview_lock);
+    if (m_preview_refs[index] <= 0) {
+        ALOGW("%s: buffer %d is not held", __func__, index);
+        return 0;
+    }
+
+    if (--m_preview_refs[index] > 0)
+        return 0;
+
+    /* buffers released while preview is stopped are queued on the
+     * next startPreview()
+     */
+    if (m_flag_camera_start == 0)
+        return 0;
+
+    int ret = queuePreviewBufferLocked(index);
+    if (ret == 0)
+        m_preview_released.signal();
+    return ret;
+}
+
 //Recording
 int SecCamera::startRecord(void)
 {
@@ -902,7 +1279,7 @@ int SecCamera::startRecord(void)
     }
 
     /* enum_fmt, s_fmt sample */
-    ret = fimc_v4l2_enum_fmt(m_cam_fd2, V4L2_PIX_FMT_NV12T);
+    ret = checkFormat(m_cam_fd2, V4L2_PIX_FMT_NV12T);
     CHECK(ret);
 
     ALOGI("%s: m_recording_width = %d, m_recording_height = %d\n",
@@ -923,18 +1300,41 @@ int SecCamera::startRecord(void)
     }
     CHECK(ret);
 
-    ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_FRAME_RATE,
-                            m_params->capture.timeperframe.denominator);
+    ret = setCtrlCached(V4L2_CID_CAMERA_FRAME_RATE,
+                  m_params->capture.timeperframe.denominator);
     CHECK(ret);
 
-    ret = fimc_v4l2_reqbufs(m_cam_fd2, V4L2_BUF_TYPE_VIDEO_CAPTURE, MAX_BUFFERS);
+    /* allocated here and freed in stopRecord(), so the record node
+     * holds no FIMC memory outside a recording
+     */
+    ret = fimc_v4l2_reqbufs_fit(m_cam_fd2, m_record_nbufs_req, MIN_STREAM_BUFFERS);
     CHECK(ret);
+    if (ret > MAX_BUFFERS)
+        ret = MAX_BUFFERS;
+    if (ret < m_record_nbufs_req)
+        ALOGW("%s: only %d of %d record buffers fit", __func__, ret, m_record_nbufs_req);
+    m_record_nbufs = ret;
+
+    /* only needed for stills during recording, so not fatal */
+    for (i = 0; i < m_record_nbufs; i++) {
+        if (fimc_v4l2_querybuf(m_cam_fd2, &m_record_buf[i],
+                               V4L2_BUF_TYPE_VIDEO_CAPTURE, i) < 0) {
+            ALOGW("WARN(%s):cannot map record buffer %d, no video snapshot", __func__, i);
+            m_record_buf[i].start = NULL;
+            m_record_buf[i].length = 0;
+        }
+    }
 
     /* start with all buffers in queue */
-    for (i = 0; i < MAX_BUFFERS; i++) {
+    m_record_lock.lock();
+    memset(m_record_refs, 0, sizeof(m_record_refs));
+    for (i = 0; i < m_record_nbufs; i++) {
         ret = fimc_v4l2_qbuf(m_cam_fd2, i);
-        CHECK(ret);
+        if (ret < 0)
+            break;
     }
+    m_record_lock.unlock();
+    CHECK(ret);
 
     ret = fimc_v4l2_streamon(m_cam_fd2);
     CHECK(ret);
@@ -953,6 +1353,7 @@ int SecCamera::startRecord(void)
     }
 
     m_flag_record_start = 1;
+    m_record_clock.restart();
 
     return 0;
 }
@@ -992,8 +1393,19 @@ int SecCamera::stopRecord(void)
     ret = fimc_v4l2_streamoff(m_cam_fd2);
     CHECK(ret);
 
-    ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_FRAME_RATE,
-                            FRAME_RATE_AUTO);
+    for (int i = 0; i < m_record_nbufs; i++) {
+        if (m_record_buf[i].start) {
+            munmap(m_record_buf[i].start, m_record_buf[i].length);
+            m_record_buf[i].start = NULL;
+            m_record_buf[i].length = 0;
+        }
+    }
+
+    /* give the memory back to FIMC until the next recording */
+    fimc_v4l2_reqbufs(m_cam_fd2, V4L2_BUF_TYPE_VIDEO_CAPTURE, 0, V4L2_MEMORY_MMAP);
+    m_record_nbufs = 0;
+
+    ret = setCtrlCached(V4L2_CID_CAMERA_FRAME_RATE, FRAME_RATE_AUTO);
     CHECK(ret);
 
     // Properties for back camera non-video recording
@@ -1047,10 +1459,35 @@ void SecCamera::pausePreview()
     fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_STREAM_PAUSE, 0);
 }
 
-int SecCamera::getPreview()
+int SecCamera::getPreview(nsecs_t *timestamp)
 {
     int index;
     int ret;
+    nsecs_t captured;
+
+    /* with every buffer out with consumers nothing can arrive, and the
+     * poll timeout below would be mistaken for a hung sensor.  wait for
+     * a consumer to hand one back instead; the timeout only keeps a
+     * stuck consumer from blocking stopPreview() for good.
+     */
+    if (m_flag_camera_start > 0) {
+        int queued;
+
+        m_preview_lock.lock();
+        if (m_preview_queued == 0)
+            m_preview_starved++;
+        while (m_preview_queued == 0 && m_flag_camera_start > 0) {
+            if (m_preview_released.waitRelative(m_preview_lock, 1000000000LL) != NO_ERROR)
+                break;
+        }
+        queued = m_preview_queued;
+        m_preview_lock.unlock();
+
+        if (queued == 0 && m_flag_camera_start > 0) {
+            ALOGE("ERR(%s):all %d buffers are held by consumers\n", __func__, m_preview_nbufs);
+            return -1;
+        }
+    }
 
     if (m_flag_camera_start == 0 || previewPoll(true) == 0) {
         ALOGE("ERR(%s):Start Camera Device Reset \n", __func__);
@@ -1076,27 +1513,103 @@ int SecCamera::getPreview()
         }
     }
 
-    index = fimc_v4l2_dqbuf(m_cam_fd);
-    if (!(0 <= index && index < MAX_BUFFERS)) {
+    index = fimc_v4l2_dqbuf_ts(m_cam_fd, V4L2_MEMORY_MMAP, &captured);
+    if (!(0 <= index && index < m_preview_nbufs)) {
         ALOGE("ERR(%s):wrong index = %d\n", __func__, index);
         return -1;
     }
 
-    ret = fimc_v4l2_qbuf(m_cam_fd, index);
-    CHECK(ret);
+    captured = m_preview_clock.frame(captured, systemTime(SYSTEM_TIME_MONOTONIC));
+    if (timestamp != NULL)
+        *timestamp = captured;
+
+    /* the frame stays ours until the caller releases it, so FIMC
+     * cannot overwrite it while it is being displayed or read
+     */
+    m_preview_lock.lock();
+    m_preview_queued--;
+    m_preview_refs[index] = 1;
+    m_preview_lock.unlock();
 
     return index;
 }
 
-int SecCamera::getRecordFrame()
+int SecCamera::getRecordFrame(nsecs_t *timestamp)
 {
+    nsecs_t captured;
+
     if (m_flag_record_start == 0) {
         ALOGE("%s: m_flag_record_start is 0", __func__);
         return -1;
     }
 
     previewPoll(false);
-    return fimc_v4l2_dqbuf(m_cam_fd2);
+    int index = fimc_v4l2_dqbuf_ts(m_cam_fd2, V4L2_MEMORY_MMAP, &captured);
+    if (index < 0 || index >= m_record_nbufs)
+        return -1;
+
+    captured = m_record_clock.frame(captured, systemTime(SYSTEM_TIME_MONOTONIC));
+    if (timestamp != NULL)
+        *timestamp = captured;
+
+    m_record_lock.lock();
+    m_record_refs[index] = 1;
+    m_record_lock.unlock();
+    return index;
+}
+
+/* an extra hold on a dequeued record frame, e.g. for a still */
+int SecCamera::acquireRecordFrame(int index)
+{
+    Mutex::Autolock lock(m_record_lock);
+
+    if (index < 0 || index >= m_record_nbufs || m_record_refs[index] <= 0)
+        return -1;
+
+    m_record_refs[index]++;
+    return 0;
+}
+
+unsigned char *SecCamera::getRecordFrameAddr(int index, unsigned char **cbcr)
+{
+    if (index < 0 || index >= m_record_nbufs || m_record_buf[index].start == NULL)
+        return NULL;
+
+    /* the CbCr plane sits where the driver put it, not at a fixed offset */
+    unsigned int addr_y = getRecPhyAddrY(index);
+    unsigned int addr_c = getRecPhyAddrC(index);
+    if ((int)addr_y < 0 || (int)addr_c < 0 || addr_c < addr_y ||
+            addr_c - addr_y >= m_record_buf[index].length)
+        return NULL;
+
+    *cbcr = (unsigned char *)m_record_buf[index].start + (addr_c - addr_y);
+    return (unsigned char *)m_record_buf[index].start;
+}
+
+int SecCamera::setRecordBufferCount(int count)
+{
+    ALOGV("%s(count(%d))", __func__, count);
+
+    if (count < MIN_STREAM_BUFFERS || count > MAX_BUFFERS) {
+        ALOGE("ERR(%s):Invalid buffer count(%d)", __func__, count);
+        return -1;
+    }
+
+    /* takes effect on the next startRecord() */
+    m_record_nbufs_req = count;
+    return 0;
+}
+
+/* buffers in use by the running recording, 0 when not recording */
+int SecCamera::getRecordBufferCount(void)
+{
+    return m_record_nbufs;
+}
+
+void SecCamera::getRecordingSize(int *width, int *height)
+{
+    *width  = m_recording_width;
+    *height = m_recording_height;
 }
 
 int SecCamera::releaseRecordFrame(int index)
@@ -1112,6 +1625,12 @@ int SecCamera::releaseRecordFrame(int index)
         return 0;
     }
 
+    Mutex::Autolock lock(m_record_lock);
+    if (index < 0 || index >= m_record_nbufs || m_record_refs[index] <= 0)
+        return -1;
+    if (--m_record_refs[index] > 0)
+        return 0;
+
     return fimc_v4l2_qbuf(m_cam_fd2, index);
 }
 
@@ -1180,9 +1699,7 @@ int SecCamera::setSnapshotCmd(void)
     ALOGV("%s :", __func__);
 
     int ret = 0;
-
-    LOG_TIME_DEFINE(0)
-    LOG_TIME_DEFINE(1)
+    nsecs_t start;
 
     if (m_cam_fd <= 0) {
         ALOGE("ERR(%s):Camera was closed\n", __func__);
@@ -1190,26 +1707,29 @@ int SecCamera::setSnapshotCmd(void)
     }
 
     if (m_flag_camera_start > 0) {
-        LOG_TIME_START(0)
+        start = systemTime(SYSTEM_TIME_MONOTONIC);
         ALOGW("WARN(%s):Camera was in preview, should have been stopped\n", __func__);
         stopPreview();
-        LOG_TIME_END(0)
+        m_snap_stop.recordSince(start);
     }
 
+    /* the capture runs the sensor's own AF, flash and exposure sequence */
+    m_ctrls.invalidate();
+
     memset(&m_events_c, 0, sizeof(m_events_c));
     m_events_c.fd = m_cam_fd;
     m_events_c.events = POLLIN | POLLERR;
 
-    LOG_TIME_START(1) // prepare
+    start = systemTime(SYSTEM_TIME_MONOTONIC);
     int nframe = 1;
 
-    ret = fimc_v4l2_enum_fmt(m_cam_fd,m_snapshot_v4lformat);
+    ret = checkFormat(m_cam_fd, m_snapshot_v4lformat);
     CHECK(ret);
     ret = fimc_v4l2_s_fmt_cap(m_cam_fd, m_snapshot_width, m_snapshot_height, V4L2_PIX_FMT_JPEG);
     CHECK(ret);
-    ret = fimc_v4l2_reqbufs(m_cam_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE, nframe);
+    ret = fimc_v4l2_reqbufs(m_cam_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE, nframe, V4L2_MEMORY_MMAP);
     CHECK(ret);
-    ret = fimc_v4l2_querybuf(m_cam_fd, &m_capture_buf, V4L2_BUF_TYPE_VIDEO_CAPTURE);
+    ret = fimc_v4l2_querybuf(m_cam_fd, &m_capture_buf, V4L2_BUF_TYPE_VIDEO_CAPTURE, 0);
     CHECK(ret);
 
     ret = fimc_v4l2_qbuf(m_cam_fd, 0);
@@ -1265,7 +1785,7 @@ int SecCamera::setSnapshotCmd(void)
     ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_CAPTURE, 0);
     CHECK(ret);
 
-    LOG_TIME_END(1)
+    m_snap_prepare.recordSince(start);
 
     return 0;
 }
@@ -1275,6 +1795,7 @@ int SecCamera::endSnapshot(void)
     int ret;
 
     ALOGI("%s :", __func__);
+    releaseSnapshotEncoder();
     if (m_capture_buf.start) {
         munmap(m_capture_buf.start, m_capture_buf.length);
         ALOGI("munmap():virt. addr %p size = %d\n",
@@ -1294,13 +1815,12 @@ unsigned char* SecCamera::getJpeg(int *jpeg_size, unsigned int *phyaddr)
 
     int index, ret = 0;
     unsigned char *addr;
-
-    LOG_TIME_DEFINE(2)
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
 
     // capture
     ret = fimc_poll(&m_events_c);
     CHECK_PTR(ret);
-    index = fimc_v4l2_dqbuf(m_cam_fd);
+    index = fimc_v4l2_dqbuf(m_cam_fd, V4L2_MEMORY_MMAP);
     if (index != 0) {
         ALOGE("ERR(%s):wrong index = %d\n", __func__, index);
         return NULL;
@@ -1321,16 +1841,18 @@ unsigned char* SecCamera::getJpeg(int *jpeg_size, unsigned int *phyaddr)
 
     addr = (unsigned char*)(m_capture_buf.start) + main_offset;
     *phyaddr = getPhyAddrY(index) + m_postview_offset;
+    m_snap_capture.recordSince(start);
 
-    LOG_TIME_START(2) // post
+    start = systemTime(SYSTEM_TIME_MONOTONIC);
     ret = fimc_v4l2_streamoff(m_cam_fd);
     CHECK_PTR(ret);
-    LOG_TIME_END(2)
+    m_snap_post.recordSince(start);
 
     return addr;
 }
 
-int SecCamera::getExif(unsigned char *pExifDst, unsigned char *pThumbSrc)
+int SecCamera::getExif(unsigned char *pExifDst, unsigned char *pThumbSrc,
+                       int width, int height)
 {
     JpegEncoder jpgEnc;
 
@@ -1389,6 +1911,9 @@ int SecCamera::getExif(unsigned char *pExifDst, unsigned char *pThumbSrc)
     unsigned int exifSize;
 
     setExifChangedAttribute();
+    /* the image may not be a full snapshot, e.g. a zero shutter lag frame */
+    mExifInfo.width = width;
+    mExifInfo.height = height;
 
     ALOGV("%s: calling jpgEnc.makeExif, mExifInfo.width set to %d, height to %d\n",
          __func__, mExifInfo.width, mExifInfo.height);
@@ -1433,37 +1958,35 @@ int SecCamera::getPostViewOffset(void)
     return m_postview_offset;
 }
 
-int SecCamera::getSnapshotAndJpeg(unsigned char *yuv_buf, unsigned char *jpeg_buf,
-                                            unsigned int *output_size)
+/*
+ * Capture one YUV frame.  The returned buffer is the driver's and stays
+ * mapped until endSnapshot().
+ */
+unsigned char *SecCamera::getSnapshot(void)
 {
     ALOGV("%s :", __func__);
 
     int index;
-    //unsigned int addr;
-    unsigned char *addr;
     int ret = 0;
-
-    LOG_TIME_DEFINE(0)
-    LOG_TIME_DEFINE(1)
-    LOG_TIME_DEFINE(2)
-    LOG_TIME_DEFINE(3)
-    LOG_TIME_DEFINE(4)
-    LOG_TIME_DEFINE(5)
+    nsecs_t start;
 
     //fimc_v4l2_streamoff(m_cam_fd); [zzangdol] remove - it is separate in HWInterface with camera_id
 
     if (m_cam_fd <= 0) {
         ALOGE("ERR(%s):Camera was closed\n", __func__);
-        return -1;
+        return NULL;
     }
 
     if (m_flag_camera_start > 0) {
-        LOG_TIME_START(0)
+        start = systemTime(SYSTEM_TIME_MONOTONIC);
         ALOGW("WARN(%s):Camera was in preview, should have been stopped\n", __func__);
         stopPreview();
-        LOG_TIME_END(0)
+        m_snap_stop.recordSince(start);
     }
 
+    /* the capture runs the sensor's own AF, flash and exposure sequence */
+    m_ctrls.invalidate();
+
     memset(&m_events_c, 0, sizeof(m_events_c));
     m_events_c.fd = m_cam_fd;
     m_events_c.events = POLLIN | POLLERR;
@@ -1489,46 +2012,175 @@ int SecCamera::getSnapshotAndJpeg(unsigned char *yuv_buf, unsigned char *jpeg_bu
         ALOGV("SnapshotFormat:UnknownFormat");
 #endif
 
-    LOG_TIME_START(1) // prepare
+    start = systemTime(SYSTEM_TIME_MONOTONIC);
     int nframe = 1;
 
-    ret = fimc_v4l2_enum_fmt(m_cam_fd,m_snapshot_v4lformat);
-    CHECK(ret);
+    ret = checkFormat(m_cam_fd, m_snapshot_v4lformat);
+    CHECK_PTR(ret);
     // FFC: Swap width and height
     ret = fimc_v4l2_s_fmt_cap(m_cam_fd, m_snapshot_height, m_snapshot_width, m_snapshot_v4lformat);
-    CHECK(ret);
-    ret = fimc_v4l2_reqbufs(m_cam_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE, nframe);
-    CHECK(ret);
-    ret = fimc_v4l2_querybuf(m_cam_fd, &m_capture_buf, V4L2_BUF_TYPE_VIDEO_CAPTURE);
-    CHECK(ret);
+    CHECK_PTR(ret);
+    ret = fimc_v4l2_reqbufs(m_cam_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE, nframe, V4L2_MEMORY_MMAP);
+    CHECK_PTR(ret);
+    ret = fimc_v4l2_querybuf(m_cam_fd, &m_capture_buf, V4L2_BUF_TYPE_VIDEO_CAPTURE, 0);
+    CHECK_PTR(ret);
 
     ret = fimc_v4l2_qbuf(m_cam_fd, 0);
-    CHECK(ret);
+    CHECK_PTR(ret);
 
     ret = fimc_v4l2_streamon(m_cam_fd);
-    CHECK(ret);
-    LOG_TIME_END(1)
+    CHECK_PTR(ret);
+    m_snap_prepare.recordSince(start);
 
-    LOG_TIME_START(2) // capture
+    start = systemTime(SYSTEM_TIME_MONOTONIC);
     fimc_poll(&m_events_c);
-    index = fimc_v4l2_dqbuf(m_cam_fd);
+    index = fimc_v4l2_dqbuf(m_cam_fd, V4L2_MEMORY_MMAP);
     fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_STREAM_PAUSE, 0);
     ALOGV("\nsnapshot dequeued buffer = %d snapshot_width = %d snapshot_height = %d\n\n",
             index, m_snapshot_width, m_snapshot_height);
+    m_snap_capture.recordSince(start);
+
+    start = systemTime(SYSTEM_TIME_MONOTONIC);
+    fimc_v4l2_streamoff(m_cam_fd);
+    m_snap_post.recordSince(start);
+
+    if (index != 0) {
+        ALOGE("ERR(%s):wrong index = %d\n", __func__, index);
+        return NULL;
+    }
+
+    return (unsigned char *)m_capture_buf.start;
+}
+
+/*
+ * Burst capture: the snapshot stream stays on with several buffers so
+ * the sensor can read out the next frame while the caller encodes the
+ * previous one.  Frames from getBurstFrame() go back to the driver
+ * with releaseBurstFrame().
+ */
+int SecCamera::startBurst(int nbufs)
+{
+    ALOGV("%s(%d)", __func__, nbufs);
+
+    int ret;
+
+    if (m_cam_fd <= 0) {
+        ALOGE("ERR(%s):Camera was closed\n", __func__);
+        return -1;
+    }
+
+    if (m_flag_camera_start > 0) {
+        ALOGW("WARN(%s):Camera was in preview, should have been stopped\n", __func__);
+        stopPreview();
+    }
+
+    if (nbufs > MAX_BUFFERS)
+        nbufs = MAX_BUFFERS;
+
+    /* the capture runs the sensor's own AF, flash and exposure sequence */
+    m_ctrls.invalidate();
+
+    memset(&m_events_c, 0, sizeof(m_events_c));
+    m_events_c.fd = m_cam_fd;
+    m_events_c.events = POLLIN | POLLERR;
+
+    ret = checkFormat(m_cam_fd, m_snapshot_v4lformat);
+    CHECK(ret);
+    // FFC: Swap width and height
+    ret = fimc_v4l2_s_fmt_cap(m_cam_fd, m_snapshot_height, m_snapshot_width, m_snapshot_v4lformat);
+    CHECK(ret);
+    ret = fimc_v4l2_reqbufs(m_cam_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE, nbufs, V4L2_MEMORY_MMAP);
+    CHECK(ret);
+    if (ret < nbufs)
+        nbufs = ret;
+
+    for (int i = 0; i < nbufs; i++) {
+        ret = fimc_v4l2_querybuf(m_cam_fd, &m_burst_buf[i], V4L2_BUF_TYPE_VIDEO_CAPTURE, i);
+        if (ret == 0)
+            ret = fimc_v4l2_qbuf(m_cam_fd, i);
+        if (ret < 0) {
+            m_burst_count = i + 1;
+            stopBurst();
+            return -1;
+        }
+    }
+    m_burst_count = nbufs;
+
+    ret = fimc_v4l2_streamon(m_cam_fd);
+    if (ret < 0) {
+        stopBurst();
+        return -1;
+    }
+
+    return nbufs;
+}
+
+unsigned char *SecCamera::getBurstFrame(int *index)
+{
+    int ret;
+
+    ret = fimc_poll(&m_events_c);
+    if (ret <= 0)
+        return NULL;
 
-    LOG_TIME_END(2)
+    *index = fimc_v4l2_dqbuf(m_cam_fd, V4L2_MEMORY_MMAP);
+    if (*index < 0 || *index >= m_burst_count) {
+        ALOGE("ERR(%s):wrong index = %d\n", __func__, *index);
+        return NULL;
+    }
+
+    return (unsigned char *)m_burst_buf[*index].start;
+}
+
+int SecCamera::releaseBurstFrame(int index)
+{
+    if (index < 0 || index >= m_burst_count)
+        return -1;
+
+    return fimc_v4l2_qbuf(m_cam_fd, index);
+}
+
+int SecCamera::stopBurst(void)
+{
+    ALOGV("%s :", __func__);
+
+    if (m_burst_count == 0)
+        return 0;
 
-    ALOGI("%s : calling memcpy from m_capture_buf", __func__);
-    memcpy(yuv_buf, (unsigned char*)m_capture_buf.start, m_snapshot_width * m_snapshot_height * 2);
-    LOG_TIME_START(5) // post
     fimc_v4l2_streamoff(m_cam_fd);
-    LOG_TIME_END(5)
 
-    LOG_CAMERA("getSnapshotAndJpeg intervals : stopPreview(%lu), prepare(%lu),"
-                " capture(%lu), memcpy(%lu), yuv2Jpeg(%lu), post(%lu)  us",
-                    LOG_TIME(0), LOG_TIME(1), LOG_TIME(2), LOG_TIME(3), LOG_TIME(4), LOG_TIME(5));
-    /* JPEG encoding */
-    JpegEncoder jpgEnc;
+    for (int i = 0; i < m_burst_count; i++) {
+        if (m_burst_buf[i].start) {
+            munmap(m_burst_buf[i].start, m_burst_buf[i].length);
+            m_burst_buf[i].start = NULL;
+            m_burst_buf[i].length = 0;
+        }
+    }
+    m_burst_count = 0;
+
+    fimc_v4l2_reqbufs(m_cam_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE, 0, V4L2_MEMORY_MMAP);
+
+    releaseSnapshotEncoder();
+
+    return 0;
+}
+
+/*
+ * Encode a frame returned by getSnapshot() or getBurstFrame().  The
+ * JPEG is left in the encoder's output buffer, valid until
+ * releaseSnapshotEncoder(), so the caller can assemble the final
+ * image with a single copy.  The frame itself is still copied into
+ * the encoder's input buffer, the hardware only reads its own memory.
+ */
+unsigned char *SecCamera::encodeSnapshot(const unsigned char *yuv_buf, int width, int height,
+                                         unsigned int *output_size)
+{
+    ALOGV("%s :", __func__);
+
+    if (m_snapshot_enc == NULL)
+        m_snapshot_enc = new JpegEncoder;
+    JpegEncoder &jpgEnc = *m_snapshot_enc;
+
     int inFormat = JPG_MODESEL_YCBCR;
     int outFormat = JPG_422;
 
@@ -1565,22 +2217,21 @@ int SecCamera::getSnapshotAndJpeg(unsigned char *yuv_buf, unsigned char *jpeg_bu
 
     if (jpgEnc.setConfig(JPEG_SET_ENCODE_QUALITY, jpegQuality) != JPG_SUCCESS)
         ALOGE("[JPEG_SET_ENCODE_QUALITY] Error\n");
-    if (jpgEnc.setConfig(JPEG_SET_ENCODE_WIDTH, m_snapshot_width) != JPG_SUCCESS)
+    if (jpgEnc.setConfig(JPEG_SET_ENCODE_WIDTH, width) != JPG_SUCCESS)
         ALOGE("[JPEG_SET_ENCODE_WIDTH] Error\n");
 
-    if (jpgEnc.setConfig(JPEG_SET_ENCODE_HEIGHT, m_snapshot_height) != JPG_SUCCESS)
+    if (jpgEnc.setConfig(JPEG_SET_ENCODE_HEIGHT, height) != JPG_SUCCESS)
         ALOGE("[JPEG_SET_ENCODE_HEIGHT] Error\n");
 
-    unsigned int snapshot_size = m_snapshot_width * m_snapshot_height * 2;
+    unsigned int snapshot_size = width * height * 2;
     unsigned char *pInBuf = (unsigned char *)jpgEnc.getInBuf(snapshot_size);
 
     if (pInBuf == NULL) {
         ALOGE("JPEG input buffer is NULL!!\n");
-        return -1;
+        return NULL;
     }
     memcpy(pInBuf, yuv_buf, snapshot_size);
 
-    setExifChangedAttribute();
     jpgEnc.encode(output_size, NULL);
 
     uint64_t outbuf_size;
@@ -1588,12 +2239,21 @@ int SecCamera::getSnapshotAndJpeg(unsigned char *yuv_buf, unsigned char *jpeg_bu
 
     if (pOutBuf == NULL) {
         ALOGE("JPEG output buffer is NULL!!\n");
-        return -1;
+        return NULL;
     }
 
-    memcpy(jpeg_buf, pOutBuf, outbuf_size);
+    return pOutBuf;
+}
 
-    return 0;
+/* every encoder instance shares the one JPEG block, so the image's
+ * must be gone before the next frame's thumbnail is encoded
+ */
+void SecCamera::releaseSnapshotEncoder(void)
+{
+    if (m_snapshot_enc) {
+        delete m_snapshot_enc;
+        m_snapshot_enc = NULL;
+    }
 }
 
 
@@ -1690,6 +2350,11 @@ int SecCamera::getCameraId(void)
     return m_camera_id;
 }
 
+bool SecCamera::isInitialized(void)
+{
+    return m_flag_init != 0;
+}
+
 // -----------------------------------
 
 int SecCamera::setAutofocus(void)
@@ -1701,6 +2366,13 @@ int SecCamera::setAutofocus(void)
         return -1;
     }
 
+    /* drop a cancel that came in while no search was running */
+    if (m_af_cancel_fd > -1) {
+        uint64_t count;
+        read(m_af_cancel_fd, &count, sizeof(count));
+    }
+    m_af_cancel_time = 0;
+
     if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_SET_AUTO_FOCUS, AUTO_FOCUS_ON) < 0) {
             ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_SET_AUTO_FOCUS", __func__);
         return -1;
@@ -1709,18 +2381,92 @@ int SecCamera::setAutofocus(void)
     return 0;
 }
 
+/* sleep until the autofocus result may have changed: a control event,
+ * the timeout, or a cancel, which returns 1
+ */
+int SecCamera::waitAutoFocus(int timeout_us)
+{
+    struct pollfd fds[2];
+    int nfds = 0;
+
+    if (m_af_cancel_fd > -1) {
+        fds[nfds].fd = m_af_cancel_fd;
+        fds[nfds].events = POLLIN;
+        fds[nfds].revents = 0;
+        nfds++;
+    }
+    if (m_af_events) {
+        fds[nfds].fd = m_cam_fd;
+        fds[nfds].events = POLLPRI;
+        fds[nfds].revents = 0;
+        nfds++;
+    }
+
+    int ret = poll(fds, nfds, (timeout_us + 999) / 1000);
+    if (ret < 0) {
+        if (errno == EINTR)
+            return 0;
+        ALOGE("ERR(%s):poll failed (%s)", __func__, strerror(errno));
+        return -1;
+    }
+    if (ret == 0)
+        return 0;
+
+    if (m_af_cancel_fd > -1 && (fds[0].revents & POLLIN))
+        return 1;
+    if (m_af_events)
+        fimc_v4l2_drain_events(m_cam_fd);
+    return 0;
+}
+
 int SecCamera::getAutoFocusResult(void)
 {
-    int af_result, count, ret;
+    int af_result, ret;
+    int delay_us = AF_POLL_MIN_US;
+    bool canceled = false;
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    nsecs_t now = start;
 
-    for (count = 0; count < FIRST_AF_SEARCH_COUNT; count++) {
+    for (;;) {
         ret = fimc_v4l2_g_ctrl(m_cam_fd, V4L2_CID_CAMERA_AUTO_FOCUS_RESULT_FIRST);
         if (ret != AF_PROGRESS)
             break;
-        usleep(AF_DELAY);
+
+        now = systemTime(SYSTEM_TIME_MONOTONIC);
+        int left_us = AF_TIMEOUT_US - (int)((now - start) / 1000);
+        if (left_us <= 0)
+            break;
+
+        /* a search takes hundreds of ms; back off so a long one does
+         * not keep the sensor's i2c busy with result reads
+         */
+        int wait_us = m_af_events ? AF_EVENT_WAIT_US : delay_us;
+        if (wait_us > left_us)
+            wait_us = left_us;
+        if (!m_af_events && delay_us < AF_POLL_MAX_US)
+            delay_us += delay_us / 2;
+
+        int woke = waitAutoFocus(wait_us);
+        if (woke == 1) {
+            canceled = true;
+            break;
+        }
+        if (woke < 0)
+            usleep(wait_us);
     }
 
-    if ((count >= FIRST_AF_SEARCH_COUNT) || (ret != AF_SUCCESS)) {
+    now = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (canceled) {
+        m_af_cancels++;
+        if (m_af_cancel_time)
+            m_af_cancel_us = (int)((now - m_af_cancel_time) / 1000);
+    } else {
+        m_af_searches++;
+        m_af_last_us = (int)((now - start) / 1000);
+        m_af_time.record(m_af_last_us);
+    }
+
+    if (canceled || (ret != AF_SUCCESS)) {
         ALOGV("%s : 1st AF timed out, failed, or was canceled", __func__);
         af_result = 0;
         goto finish_auto_focus;
@@ -1751,6 +2497,13 @@ int SecCamera::cancelAutofocus(void)
         return -1;
     }
 
+    /* wake a search waiting in getAutoFocusResult() */
+    if (m_af_cancel_fd > -1) {
+        uint64_t one = 1;
+        m_af_cancel_time = systemTime(SYSTEM_TIME_MONOTONIC);
+        write(m_af_cancel_fd, &one, sizeof(one));
+    }
+
     return 0;
 }
 
@@ -1829,7 +2582,7 @@ int SecCamera::setFrameRate(int frame_rate)
     if (m_params->capture.timeperframe.denominator != (unsigned)frame_rate) {
         m_params->capture.timeperframe.denominator = frame_rate;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_FRAME_RATE, frame_rate) < 0) {
+            if (setCtrlCached(V4L2_CID_CAMERA_FRAME_RATE, frame_rate) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_FRAME_RATE", __func__);
                 return -1;
             }
@@ -1889,7 +2642,7 @@ int SecCamera::setWhiteBalance(int white_balance)
     if (m_params->white_balance != white_balance) {
         m_params->white_balance = white_balance;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_WHITE_BALANCE, white_balance) < 0) {
+            if (setCtrlCached(V4L2_CID_CAMERA_WHITE_BALANCE, white_balance) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_WHITE_BALANCE", __func__);
                 return -1;
             }
@@ -1921,7 +2674,7 @@ int SecCamera::setBrightness(int brightness)
     if (m_params->brightness != brightness) {
         m_params->brightness = brightness;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_BRIGHTNESS, brightness) < 0) {
+            if (setCtrlCached(V4L2_CID_CAMERA_BRIGHTNESS, brightness) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_BRIGHTNESS", __func__);
                 return -1;
             }
@@ -1951,7 +2704,7 @@ int SecCamera::setImageEffect(int image_effect)
     if (m_params->effects != image_effect) {
         m_params->effects = image_effect;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_EFFECT, image_effect) < 0) {
+            if (setCtrlCached(V4L2_CID_CAMERA_EFFECT, image_effect) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_EFFECT", __func__);
                 return -1;
             }
@@ -1980,7 +2733,7 @@ int SecCamera::setAntiBanding(int anti_banding)
     if (m_anti_banding != anti_banding) {
         m_anti_banding = anti_banding;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_ANTI_BANDING, anti_banding) < 0) {
+            if (setCtrlCached(V4L2_CID_CAMERA_ANTI_BANDING, anti_banding) < 0) {
                  ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_ANTI_BANDING", __func__);
                  return -1;
             }
@@ -2003,7 +2756,7 @@ int SecCamera::setSceneMode(int scene_mode)
     if (m_params->scene_mode != scene_mode) {
         m_params->scene_mode = scene_mode;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_SCENE_MODE, scene_mode) < 0) {
+            if (setCtrlCached(V4L2_CID_CAMERA_SCENE_MODE, scene_mode) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_SCENE_MODE", __func__);
                 return -1;
             }
@@ -2032,7 +2785,7 @@ int SecCamera::setFlashMode(int flash_mode)
     if (m_params->flash_mode != flash_mode) {
         m_params->flash_mode = flash_mode;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_FLASH_MODE, flash_mode) < 0) {
+            if (setCtrlCached(V4L2_CID_CAMERA_FLASH_MODE, flash_mode) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_FLASH_MODE", __func__);
                 return -1;
             }
@@ -2060,7 +2813,7 @@ int SecCamera::setISO(int iso_value)
     if (m_params->iso != iso_value) {
         m_params->iso = iso_value;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_ISO, iso_value) < 0) {
+            if (setCtrlCached(V4L2_CID_CAMERA_ISO, iso_value) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_ISO", __func__);
                 return -1;
             }
@@ -2089,7 +2842,7 @@ int SecCamera::setContrast(int contrast_value)
     if (m_params->contrast != contrast_value) {
         m_params->contrast = contrast_value;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_CONTRAST, contrast_value) < 0) {
+            if (setCtrlCached(V4L2_CID_CAMERA_CONTRAST, contrast_value) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_CONTRAST", __func__);
                 return -1;
             }
@@ -2118,7 +2871,7 @@ int SecCamera::setSaturation(int saturation_value)
     if (m_params->saturation != saturation_value) {
         m_params->saturation = saturation_value;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_SATURATION, saturation_value) < 0) {
+            if (setCtrlCached(V4L2_CID_CAMERA_SATURATION, saturation_value) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_SATURATION", __func__);
                 return -1;
             }
@@ -2147,7 +2900,7 @@ int SecCamera::setSharpness(int sharpness_value)
     if (m_params->sharpness != sharpness_value) {
         m_params->sharpness = sharpness_value;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_SHARPNESS, sharpness_value) < 0) {
+            if (setCtrlCached(V4L2_CID_CAMERA_SHARPNESS, sharpness_value) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_SHARPNESS", __func__);
                 return -1;
             }
@@ -2176,7 +2929,7 @@ int SecCamera::setWDR(int wdr_value)
     if (m_wdr != wdr_value) {
         m_wdr = wdr_value;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_WDR, wdr_value) < 0) {
+            if (setCtrlCached(V4L2_CID_CAMERA_WDR, wdr_value) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_WDR", __func__);
                 return -1;
             }
@@ -2205,7 +2958,7 @@ int SecCamera::setAntiShake(int anti_shake)
     if (m_anti_shake != anti_shake) {
         m_anti_shake = anti_shake;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_ANTI_SHAKE, anti_shake) < 0) {
+            if (setCtrlCached(V4L2_CID_CAMERA_ANTI_SHAKE, anti_shake) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_ANTI_SHAKE", __func__);
                 return -1;
             }
@@ -2235,7 +2988,7 @@ int SecCamera::setMetering(int metering_value)
     if (m_params->metering != metering_value) {
         m_params->metering = metering_value;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_METERING, metering_value) < 0) {
+            if (setCtrlCached(V4L2_CID_CAMERA_METERING, metering_value) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_METERING", __func__);
                 return -1;
             }
@@ -2264,7 +3017,7 @@ int SecCamera::setJpegQuality(int jpeg_quality)
     if (m_jpeg_quality != jpeg_quality) {
         m_jpeg_quality = jpeg_quality;
         if (m_flag_camera_start && (m_camera_id == CAMERA_ID_BACK)) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAM_JPEG_QUALITY, jpeg_quality) < 0) {
+            if (setCtrlCached(V4L2_CID_CAM_JPEG_QUALITY, jpeg_quality) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAM_JPEG_QUALITY", __func__);
                 return -1;
             }
@@ -2293,7 +3046,7 @@ int SecCamera::setZoom(int zoom_level)
     if (m_zoom_level != zoom_level) {
         m_zoom_level = zoom_level;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_ZOOM, zoom_level) < 0) {
+            if (setCtrlCached(V4L2_CID_CAMERA_ZOOM, zoom_level) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_ZOOM", __func__);
                 return -1;
             }
@@ -2383,7 +3136,7 @@ int SecCamera::setSmartAuto(int smart_auto)
     if (m_smart_auto != smart_auto) {
         m_smart_auto = smart_auto;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_SMART_AUTO, smart_auto) < 0) {
+            if (setCtrlCached(V4L2_CID_CAMERA_SMART_AUTO, smart_auto) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_SMART_AUTO", __func__);
                 return -1;
             }
@@ -2427,7 +3180,7 @@ int SecCamera::setBeautyShot(int beauty_shot)
     if (m_beauty_shot != beauty_shot) {
         m_beauty_shot = beauty_shot;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_BEAUTY_SHOT, beauty_shot) < 0) {
+            if (setCtrlCached(V4L2_CID_CAMERA_BEAUTY_SHOT, beauty_shot) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_BEAUTY_SHOT", __func__);
                 return -1;
             }
@@ -2458,7 +3211,7 @@ int SecCamera::setVintageMode(int vintage_mode)
     if (m_vintage_mode != vintage_mode) {
         m_vintage_mode = vintage_mode;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_VINTAGE_MODE, vintage_mode) < 0) {
+            if (setCtrlCached(V4L2_CID_CAMERA_VINTAGE_MODE, vintage_mode) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_VINTAGE_MODE", __func__);
                 return -1;
             }
@@ -2488,7 +3241,7 @@ int SecCamera::setFocusMode(int focus_mode)
         m_params->focus_mode = focus_mode;
 
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_FOCUS_MODE, focus_mode) < 0) {
+            if (setCtrlCached(V4L2_CID_CAMERA_FOCUS_MODE, focus_mode) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_FOCUS_MODE", __func__);
                 return -1;
             }
@@ -2513,12 +3266,12 @@ int SecCamera::setFaceDetect(int face_detect)
         m_face_detect = face_detect;
         if (m_flag_camera_start) {
             if (m_face_detect != FACE_DETECTION_OFF) {
-                if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_FOCUS_MODE, FOCUS_MODE_AUTO) < 0) {
+                if (setCtrlCached(V4L2_CID_CAMERA_FOCUS_MODE, FOCUS_MODE_AUTO) < 0) {
                     ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_FOCUS_MODin face detecion", __func__);
                     return -1;
                 }
             }
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_FACE_DETECTION, face_detect) < 0) {
+            if (setCtrlCached(V4L2_CID_CAMERA_FACE_DETECTION, face_detect) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_FACE_DETECTION", __func__);
                 return -1;
             }
@@ -2689,7 +3442,7 @@ int SecCamera::setGamma(int gamma)
      if (m_video_gamma != gamma) {
          m_video_gamma = gamma;
          if (m_flag_camera_start) {
-             if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_SET_GAMMA, gamma) < 0) {
+             if (setCtrlCached(V4L2_CID_CAMERA_SET_GAMMA, gamma) < 0) {
                  ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_SET_GAMMA", __func__);
                  return -1;
              }
@@ -2713,7 +3466,7 @@ int SecCamera::setSlowAE(int slow_ae)
      if (m_slow_ae!= slow_ae) {
          m_slow_ae = slow_ae;
          if (m_flag_camera_start) {
-             if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_SET_SLOW_AE, slow_ae) < 0) {
+             if (setCtrlCached(V4L2_CID_CAMERA_SET_SLOW_AE, slow_ae) < 0) {
                  ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_SET_SLOW_AE", __func__);
                  return -1;
              }
@@ -2833,7 +3586,7 @@ int SecCamera::setBlur(int blur_level)
     if (m_blur_level != blur_level) {
         m_blur_level = blur_level;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_VGA_BLUR, blur_level) < 0) {
+            if (setCtrlCached(V4L2_CID_CAMERA_VGA_BLUR, blur_level) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_VGA_BLUR", __func__);
                 return -1;
             }
@@ -2883,6 +3636,10 @@ const __u8* SecCamera::getCameraSensorName(void)
 {
     ALOGV("%s", __func__);
 
+    if (m_camera_id >= CAMERA_ID_BACK && m_camera_id <= CAMERA_ID_FRONT &&
+            m_sensor_caps[m_camera_id].valid)
+        return (const __u8 *)m_sensor_caps[m_camera_id].name;
+
     return fimc_v4l2_enuminput(m_cam_fd, getCameraId());
 }
 
@@ -3233,6 +3990,39 @@ status_t SecCamera::dump(int fd)
     String8 result;
     snprintf(buffer, 255, "dump(%d)\n", fd);
     result.append(buffer);
+
+    m_preview_lock.lock();
+    snprintf(buffer, 255, " preview buffers: %d/%d, %d queued, %d starved, refs",
+             m_preview_nbufs, m_preview_nbufs_req, m_preview_queued, m_preview_starved);
+    result.append(buffer);
+    for (int i = 0; i < m_preview_nbufs; i++) {
+        snprintf(buffer, 255, " %d", m_preview_refs[i]);
+        result.append(buffer);
+    }
+    m_preview_lock.unlock();
+    result.append("\n");
+    snprintf(buffer, 255, " record buffers: %d/%d\n", m_record_nbufs, m_record_nbufs_req);
+    result.append(buffer);
+    m_ctrls.dump(result);
+    snprintf(buffer, 255, " sensor caps: back(%s) front(%s), %d warm inits, %d cold, "
+             "formats %d/%d\n",
+             m_sensor_caps[CAMERA_ID_BACK].valid ? m_sensor_caps[CAMERA_ID_BACK].name : "-",
+             m_sensor_caps[CAMERA_ID_FRONT].valid ? m_sensor_caps[CAMERA_ID_FRONT].name : "-",
+             m_caps_hits, m_caps_misses, m_node_formats[0].count, m_node_formats[1].count);
+    result.append(buffer);
+    snprintf(buffer, 255, " autofocus (%s): %d searches, last %d us, "
+             "%d cancels, last stopped %d us after cancel\n",
+             m_af_events ? "events" : "polled", m_af_searches, m_af_last_us,
+             m_af_cancels, m_af_cancel_us);
+    result.append(buffer);
+    result.append(" timings:\n");
+    m_snap_stop.dump(result);
+    m_snap_prepare.dump(result);
+    m_snap_capture.dump(result);
+    m_snap_post.dump(result);
+    m_af_time.dump(result);
+    m_preview_clock.dump(result);
+    m_record_clock.dump(result);
     ::write(fd, result.string(), result.size());
     return NO_ERROR;
 }
@@ -35,12 +35,14 @@
 #include <sys/stat.h>
 
 #include <utils/RefBase.h>
+#include <utils/threads.h>
 #include <linux/videodev2.h>
 #include <videodev2_samsung.h>
 
 #include <utils/String8.h>
 
 #include "JpegEncoder.h"
+#include "SecCameraMetrics.h"
 
 namespace android {
 
@@ -50,26 +52,9 @@ namespace android {
 #if defined(LOG_NDEBUG) && LOG_NDEBUG == 0
 #define LOG_CAMERA ALOGD
 #define LOG_CAMERA_PREVIEW ALOGD
-
-#define LOG_TIME_DEFINE(n) \
-    struct timeval time_start_##n, time_stop_##n; unsigned long log_time_##n = 0;
-
-#define LOG_TIME_START(n) \
-    gettimeofday(&time_start_##n, NULL);
-
-#define LOG_TIME_END(n) \
-    gettimeofday(&time_stop_##n, NULL); log_time_##n = measure_time(&time_start_##n, &time_stop_##n);
-
-#define LOG_TIME(n) \
-    log_time_##n
-
 #else
 #define LOG_CAMERA(...)
 #define LOG_CAMERA_PREVIEW(...)
-#define LOG_TIME_DEFINE(n)
-#define LOG_TIME_START(n)
-#define LOG_TIME_END(n)
-#define LOG_TIME(n)
 #endif
 
 #define JOIN(x, y) JOIN_AGAIN(x, y)
@@ -147,12 +132,28 @@ namespace android {
 
 #define BPP             2
 #define MIN(x, y)       (((x) < (y)) ? (x) : (y))
-#define MAX_BUFFERS     8
+/* preview buffers FIMC needs queued to stream without dropping frames,
+ * plus the most that display and callback consumers hold at once.
+ * MAX_BUFFERS bounds the per-stream arrays; the count each stream
+ * actually gets is set at run time and trimmed to the FIMC memory.
+ */
+#define PREVIEW_DRIVER_BUFFERS      4
+#define PREVIEW_CONSUMER_BUFFERS    4
+#define MAX_BUFFERS     (PREVIEW_DRIVER_BUFFERS + PREVIEW_CONSUMER_BUFFERS)
+#define MIN_STREAM_BUFFERS          2
 
 #define FIRST_AF_SEARCH_COUNT 600
 #define AF_PROGRESS 0x05
 #define AF_SUCCESS 0x02
 #define AF_DELAY 10000
+/* give up on a search after as long as the old 600 x 10 ms poll did;
+ * without control events the result is polled between these intervals
+ */
+#define AF_TIMEOUT_US       (FIRST_AF_SEARCH_COUNT * AF_DELAY)
+#define AF_POLL_MIN_US      2000
+#define AF_POLL_MAX_US      20000
+/* with control events, still look now and then in case one is lost */
+#define AF_EVENT_WAIT_US    100000
 
 /*
  * V 4 L 2   F I M C   E X T E N S I O N S
@@ -208,6 +209,31 @@ struct camsensor_date_info {
     unsigned int date;
 };
 
+/* last value the driver accepted for each sensor control.  set()
+ * does not write a value the sensor already holds.
+ */
+class SecCameraCtrlCache {
+public:
+    SecCameraCtrlCache();
+
+    int             set(int fd, unsigned int id, int value);
+    void            invalidate(void);
+    void            dump(String8 &result) const;
+
+private:
+    enum { MAX_CTRLS = 48 };
+
+    int             find(unsigned int id) const;
+
+    unsigned int    m_cache_id[MAX_CTRLS];
+    int             m_cache_value[MAX_CTRLS];
+    int             m_cache_count;
+
+    unsigned int    m_written;
+    unsigned int    m_skipped;
+    mutable Mutex   m_lock;
+};
+
 class SecCamera : public virtual RefBase {
 public:
 
@@ -289,22 +315,33 @@ public:
     status_t dump(int fd);
 
     int             getCameraId(void);
+    bool            isInitialized(void);
 
     int             startPreview(void);
     int             stopPreview(void);
 
     int             startRecord(void);
     int             stopRecord(void);
-    int             getRecordFrame(void);
+    int             setRecordBufferCount(int count);
+    int             getRecordBufferCount(void);
+    int             getRecordFrame(nsecs_t *timestamp);
     int             releaseRecordFrame(int index);
     unsigned int    getRecPhyAddrY(int);
     unsigned int    getRecPhyAddrC(int);
+    int             acquireRecordFrame(int index);
+    unsigned char*  getRecordFrameAddr(int index, unsigned char **cbcr);
+    void            getRecordingSize(int *width, int *height);
 
-    int             getPreview(void);
+    int             getPreview(nsecs_t *timestamp);
     int             setPreviewSize(int width, int height, int pixel_format);
     int             getPreviewSize(int *width, int *height, int *frame_size);
     int             getPreviewMaxSize(int *width, int *height);
     int             getPreviewPixelFormat(void);
+    int             clearPreviewFrames(void);
+    int             setPreviewBufferCount(int count);
+    int             getPreviewBufferCount(void);
+    int             acquirePreviewFrame(int index);
+    int             releasePreviewFrame(int index);
     int             setPreviewImage(int index, unsigned char *buffer, int size);
 
     int             setSnapshotSize(int width, int height);
@@ -435,9 +472,16 @@ public:
 
     int setFrameRate(int frame_rate);
     unsigned char*  getJpeg(int*, unsigned int*);
-    int             getSnapshotAndJpeg(unsigned char *yuv_buf, unsigned char *jpeg_buf,
-                                        unsigned int *output_size);
-    int             getExif(unsigned char *pExifDst, unsigned char *pThumbSrc);
+    unsigned char*  getSnapshot(void);
+    unsigned char*  encodeSnapshot(const unsigned char *yuv_buf, int width, int height,
+                                   unsigned int *output_size);
+    void            releaseSnapshotEncoder(void);
+    int             startBurst(int nbufs);
+    unsigned char*  getBurstFrame(int *index);
+    int             releaseBurstFrame(int index);
+    int             stopBurst(void);
+    int             getExif(unsigned char *pExifDst, unsigned char *pThumbSrc,
+                            int width, int height);
 
     void            getPostViewConfig(int*, int*, int*);
     void            getThumbnailConfig(int *width, int *height, int *size);
@@ -496,9 +540,27 @@ private:
 
     int             m_cam_fd2;
     struct pollfd   m_events_c2;
+    /* record buffers, mapped so a still can be taken from them; a
+     * buffer goes back to the driver when its last holder releases it
+     */
+    struct fimc_buffer m_record_buf[MAX_BUFFERS];
+    int             m_record_refs[MAX_BUFFERS];
+    int             m_record_nbufs_req;
+    int             m_record_nbufs;
+    Mutex           m_record_lock;
     int             m_flag_record_start;
 
     int             m_preview_v4lformat;
+    /* consumer references per preview buffer; 0 means FIMC owns it */
+    int             m_preview_refs[MAX_BUFFERS];
+    /* buffers asked for and buffers FIMC gave us for mmap preview */
+    int             m_preview_nbufs_req;
+    int             m_preview_nbufs;
+    int             m_preview_queued;
+    int             m_preview_starved;
+    Mutex           m_preview_lock;
+    /* signalled when a released buffer goes back to the driver */
+    Condition       m_preview_released;
     int             m_preview_width;
     int             m_preview_height;
     int             m_preview_max_width;
@@ -539,6 +601,16 @@ private:
     int             m_caf_on_off;
     int             m_default_imei;
     int             m_camera_af_flag;
+    /* autofocus waits on this for a cancel, and on control events
+     * from m_cam_fd when the driver sends them
+     */
+    int             m_af_cancel_fd;
+    bool            m_af_events;
+    nsecs_t         m_af_cancel_time;
+    int             m_af_searches;
+    int             m_af_last_us;
+    int             m_af_cancels;
+    int             m_af_cancel_us;
 
     int             m_flag_camera_start;
 
@@ -556,9 +628,50 @@ private:
     exif_attribute_t mExifInfo;
 
     struct fimc_buffer m_capture_buf;
+    JpegEncoder     *m_snapshot_enc;
+    struct fimc_buffer m_burst_buf[MAX_BUFFERS];
+    int             m_burst_count;
     struct pollfd   m_events_c;
+    SecCameraCtrlCache m_ctrls;
+
+    /* driver answers that do not change within a process: a reopen,
+     * or a switch to the other sensor, does not ask again
+     */
+    enum {
+        MAX_CACHED_FORMATS = 16,
+    };
+
+    struct SensorCaps {
+        bool            valid;
+        char            name[32];
+    };
+
+    struct NodeFormats {
+        bool            valid;
+        int             count;
+        unsigned int    formats[MAX_CACHED_FORMATS];
+    };
+
+    SensorCaps      m_sensor_caps[CAMERA_ID_FRONT + 1];
+    NodeFormats     m_node_formats[2];
+    int             m_caps_hits;
+    int             m_caps_misses;
+
+    /* snapshot stages and autofocus searches, see dump() */
+    SecCameraHistogram m_snap_stop;
+    SecCameraHistogram m_snap_prepare;
+    SecCameraHistogram m_snap_capture;
+    SecCameraHistogram m_snap_post;
+    SecCameraHistogram m_af_time;
+    /* driver timestamps against the monotonic clock */
+    SecCameraFrameClock m_preview_clock;
+    SecCameraFrameClock m_record_clock;
 
     inline int      m_frameSize(int format, int width, int height);
+    int             queuePreviewBufferLocked(int index);
+    int             waitAutoFocus(int timeout_us);
+    int             checkFormat(int fd, unsigned int fmt);
+    int             setCtrlCached(unsigned int id, int value);
 
     void            setExifChangedAttribute();
     void            setExifFixedAttribute();
@@ -569,8 +682,6 @@ private:
     static int      jpegLineLength;
 };
 
-extern unsigned long measure_time(struct timeval *start, struct timeval *stop);
-
 }; // namespace android
 
 #endif // ANDROID_HARDWARE_CAMERA_SEC_H
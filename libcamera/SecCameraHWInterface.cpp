@@ -79,6 +79,145 @@ gralloc_module_t const* CameraHardwareSec::mGrallocHal;
 // Samsung-specific focus mode
 const char FOCUS_MODE_FACEDETECT[] = "facedetect";
 
+/* default parameters per camera id, kept for the life of the process */
+#define DEFAULT_PARAMS_CAMERAS  2
+static String8 g_default_params[DEFAULT_PARAMS_CAMERAS];
+static String8 g_default_internal_params[DEFAULT_PARAMS_CAMERAS];
+
+/* camera open times, cold is the first open of a camera id */
+static SecCameraHistogram g_open_cold("open cold");
+static SecCameraHistogram g_open_warm("open warm");
+
+/* parameter strings and the values they select, looked up by
+ * setParameters for the keys that changed
+ */
+struct ParamMap {
+    const char  *name;
+    int         value;
+};
+
+struct FocusModeMap {
+    const char  *name;
+    int         value;
+    const char  *distances;
+};
+
+struct SceneModeMap {
+    const char  *name;
+    int         value;
+    const char  *flash_mode;    /* forced by the scene, NULL for auto */
+    const char  *flash_modes;   /* supported while the scene is on */
+};
+
+static const ParamMap kPictureFormats[] = {
+    { CameraParameters::PIXEL_FORMAT_RGB565,    V4L2_PIX_FMT_RGB565 },
+    { CameraParameters::PIXEL_FORMAT_RGBA8888,  V4L2_PIX_FMT_RGB32 },
+    { CameraParameters::PIXEL_FORMAT_YUV420SP,  V4L2_PIX_FMT_NV21 },
+    { "yuv420sp_custom",                        V4L2_PIX_FMT_NV12T },
+    { "yuv420p",                                V4L2_PIX_FMT_YUV420 },
+    { "yuv422i",                                V4L2_PIX_FMT_YUYV },
+    { "uyv422i_custom",                         V4L2_PIX_FMT_UYVY }, //Zero copy UYVY format
+    { "uyv422i",                                V4L2_PIX_FMT_UYVY }, //Non-zero copy UYVY format
+    { CameraParameters::PIXEL_FORMAT_JPEG,      V4L2_PIX_FMT_YUYV },
+    { "yuv422p",                                V4L2_PIX_FMT_YUV422P },
+};
+
+static const ParamMap kIsoValues[] = {
+    { "auto",       ISO_AUTO },
+    { "ISO50",      ISO_50 },
+    { "ISO100",     ISO_100 },
+    { "ISO200",     ISO_200 },
+    { "ISO400",     ISO_400 },
+    { "ISO800",     ISO_800 },
+    { "ISO1600",    ISO_1600 },
+};
+
+static const ParamMap kWhiteBalances[] = {
+    { CameraParameters::WHITE_BALANCE_AUTO,             WHITE_BALANCE_AUTO },
+    { CameraParameters::WHITE_BALANCE_DAYLIGHT,         WHITE_BALANCE_SUNNY },
+    { CameraParameters::WHITE_BALANCE_CLOUDY_DAYLIGHT,  WHITE_BALANCE_CLOUDY },
+    { CameraParameters::WHITE_BALANCE_FLUORESCENT,      WHITE_BALANCE_FLUORESCENT },
+    { CameraParameters::WHITE_BALANCE_INCANDESCENT,     WHITE_BALANCE_TUNGSTEN },
+};
+
+static const ParamMap kImageEffects[] = {
+    { CameraParameters::EFFECT_NONE,        IMAGE_EFFECT_NONE },
+    { CameraParameters::EFFECT_MONO,        IMAGE_EFFECT_BNW },
+    { CameraParameters::EFFECT_SEPIA,       IMAGE_EFFECT_SEPIA },
+    { CameraParameters::EFFECT_AQUA,        IMAGE_EFFECT_AQUA },
+    { CameraParameters::EFFECT_NEGATIVE,    IMAGE_EFFECT_NEGATIVE },
+};
+
+#ifdef HAVE_FLASH
+static const ParamMap kFlashModes[] = {
+    { CameraParameters::FLASH_MODE_OFF,     FLASH_MODE_OFF },
+    { CameraParameters::FLASH_MODE_AUTO,    FLASH_MODE_AUTO },
+    { CameraParameters::FLASH_MODE_ON,      FLASH_MODE_ON },
+    { CameraParameters::FLASH_MODE_TORCH,   FLASH_MODE_TORCH },
+};
+#endif
+
+static const FocusModeMap kFocusModes[] = {
+    { CameraParameters::FOCUS_MODE_AUTO,        FOCUS_MODE_AUTO,
+      BACK_CAMERA_AUTO_FOCUS_DISTANCES_STR },
+    { CameraParameters::FOCUS_MODE_MACRO,       FOCUS_MODE_MACRO,
+      BACK_CAMERA_MACRO_FOCUS_DISTANCES_STR },
+    { CameraParameters::FOCUS_MODE_INFINITY,    FOCUS_MODE_INFINITY,
+      BACK_CAMERA_INFINITY_FOCUS_DISTANCES_STR },
+};
+
+static const SceneModeMap kSceneModes[] = {
+    { CameraParameters::SCENE_MODE_AUTO,        SCENE_MODE_NONE,
+      NULL,                                 "on,off,auto,torch" },
+    { CameraParameters::SCENE_MODE_PORTRAIT,    SCENE_MODE_PORTRAIT,
+      CameraParameters::FLASH_MODE_AUTO,    "auto" },
+    { CameraParameters::SCENE_MODE_LANDSCAPE,   SCENE_MODE_LANDSCAPE,
+      CameraParameters::FLASH_MODE_OFF,     "off" },
+    { CameraParameters::SCENE_MODE_SPORTS,      SCENE_MODE_SPORTS,
+      CameraParameters::FLASH_MODE_OFF,     "off" },
+    { CameraParameters::SCENE_MODE_PARTY,       SCENE_MODE_PARTY_INDOOR,
+      CameraParameters::FLASH_MODE_AUTO,    "auto" },
+    { CameraParameters::SCENE_MODE_BEACH,       SCENE_MODE_BEACH_SNOW,
+      CameraParameters::FLASH_MODE_OFF,     "off" },
+    { CameraParameters::SCENE_MODE_SNOW,        SCENE_MODE_BEACH_SNOW,
+      CameraParameters::FLASH_MODE_OFF,     "off" },
+    { CameraParameters::SCENE_MODE_SUNSET,      SCENE_MODE_SUNSET,
+      CameraParameters::FLASH_MODE_OFF,     "off" },
+    { CameraParameters::SCENE_MODE_NIGHT,       SCENE_MODE_NIGHTSHOT,
+      CameraParameters::FLASH_MODE_OFF,     "off" },
+    { CameraParameters::SCENE_MODE_FIREWORKS,   SCENE_MODE_FIREWORKS,
+      CameraParameters::FLASH_MODE_OFF,     "off" },
+    { CameraParameters::SCENE_MODE_CANDLELIGHT, SCENE_MODE_CANDLE_LIGHT,
+      CameraParameters::FLASH_MODE_OFF,     "off" },
+};
+
+template <typename T>
+static const T *findParam(const T *table, size_t count, const char *name)
+{
+    if (name == NULL)
+        return NULL;
+
+    for (size_t i = 0; i < count; i++) {
+        if (!strcmp(table[i].name, name))
+            return &table[i];
+    }
+    return NULL;
+}
+
+#define FIND_PARAM(table, name) \
+    findParam(table, sizeof(table) / sizeof(table[0]), name)
+
+/* sensor settings that only take effect on V4L2_CID_CAMERA_BATCH_REFLECTION */
+static const char *const kReflectedKeys[] = {
+    CameraParameters::KEY_EXPOSURE_COMPENSATION,
+    "iso",
+    CameraParameters::KEY_WHITE_BALANCE,
+    CameraParameters::KEY_SCENE_MODE,
+    CameraParameters::KEY_EFFECT,
+};
+
+#define NUM_REFLECTED_KEYS  (sizeof(kReflectedKeys) / sizeof(kReflectedKeys[0]))
+
 CameraHardwareSec::CameraHardwareSec(int cameraId, camera_device_t *dev)
         :
           mCaptureInProgress(false),
@@ -94,17 +233,77 @@ CameraHardwareSec::CameraHardwareSec(int cameraId, camera_device_t *dev)
           mPostViewWidth(0),
           mPostViewHeight(0),
           mPostViewSize(0),
-          mHalDevice(dev)
+          mHalDevice(dev),
+          mFrameLatency("frame latency"),
+          mPreviewCopy("preview copy"),
+          mPreviewCallback("preview callback"),
+          mCaptureShot("capture"),
+          mCaptureMemcpy("capture memcpy"),
+          mCaptureExif("capture exif"),
+          mCaptureEncode("capture encode"),
+          mCaptureTotal("picture total"),
+          mFramesSkipped(0),
+          mFramesDropped(0)
 {
     ALOGV("%s :", __func__);
     int ret = 0;
+    nsecs_t open_start = systemTime(SYSTEM_TIME_MONOTONIC);
 
     mPreviewWindow = NULL;
     mSecCamera = SecCamera::createInstance();
 
     mRawHeap = NULL;
     mPreviewHeap = NULL;
+    mPreviewCallbackHeap = NULL;
     mRecordHeap = NULL;
+    mCallbackPool = NULL;
+    mCallbackPoolSize = 0;
+    memset(mCallbackPoolBusy, 0, sizeof(mCallbackPoolBusy));
+    mCallbackBufferCount = 0;
+    mCallbacksDropped = 0;
+    mPreviewBufferCount = 0;
+    mRecordBufferCount = 0;
+
+    mCaptureThumbBytes = 0;
+    mCaptureExifBytes = 0;
+    mThumbnailHeap = NULL;
+    mExifHeap = NULL;
+    mCaptureAllocs = 0;
+    mCaptureReuses = 0;
+
+    mBurstHead = 0;
+    mBurstTail = 0;
+    mBurstDone = false;
+    mBurstCancel = false;
+    mBurstMsgs = 0;
+    mBurstCount = 0;
+    mBurstDelivered = 0;
+    mBurstShotsPerSec100 = 0;
+
+    mYuyvHeap = NULL;
+    mVideoSnapshot = false;
+    mVideoSnapshotPending = false;
+    mVideoSnapshotIndex = -1;
+    mLastRecordIndex = -1;
+    mVideoSnapshots = 0;
+
+    mZslHeap = NULL;
+    mZslDepth = 0;
+    mZslFrameSize = 0;
+    mZslHeapDepth = 0;
+    mZslHead = 0;
+    mZslCount = 0;
+    mZslReading = -1;
+    memset(mZslFrames, 0, sizeof(mZslFrames));
+    mZslShot = false;
+    mZslShutterTime = 0;
+    mZslShots = 0;
+    mZslLagUs = 0;
+
+    mParametersApplied = false;
+    mInternalApplied = false;
+    mParamCalls = 0;
+    mParamUnchanged = 0;
 
     if (!mGrallocHal) {
         ret = hw_get_module(GRALLOC_HARDWARE_MODULE_ID, (const hw_module_t **)&mGrallocHal);
@@ -121,6 +320,8 @@ CameraHardwareSec::CameraHardwareSec(int cameraId, camera_device_t *dev)
     ALOGV("mPostViewWidth = %d mPostViewHeight = %d mPostViewSize = %d",
             mPostViewWidth,mPostViewHeight,mPostViewSize);
 
+    mOpenWarm = cameraId >= 0 && cameraId < DEFAULT_PARAMS_CAMERAS &&
+                !g_default_params[cameraId].isEmpty();
     initDefaultParameters(cameraId);
 
     mExitAutoFocusThread = false;
@@ -130,9 +331,20 @@ CameraHardwareSec::CameraHardwareSec(int cameraId, camera_device_t *dev)
      */
     mPreviewRunning = false;
     mPreviewStartDeferred = false;
+    initFrameQueue(&mDisplayQueue);
+    initFrameQueue(&mCallbackQueue);
+    mPreviewDisplayThread = new PreviewDisplayThread(this);
+    mPreviewCallbackThread = new PreviewCallbackThread(this);
     mPreviewThread = new PreviewThread(this);
     mAutoFocusThread = new AutoFocusThread(this);
     mPictureThread = new PictureThread(this);
+    mBurstEncodeThread = new BurstEncodeThread(this);
+
+    mOpenUs = SecCameraHistogram::elapsedUs(open_start);
+    if (mOpenWarm)
+        g_open_warm.record(mOpenUs);
+    else
+        g_open_cold.record(mOpenUs);
 }
 
 int CameraHardwareSec::getCameraId() const
@@ -140,19 +352,10 @@ int CameraHardwareSec::getCameraId() const
     return mSecCamera->getCameraId();
 }
 
-void CameraHardwareSec::initDefaultParameters(int cameraId)
+/* the defaults only depend on the camera id */
+void CameraHardwareSec::buildDefaultParameters(int cameraId, CameraParameters &p,
+                                               CameraParameters &ip)
 {
-    if (mSecCamera == NULL) {
-        ALOGE("ERR(%s):mSecCamera object is NULL", __func__);
-        return;
-    }
-
-    CameraParameters p;
-    CameraParameters ip;
-
-    mCameraSensorName = mSecCamera->getCameraSensorName();
-    ALOGV("CameraSensorName: %s", mCameraSensorName);
-
     int preview_max_width   = 0;
     int preview_max_height  = 0;
     int snapshot_max_width  = 0;
@@ -170,8 +373,6 @@ void CameraHardwareSec::initDefaultParameters(int cameraId)
               "640x480");
     }
 
-    p.getSupportedPreviewSizes(mSupportedPreviewSizes);
-
     // If these fail, then we are using an invalid cameraId and we'll leave the
     // sizes at zero to catch the error.
     if (mSecCamera->getPreviewMaxSize(&preview_max_width,
@@ -325,11 +526,28 @@ void CameraHardwareSec::initDefaultParameters(int cameraId)
     if (cameraId == SecCamera::CAMERA_ID_FRONT) {
         ip.set("vtmode", 0);
         ip.set("blur", 0);
+        p.set("burst-capture", 0);
+        p.set("burst-capture-max", kMaxBurstCount);
+    }
+
+    if (cameraId == SecCamera::CAMERA_ID_BACK) {
+        p.set("zsl-values", "off,on");
+        p.set("zsl", "off");
+        p.set("zsl-depth", 3);
+        p.set("zsl-depth-max", kMaxZslDepth);
     }
 
     p.set("iso-values", "auto,ISO50,ISO100,ISO200,ISO400,ISO800,ISO1600");
     p.set("iso", "auto");
 
+    p.set("preview-callback-buffers", 0);
+    p.set("preview-callback-buffers-max", kMaxCallbackBuffers);
+
+    p.set("preview-buffers", 0);
+    p.set("record-buffers", 0);
+    p.set("stream-buffers-min", MIN_STREAM_BUFFERS);
+    p.set("stream-buffers-max", MAX_BUFFERS);
+
     p.set(CameraParameters::KEY_HORIZONTAL_VIEW_ANGLE, "51.2");
     p.set(CameraParameters::KEY_VERTICAL_VIEW_ANGLE, "39.4");
 
@@ -337,9 +555,45 @@ void CameraHardwareSec::initDefaultParameters(int cameraId)
     p.set(CameraParameters::KEY_MAX_EXPOSURE_COMPENSATION, "4");
     p.set(CameraParameters::KEY_MIN_EXPOSURE_COMPENSATION, "-4");
     p.set(CameraParameters::KEY_EXPOSURE_COMPENSATION_STEP, "0.5");
+}
+
+void CameraHardwareSec::initDefaultParameters(int cameraId)
+{
+    if (mSecCamera == NULL) {
+        ALOGE("ERR(%s):mSecCamera object is NULL", __func__);
+        return;
+    }
+
+    CameraParameters p;
+    CameraParameters ip;
+
+    mCameraSensorName = mSecCamera->getCameraSensorName();
+    ALOGV("CameraSensorName: %s", mCameraSensorName);
+
+    /* built on the first open of each camera, later opens and
+     * switches between the cameras reuse the strings.  a camera that
+     * failed to initialize does not know its sizes, so nothing is kept,
+     * and an id without a slot is built every time.
+     */
+    if (cameraId < 0 || cameraId >= DEFAULT_PARAMS_CAMERAS) {
+        buildDefaultParameters(cameraId, p, ip);
+    } else if (g_default_params[cameraId].isEmpty()) {
+        buildDefaultParameters(cameraId, p, ip);
+        if (mSecCamera->isInitialized()) {
+            g_default_params[cameraId] = p.flatten();
+            g_default_internal_params[cameraId] = ip.flatten();
+        }
+    } else {
+        p.unflatten(g_default_params[cameraId]);
+        ip.unflatten(g_default_internal_params[cameraId]);
+    }
+
+    p.getSupportedPreviewSizes(mSupportedPreviewSizes);
 
     mParameters = p;
     mInternalParameters = ip;
+    mParametersApplied = false;
+    mInternalApplied = false;
 
     /* make sure mSecCamera has all the settings we do.  applications
      * aren't required to call setParameters themselves (only if they
@@ -363,60 +617,72 @@ CameraHardwareSec::~CameraHardwareSec()
     mSecCamera->DeinitCamera();
 }
 
+bool CameraHardwareSec::hasPreviewWindow() const
+{
+    Mutex::Autolock lock(mPreviewWindowLock);
+    return mPreviewWindow != NULL;
+}
+
 status_t CameraHardwareSec::setPreviewWindow(preview_stream_ops *w)
 {
     int min_bufs;
 
-    mPreviewWindow = w;
-    ALOGV("%s: mPreviewWindow %p", __func__, mPreviewWindow);
-
     if (!w) {
+        Mutex::Autolock lock(mPreviewWindowLock);
+        mPreviewWindow = w;
         ALOGE("preview window is NULL!");
         return OK;
     }
 
-    mPreviewLock.lock();
+    Mutex::Autolock lock(mPreviewLock);
 
     if (mPreviewRunning && !mPreviewStartDeferred) {
         ALOGI("stop preview (window change)");
         stopPreviewInternal();
     }
 
-    if (w->get_min_undequeued_buffer_count(w, &min_bufs)) {
-        ALOGE("%s: could not retrieve min undequeued buffer count", __func__);
-        return INVALID_OPERATION;
-    }
+    /* startPreviewInternal() below takes the window lock itself */
+    {
+        Mutex::Autolock windowLock(mPreviewWindowLock);
+        mPreviewWindow = w;
+        ALOGV("%s: mPreviewWindow %p", __func__, mPreviewWindow);
 
-    if (min_bufs >= kBufferCount) {
-        ALOGE("%s: min undequeued buffer count %d is too high (expecting at most %d)", __func__,
-             min_bufs, kBufferCount - 1);
-    }
+        if (w->get_min_undequeued_buffer_count(w, &min_bufs)) {
+            ALOGE("%s: could not retrieve min undequeued buffer count", __func__);
+            return INVALID_OPERATION;
+        }
 
-    ALOGV("%s: setting buffer count to %d", __func__, kBufferCount);
-    if (w->set_buffer_count(w, kBufferCount)) {
-        ALOGE("%s: could not set buffer count", __func__);
-        return INVALID_OPERATION;
-    }
+        if (min_bufs >= kBufferCount) {
+            ALOGE("%s: min undequeued buffer count %d is too high (expecting at most %d)", __func__,
+                 min_bufs, kBufferCount - 1);
+        }
 
-    int preview_width;
-    int preview_height;
-    mParameters.getPreviewSize(&preview_width, &preview_height);
-    int hal_pixel_format = HAL_PIXEL_FORMAT_YV12;
+        ALOGV("%s: setting buffer count to %d", __func__, kBufferCount);
+        if (w->set_buffer_count(w, kBufferCount)) {
+            ALOGE("%s: could not set buffer count", __func__);
+            return INVALID_OPERATION;
+        }
 
-    const char *str_preview_format = mParameters.getPreviewFormat();
-    ALOGV("%s: preview format %s", __func__, str_preview_format);
+        int preview_width;
+        int preview_height;
+        mParameters.getPreviewSize(&preview_width, &preview_height);
+        int hal_pixel_format = HAL_PIXEL_FORMAT_YV12;
 
-    if (w->set_usage(w, GRALLOC_USAGE_SW_WRITE_OFTEN)) {
-        ALOGE("%s: could not set usage on gralloc buffer", __func__);
-        return INVALID_OPERATION;
-    }
+        const char *str_preview_format = mParameters.getPreviewFormat();
+        ALOGV("%s: preview format %s", __func__, str_preview_format);
 
-    if (w->set_buffers_geometry(w,
-                                preview_width, preview_height,
-                                hal_pixel_format)) {
-        ALOGE("%s: could not set buffers geometry to %s",
-             __func__, str_preview_format);
-        return INVALID_OPERATION;
+        if (w->set_usage(w, GRALLOC_USAGE_SW_WRITE_OFTEN)) {
+            ALOGE("%s: could not set usage on gralloc buffer", __func__);
+            return INVALID_OPERATION;
+        }
+
+        if (w->set_buffers_geometry(w,
+                                    preview_width, preview_height,
+                                    hal_pixel_format)) {
+            ALOGE("%s: could not set buffers geometry to %s",
+                 __func__, str_preview_format);
+            return INVALID_OPERATION;
+        }
     }
 
     if (mPreviewRunning && mPreviewStartDeferred) {
@@ -427,7 +693,6 @@ status_t CameraHardwareSec::setPreviewWindow(preview_stream_ops *w)
             mPreviewCondition.signal();
         }
     }
-    mPreviewLock.unlock();
 
     return OK;
 }
@@ -482,6 +747,15 @@ int CameraHardwareSec::previewThreadWrapper()
     ALOGI("%s: starting", __func__);
     while (1) {
         mPreviewLock.lock();
+        if (!mPreviewRunning) {
+            /* the workers may be inside a client callback, don't make
+             * them wait for the preview lock while we wait for them
+             */
+            mPreviewLock.unlock();
+            flushPreviewFrames(&mDisplayQueue);
+            flushPreviewFrames(&mCallbackQueue);
+            mPreviewLock.lock();
+        }
         while (!mPreviewRunning) {
             ALOGI("%s: calling mSecCamera->stopPreview() and waiting", __func__);
             mSecCamera->stopPreview();
@@ -494,6 +768,8 @@ int CameraHardwareSec::previewThreadWrapper()
 
         if (mExitPreviewThread) {
             ALOGI("%s: exiting", __func__);
+            flushPreviewFrames(&mDisplayQueue);
+            flushPreviewFrames(&mCallbackQueue);
             mSecCamera->stopPreview();
             return 0;
         }
@@ -501,15 +777,111 @@ int CameraHardwareSec::previewThreadWrapper()
     }
 }
 
+void CameraHardwareSec::initFrameQueue(FrameQueue *q)
+{
+    q->head = 0;
+    q->count = 0;
+    q->busy = false;
+    q->exit = false;
+    q->drops = 0;
+}
+
+void CameraHardwareSec::releaseQueuedFrame(const PreviewFrame *frame)
+{
+    if (frame->slot < 0) {
+        mSecCamera->releasePreviewFrame(frame->index);
+        return;
+    }
+
+    Mutex::Autolock lock(mCallbackPoolLock);
+    mCallbackPoolBusy[frame->slot] = false;
+}
+
+/* the caller's reference on the buffer, or on the callback pool
+ * buffer, moves to the queue
+ */
+void CameraHardwareSec::pushPreviewFrame(FrameQueue *q, int index, int slot,
+                                         nsecs_t timestamp)
+{
+    Mutex::Autolock lock(q->lock);
+
+    if (q->count == kFrameQueueDepth) {
+        /* the consumer is behind; the newest frame is the one worth
+         * keeping
+         */
+        releaseQueuedFrame(&q->frames[q->head]);
+        q->head = (q->head + 1) % kFrameQueueDepth;
+        q->count--;
+        q->drops++;
+    }
+
+    PreviewFrame *frame = &q->frames[(q->head + q->count) % kFrameQueueDepth];
+    frame->index = index;
+    frame->slot = slot;
+    frame->timestamp = timestamp;
+    q->count++;
+    q->cond.broadcast();
+}
+
+/* blocks for the next frame, which the consumer must release.  calling
+ * it again also marks the previous frame as done.
+ */
+bool CameraHardwareSec::popPreviewFrame(FrameQueue *q, PreviewFrame *frame)
+{
+    Mutex::Autolock lock(q->lock);
+
+    q->busy = false;
+    q->cond.broadcast();
+
+    while (q->count == 0 && !q->exit)
+        q->cond.wait(q->lock);
+    if (q->exit)
+        return false;
+
+    *frame = q->frames[q->head];
+    q->head = (q->head + 1) % kFrameQueueDepth;
+    q->count--;
+    q->busy = true;
+
+    return true;
+}
+
+/* drops what is queued and waits for the frame in progress */
+void CameraHardwareSec::flushPreviewFrames(FrameQueue *q)
+{
+    Mutex::Autolock lock(q->lock);
+
+    while (q->count > 0) {
+        releaseQueuedFrame(&q->frames[q->head]);
+        q->head = (q->head + 1) % kFrameQueueDepth;
+        q->count--;
+    }
+
+    while (q->busy && !q->exit)
+        q->cond.wait(q->lock);
+}
+
+void CameraHardwareSec::exitPreviewFrames(FrameQueue *q)
+{
+    Mutex::Autolock lock(q->lock);
+
+    q->exit = true;
+    q->cond.broadcast();
+}
+
 int CameraHardwareSec::previewThread()
 {
     int index;
     nsecs_t timestamp;
+    nsecs_t start;
     unsigned int phyYAddr;
     unsigned int phyCAddr;
     struct addrs *addrs;
 
-    index = mSecCamera->getPreview();
+    /* stamped by the driver when the frame was captured, so scheduling
+     * here does not show up as jitter in the recording
+     */
+    index = mSecCamera->getPreview(&timestamp);
     if (index < 0) {
         ALOGE("ERR(%s):Fail on SecCamera->getPreview()", __func__);
         return UNKNOWN_ERROR;
@@ -521,12 +893,14 @@ int CameraHardwareSec::previewThread()
     if (mSkipFrame > 0) {
         mSkipFrame--;
         mSkipFrameLock.unlock();
+        android_atomic_inc(&mFramesSkipped);
         ALOGV("%s: index %d skipping frame", __func__, index);
+        mSecCamera->releasePreviewFrame(index);
         return NO_ERROR;
     }
     mSkipFrameLock.unlock();
 
-    timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+    mPreviewFps.tick(timestamp);
 
     phyYAddr = mSecCamera->getPhyAddrY(index);
     phyCAddr = mSecCamera->getPhyAddrC(index);
@@ -534,6 +908,7 @@ int CameraHardwareSec::previewThread()
     if (phyYAddr == 0xffffffff || phyCAddr == 0xffffffff) {
         ALOGE("ERR(%s):Fail on SecCamera getPhyAddr Y addr = %0x C addr = %0x",
              __func__, phyYAddr, phyCAddr);
+        mSecCamera->releasePreviewFrame(index);
         return UNKNOWN_ERROR;
      }
 
@@ -543,15 +918,94 @@ int CameraHardwareSec::previewThread()
 
     offset = frame_size * index;
 
+    if (mZslDepth > 0)
+        pushZslFrame(((char *)mPreviewHeap->data) + offset, width, height,
+                     frame_size, timestamp);
+
+    /* the callback worker takes its own reference, ours goes to the
+     * display worker
+     */
+    if (mMsgEnabled & CAMERA_MSG_PREVIEW_FRAME) {
+        if (mCallbackPool != NULL)
+            queueCallbackBuffer(index, timestamp);
+        else if (mSecCamera->acquirePreviewFrame(index) == 0)
+            pushPreviewFrame(&mCallbackQueue, index, -1, timestamp);
+    }
+
+    if (hasPreviewWindow())
+        pushPreviewFrame(&mDisplayQueue, index, -1, timestamp);
+    else
+        mSecCamera->releasePreviewFrame(index);
+
+    Mutex::Autolock lock(mRecordLock);
+    if (mRecordRunning == true) {
+        index = mSecCamera->getRecordFrame(&timestamp);
+        if (index < 0) {
+            ALOGE("ERR(%s):Fail on SecCamera->getRecord()", __func__);
+            return UNKNOWN_ERROR;
+        }
+
+        phyYAddr = mSecCamera->getRecPhyAddrY(index);
+        phyCAddr = mSecCamera->getRecPhyAddrC(index);
+
+        if (phyYAddr == 0xffffffff || phyCAddr == 0xffffffff) {
+            ALOGE("ERR(%s):Fail on SecCamera getRectPhyAddr Y addr = %0x C addr = %0x", __func__,
+                 phyYAddr, phyCAddr);
+            return UNKNOWN_ERROR;
+        }
+
+        mLastRecordIndex = index;
+        if (mVideoSnapshotPending && mSecCamera->acquireRecordFrame(index) == 0) {
+            mVideoSnapshotIndex = index;
+            mVideoSnapshotPending = false;
+            mVideoSnapshotCondition.signal();
+        }
+
+        addrs = (struct addrs *)mRecordHeap->data;
+
+        addrs[index].type   = kMetadataBufferTypeCameraSource;
+        addrs[index].addr_y = phyYAddr;
+        addrs[index].addr_cbcr = phyCAddr;
+        addrs[index].buf_index = index;
+
+        // Notify the client of a new frame.
+        if (mMsgEnabled & CAMERA_MSG_VIDEO_FRAME) {
+            mDataCbTimestamp(timestamp, CAMERA_MSG_VIDEO_FRAME,
+                             mRecordHeap, index, mCallbackCookie);
+        } else {
+            mSecCamera->releaseRecordFrame(index);
+        }
+    }
+
+    return NO_ERROR;
+}
+
+bool CameraHardwareSec::previewDisplayThread()
+{
+    PreviewFrame frame;
+    int width, height, frame_size, offset;
+    nsecs_t start;
+
+    if (!popPreviewFrame(&mDisplayQueue, &frame))
+        return false;
+
+    int index = frame.index;
+
+    mSecCamera->getPreviewSize(&width, &height, &frame_size);
+    offset = frame_size * index;
+
+    mPreviewWindowLock.lock();
     if (mPreviewWindow && mGrallocHal) {
         buffer_handle_t *buf_handle;
         int stride;
         if (0 != mPreviewWindow->dequeue_buffer(mPreviewWindow, &buf_handle, &stride)) {
             ALOGE("Could not dequeue gralloc buffer!\n");
-            goto callbacks;
+            android_atomic_inc(&mFramesDropped);
+            goto release;
         }
 
         void *vaddr;
+        start = systemTime(SYSTEM_TIME_MONOTONIC);
         if (!mGrallocHal->lock(mGrallocHal,
                                *buf_handle,
                                GRALLOC_USAGE_SW_WRITE_OFTEN,
@@ -591,73 +1045,112 @@ int CameraHardwareSec::previewThread()
             }
 
             mGrallocHal->unlock(mGrallocHal, *buf_handle);
+            mPreviewCopy.recordSince(start);
         }
         else
             ALOGE("%s: could not obtain gralloc buffer", __func__);
 
         if (0 != mPreviewWindow->enqueue_buffer(mPreviewWindow, buf_handle)) {
             ALOGE("Could not enqueue gralloc buffer!\n");
-            goto callbacks;
+            android_atomic_inc(&mFramesDropped);
+            goto release;
         }
+        mFrameLatency.recordSince(frame.timestamp);
     }
 
-callbacks:
-    // Notify the client of a new frame.
-    if (mMsgEnabled & CAMERA_MSG_PREVIEW_FRAME) {
-        const char * preview_format = mParameters.getPreviewFormat();
-        if (!strcmp(preview_format, CameraParameters::PIXEL_FORMAT_YUV420SP)) {
-            // Color conversion from YUV420 to NV21
-            char *vu = ((char *)mPreviewHeap->data) + offset + width * height;
-            const int uv_size = (width * height) >> 1;
-            char saved_uv[uv_size];
-            memcpy(saved_uv, vu, uv_size);
-            char *u = saved_uv;
-            char *v = u + (uv_size >> 1);
-
-            int h = 0;
-            while (h < width * height / 4) {
-                *vu++ = *v++;
-                *vu++ = *u++;
-                ++h;
-            }
+release:
+    mPreviewWindowLock.unlock();
+    mSecCamera->releasePreviewFrame(index);
+    return true;
+}
+
+void CameraHardwareSec::queueCallbackBuffer(int index, nsecs_t timestamp)
+{
+    int width, height, frame_size;
+    int slot = -1;
+
+    mCallbackPoolLock.lock();
+    for (int i = 0; i < mCallbackPoolSize; i++) {
+        if (!mCallbackPoolBusy[i]) {
+            mCallbackPoolBusy[i] = true;
+            slot = i;
+            break;
         }
-        mDataCb(CAMERA_MSG_PREVIEW_FRAME, mPreviewHeap, index, NULL, mCallbackCookie);
     }
+    mCallbackPoolLock.unlock();
 
-    Mutex::Autolock lock(mRecordLock);
-    if (mRecordRunning == true) {
-        index = mSecCamera->getRecordFrame();
-        if (index < 0) {
-            ALOGE("ERR(%s):Fail on SecCamera->getRecord()", __func__);
-            return UNKNOWN_ERROR;
-        }
+    if (slot < 0) {
+        android_atomic_inc(&mCallbacksDropped);
+        return;
+    }
 
-        phyYAddr = mSecCamera->getRecPhyAddrY(index);
-        phyCAddr = mSecCamera->getRecPhyAddrC(index);
+    mSecCamera->getPreviewSize(&width, &height, &frame_size);
 
-        if (phyYAddr == 0xffffffff || phyCAddr == 0xffffffff) {
-            ALOGE("ERR(%s):Fail on SecCamera getRectPhyAddr Y addr = %0x C addr = %0x", __func__,
-                 phyYAddr, phyCAddr);
-            return UNKNOWN_ERROR;
-        }
+    uint8_t *src = (uint8_t *)mPreviewHeap->data + frame_size * index;
+    uint8_t *dst = (uint8_t *)mCallbackPool->data + frame_size * slot;
 
-        addrs = (struct addrs *)mRecordHeap->data;
+    if (!strcmp(mParameters.getPreviewFormat(), CameraParameters::PIXEL_FORMAT_YUV420SP))
+        yuv420pToNv21(src, dst, width, height);
+    else
+        memcpy(dst, src, frame_size);
 
-        addrs[index].type   = kMetadataBufferTypeCameraSource;
-        addrs[index].addr_y = phyYAddr;
-        addrs[index].addr_cbcr = phyCAddr;
-        addrs[index].buf_index = index;
+    pushPreviewFrame(&mCallbackQueue, index, slot, timestamp);
+}
 
-        // Notify the client of a new frame.
-        if (mMsgEnabled & CAMERA_MSG_VIDEO_FRAME) {
-            mDataCbTimestamp(timestamp, CAMERA_MSG_VIDEO_FRAME,
-                             mRecordHeap, index, mCallbackCookie);
-        } else {
-            mSecCamera->releaseRecordFrame(index);
+bool CameraHardwareSec::previewCallbackThread()
+{
+    PreviewFrame frame;
+    int width, height, frame_size, offset;
+    nsecs_t start;
+
+    if (!popPreviewFrame(&mCallbackQueue, &frame))
+        return false;
+
+    if (frame.slot >= 0) {
+        /* already converted; the framework copies the frame out
+         * before mDataCb returns, so the buffer is free after it
+         */
+        if (mMsgEnabled & CAMERA_MSG_PREVIEW_FRAME) {
+            start = systemTime(SYSTEM_TIME_MONOTONIC);
+            mDataCb(CAMERA_MSG_PREVIEW_FRAME, mCallbackPool, frame.slot, NULL, mCallbackCookie);
+            mPreviewCallback.recordSince(start);
         }
+        releaseQueuedFrame(&frame);
+        return true;
     }
 
-    return NO_ERROR;
+    int index = frame.index;
+
+    mSecCamera->getPreviewSize(&width, &height, &frame_size);
+    offset = frame_size * index;
+
+    // Notify the client of a new frame.
+    if (mMsgEnabled & CAMERA_MSG_PREVIEW_FRAME) {
+        const char * preview_format = mParameters.getPreviewFormat();
+        camera_memory_t *cbHeap = mPreviewHeap;
+
+        start = systemTime(SYSTEM_TIME_MONOTONIC);
+        if (!strcmp(preview_format, CameraParameters::PIXEL_FORMAT_YUV420SP)) {
+            /* convert YUV420 to NV21 into a heap of our own, the
+             * preview heap may be the driver's buffer
+             */
+            if (mPreviewCallbackHeap == NULL)
+                mPreviewCallbackHeap = mGetMemoryCb(-1, frame_size,
+                                                    mSecCamera->getPreviewBufferCount(), 0);
+            if (mPreviewCallbackHeap != NULL) {
+                yuv420pToNv21((uint8_t *)mPreviewHeap->data + offset,
+                              (uint8_t *)mPreviewCallbackHeap->data + offset,
+                              width, height);
+                cbHeap = mPreviewCallbackHeap;
+            } else
+                ALOGE("ERR(%s):Fail on allocating preview callback heap", __func__);
+        }
+        mDataCb(CAMERA_MSG_PREVIEW_FRAME, cbHeap, index, NULL, mCallbackCookie);
+        mPreviewCallback.recordSince(start);
+    }
+
+    mSecCamera->releasePreviewFrame(index);
+    return true;
 }
 
 status_t CameraHardwareSec::startPreview()
@@ -681,7 +1174,7 @@ status_t CameraHardwareSec::startPreview()
     mPreviewRunning = true;
     mPreviewStartDeferred = false;
 
-    if (!mPreviewWindow) {
+    if (!hasPreviewWindow()) {
         ALOGI("%s : deferring", __func__);
         mPreviewStartDeferred = true;
         mPreviewLock.unlock();
@@ -700,7 +1193,12 @@ status_t CameraHardwareSec::startPreviewInternal()
 {
     ALOGV("%s", __func__);
 
-    int ret  = mSecCamera->startPreview();
+    int ret;
+
+    /* drops any buffer references left from a previous run */
+    mSecCamera->clearPreviewFrames();
+    mSecCamera->setPreviewBufferCount(previewBuffersWanted());
+    ret = mSecCamera->startPreview();
     ALOGV("%s : mSecCamera->startPreview() returned %d", __func__, ret);
 
     if (ret < 0) {
@@ -720,11 +1218,37 @@ status_t CameraHardwareSec::startPreviewInternal()
         mPreviewHeap->release(mPreviewHeap);
         mPreviewHeap = 0;
     }
+    /* reallocated at the new size on the first NV21 callback */
+    if (mPreviewCallbackHeap) {
+        mPreviewCallbackHeap->release(mPreviewCallbackHeap);
+        mPreviewCallbackHeap = 0;
+    }
 
-    mPreviewHeap = mGetMemoryCb((int)mSecCamera->getCameraFd(),
-                                frame_size,
-                                kBufferCount,
-                                0); // no cookie
+    mCallbackPoolLock.lock();
+    if (mCallbackPool) {
+        mCallbackPool->release(mCallbackPool);
+        mCallbackPool = NULL;
+    }
+    mCallbackPoolSize = 0;
+    memset(mCallbackPoolBusy, 0, sizeof(mCallbackPoolBusy));
+    if (mCallbackBufferCount > 0) {
+        mCallbackPool = mGetMemoryCb(-1, frame_size, mCallbackBufferCount, 0);
+        if (mCallbackPool != NULL)
+            mCallbackPoolSize = mCallbackBufferCount;
+        else
+            ALOGE("ERR(%s):Fail on allocating %d preview callback buffers",
+                 __func__, mCallbackBufferCount);
+    }
+    mCallbackPoolLock.unlock();
+
+    mZslLock.lock();
+    resetZslLocked();
+    mZslLock.unlock();
+
+    mPreviewHeap = mGetMemoryCb((int)mSecCamera->getCameraFd(),
+                                frame_size,
+                                mSecCamera->getPreviewBufferCount(),
+                                0); // no cookie
 
     mSecCamera->getPostViewConfig(&mPostViewWidth, &mPostViewHeight, &mPostViewSize);
     ALOGV("CameraHardwareSec: mPostViewWidth = %d mPostViewHeight = %d mPostViewSize = %d",
@@ -733,6 +1257,30 @@ status_t CameraHardwareSec::startPreviewInternal()
     return NO_ERROR;
 }
 
+/* mmap preview buffers: what FIMC needs queued plus the most the
+ * consumers holding driver frames can keep at once.  callbacks in
+ * buffer mode copy the frame, so they hold none; otherwise they are
+ * counted even when disabled, since they can be turned on mid-preview.
+ * an explicit "preview-buffers" is raised so FIMC always keeps one.
+ */
+int CameraHardwareSec::previewBuffersWanted()
+{
+    int held = 0;
+    int count;
+
+    if (hasPreviewWindow())
+        held += kFrameQueueDepth + 1;
+    if (mCallbackBufferCount == 0)
+        held += kFrameQueueDepth + 1;
+
+    if (mPreviewBufferCount > 0)
+        count = mPreviewBufferCount > held ? mPreviewBufferCount : held + 1;
+    else
+        count = PREVIEW_DRIVER_BUFFERS + held;
+
+    return count < MAX_BUFFERS ? count : MAX_BUFFERS;
+}
+
 void CameraHardwareSec::stopPreviewInternal()
 {
     ALOGV("%s :", __func__);
@@ -787,6 +1335,11 @@ status_t CameraHardwareSec::startRecording()
     }
 
     if (mRecordRunning == false) {
+        /* the encoder's depth is not known here, so ask for all of
+         * them and let FIMC memory decide
+         */
+        mSecCamera->setRecordBufferCount(mRecordBufferCount > 0 ? mRecordBufferCount :
+                                                                  kBufferCountForRecord);
         if (mSecCamera->startRecord() < 0) {
             ALOGE("ERR(%s):Fail on mSecCamera->startRecord()", __func__);
             return UNKNOWN_ERROR;
@@ -800,6 +1353,9 @@ void CameraHardwareSec::stopRecording()
 {
     ALOGV("%s :", __func__);
 
+    /* a video snapshot may be reading a mapped record buffer */
+    waitCaptureCompletion();
+
     Mutex::Autolock lock(mRecordLock);
 
     if (mRecordRunning == true) {
@@ -890,6 +1446,11 @@ int CameraHardwareSec::autoFocusThread()
 status_t CameraHardwareSec::autoFocus()
 {
     ALOGV("%s :", __func__);
+    /* the focus area has to be sent again to start the next touch
+     * focus, even when it is the same one
+     */
+    mAppliedParameters.remove(CameraParameters::KEY_FOCUS_AREAS);
+    mAppliedFlat.setTo("");
     /* signal autoFocusThread to run once */
     mFocusCondition.signal();
     return NO_ERROR;
@@ -981,63 +1542,12 @@ void CameraHardwareSec::save_postview(const char *fname, uint8_t *buf, uint32_t
 bool CameraHardwareSec::scaleDownYuv422(char *srcBuf, uint32_t srcWidth, uint32_t srcHeight,
                                         char *dstBuf, uint32_t dstWidth, uint32_t dstHeight)
 {
-    int32_t step_x, step_y;
-    int32_t iXsrc, iXdst;
-    int32_t x, y, src_y_start_pos, dst_pos, src_pos;
-
-    if (dstWidth % 2 != 0 || dstHeight % 2 != 0){
+    if (!scaleYuy2((const uint8_t *)srcBuf, srcWidth, srcHeight,
+                   (uint8_t *)dstBuf, dstWidth, dstHeight)) {
         ALOGE("scale_down_yuv422: invalid width, height for scaling");
         return false;
     }
 
-    step_x = srcWidth / dstWidth;
-    step_y = srcHeight / dstHeight;
-
-    dst_pos = 0;
-    for (uint32_t y = 0; y < dstHeight; y++) {
-        src_y_start_pos = (y * step_y * (srcWidth * 2));
-
-        for (uint32_t x = 0; x < dstWidth; x += 2) {
-            src_pos = src_y_start_pos + (x * (step_x * 2));
-
-            dstBuf[dst_pos++] = srcBuf[src_pos    ];
-            dstBuf[dst_pos++] = srcBuf[src_pos + 1];
-            dstBuf[dst_pos++] = srcBuf[src_pos + 2];
-            dstBuf[dst_pos++] = srcBuf[src_pos + 3];
-        }
-    }
-
-    return true;
-}
-
-bool CameraHardwareSec::YUY2toNV21(void *srcBuf, void *dstBuf, uint32_t srcWidth, uint32_t srcHeight)
-{
-    int32_t        x, y, src_y_start_pos, dst_cbcr_pos, dst_pos, src_pos;
-    unsigned char *srcBufPointer = (unsigned char *)srcBuf;
-    unsigned char *dstBufPointer = (unsigned char *)dstBuf;
-
-    dst_pos = 0;
-    dst_cbcr_pos = srcWidth*srcHeight;
-    for (uint32_t y = 0; y < srcHeight; y++) {
-        src_y_start_pos = (y * (srcWidth * 2));
-
-        for (uint32_t x = 0; x < (srcWidth * 2); x += 2) {
-            src_pos = src_y_start_pos + x;
-
-            dstBufPointer[dst_pos++] = srcBufPointer[src_pos];
-        }
-    }
-    for (uint32_t y = 0; y < srcHeight; y += 2) {
-        src_y_start_pos = (y * (srcWidth * 2));
-
-        for (uint32_t x = 0; x < (srcWidth * 2); x += 4) {
-            src_pos = src_y_start_pos + x;
-
-            dstBufPointer[dst_cbcr_pos++] = srcBufPointer[src_pos + 3];
-            dstBufPointer[dst_cbcr_pos++] = srcBufPointer[src_pos + 1];
-        }
-    }
-
     return true;
 }
 
@@ -1048,30 +1558,17 @@ int CameraHardwareSec::pictureThread()
     int jpeg_size = 0;
     int ret = NO_ERROR;
     unsigned char *jpeg_data = NULL;
-    int postview_offset = 0;
-    unsigned char *postview_data = NULL;
+    unsigned char *yuv_data = NULL;
 
-    unsigned char *addr = NULL;
     int mPostViewWidth, mPostViewHeight, mPostViewSize;
-    int mThumbWidth, mThumbHeight, mThumbSize;
     int cap_width, cap_height, cap_frame_size;
-    int JpegImageSize, JpegExifSize;
-
-    unsigned int output_size = 0;
 
     mSecCamera->getPostViewConfig(&mPostViewWidth, &mPostViewHeight, &mPostViewSize);
-    mSecCamera->getThumbnailConfig(&mThumbWidth, &mThumbHeight, &mThumbSize);
     int postviewHeapSize = mPostViewSize;
     mSecCamera->getSnapshotSize(&cap_width, &cap_height, &cap_frame_size);
-    int mJpegHeapSize;
-    if (mSecCamera->getCameraId() == SecCamera::CAMERA_ID_BACK)
-        mJpegHeapSize = cap_frame_size * SecCamera::getJpegRatio();
-    else
-        mJpegHeapSize = cap_frame_size;
 
-    LOG_TIME_DEFINE(0)
-    LOG_TIME_START(0)
-//    sp<MemoryBase> buffer = new MemoryBase(mRawHeap, 0, mPostViewSize + 8);
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    nsecs_t stage = start;
 
     struct addrs_cap *addrs = (struct addrs_cap *)mRawHeap->data;
 
@@ -1079,18 +1576,27 @@ int CameraHardwareSec::pictureThread()
     addrs[0].height = mPostViewHeight;
     ALOGV("[5B] mPostViewWidth = %d mPostViewHeight = %d\n",mPostViewWidth,mPostViewHeight);
 
-    camera_memory_t *JpegHeap = mGetMemoryCb(-1, mJpegHeapSize, 1, 0);
-    sp<MemoryHeapBase> PostviewHeap = new MemoryHeapBase(mPostViewSize);
-    sp<MemoryHeapBase> ThumbnailHeap = new MemoryHeapBase(mThumbSize);
+    unsigned int phyAddr;
+
+    if (initCaptureBuffers() < 0) {
+        ret = NO_MEMORY;
+        goto out;
+    }
 
-    LOG_TIME_DEFINE(1)
-    LOG_TIME_START(1)
+    if (mVideoSnapshot) {
+        ret = videoSnapshot();
+        goto out;
+    }
 
-    int picture_size, picture_width, picture_height;
-    mSecCamera->getSnapshotSize(&picture_width, &picture_height, &picture_size);
-    int picture_format = mSecCamera->getSnapshotPixelFormat();
+    if (mSecCamera->getCameraId() == SecCamera::CAMERA_ID_FRONT && mBurstCount > 1) {
+        ret = burstCapture(mBurstCount);
+        goto out;
+    }
 
-    unsigned int phyAddr;
+    if (mZslShot) {
+        ret = zslCapture();
+        goto out;
+    }
 
     // Modified the shutter sound timing for Jpeg capture
     if (mSecCamera->getCameraId() == SecCamera::CAMERA_ID_BACK)
@@ -1099,6 +1605,9 @@ int CameraHardwareSec::pictureThread()
         mNotifyCb(CAMERA_MSG_SHUTTER, 0, 0, mCallbackCookie);
     }
 
+    /* both paths leave the image in driver memory until endSnapshot(),
+     * it is copied once, straight into the client's buffer
+     */
     if (mSecCamera->getCameraId() == SecCamera::CAMERA_ID_BACK){
         jpeg_data = mSecCamera->getJpeg(&jpeg_size, &phyAddr);
         if (jpeg_data == NULL) {
@@ -1107,28 +1616,32 @@ int CameraHardwareSec::pictureThread()
             goto out;
         }
     } else {
-        if (mSecCamera->getSnapshotAndJpeg((unsigned char*)PostviewHeap->base(),
-                (unsigned char*)JpegHeap->data, &output_size) < 0) {
+        yuv_data = mSecCamera->getSnapshot();
+        if (yuv_data == NULL) {
+            ALOGE("ERR(%s):Fail on SecCamera->getSnapshot()", __func__);
             ret = UNKNOWN_ERROR;
             goto out;
         }
-        ALOGI("snapshotandjpeg done\n");
+        ALOGI("snapshot done\n");
     }
 
-    LOG_TIME_END(1)
-    LOG_CAMERA("getSnapshotAndJpeg interval: %lu us", LOG_TIME(1));
+    mCaptureShot.recordSince(stage);
 
-    if (mSecCamera->getCameraId() == SecCamera::CAMERA_ID_BACK) {
-        // TODO: copy postview to PostviewHeap->base()
-        memcpy(JpegHeap->data, jpeg_data, jpeg_size);
-        JpegImageSize = jpeg_size;
-    } else {
-        JpegImageSize = static_cast<int>(output_size);
+    /* the postview is the captured frame scaled down to the postview
+     * size; a postview larger than the capture gets the plain copy.
+     * TODO: the back camera's postview is not copied out of the ISP buffer
+     */
+    if (yuv_data != NULL && (mMsgEnabled & CAMERA_MSG_RAW_IMAGE) &&
+            (int)mRawHeap->size >= postviewHeapSize) {
+        stage = systemTime(SYSTEM_TIME_MONOTONIC);
+        if (mPostViewWidth <= cap_width && mPostViewHeight <= cap_height)
+            scaleDownYuv422((char *)yuv_data, cap_width, cap_height,
+                            (char *)mRawHeap->data, mPostViewWidth, mPostViewHeight);
+        else
+            memcpy(mRawHeap->data, yuv_data,
+                   cap_frame_size < postviewHeapSize ? cap_frame_size : postviewHeapSize);
+        mCaptureMemcpy.recordSince(stage);
     }
-    scaleDownYuv422((char *)PostviewHeap->base(), mPostViewWidth, mPostViewHeight,
-                    (char *)ThumbnailHeap->base(), mThumbWidth, mThumbHeight);
-
-    memcpy(mRawHeap->data, PostviewHeap->base(), postviewHeapSize);
 
     if (mMsgEnabled & CAMERA_MSG_RAW_IMAGE) {
         mDataCb(CAMERA_MSG_RAW_IMAGE, mRawHeap, 0, NULL, mCallbackCookie);
@@ -1139,42 +1652,24 @@ int CameraHardwareSec::pictureThread()
     if (mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE) {
         if (mSecCamera->getCameraId() == SecCamera::CAMERA_ID_BACK) {
             // Aries' back camera already has EXIF data
-            camera_memory_t *mem = mGetMemoryCb(-1, JpegImageSize, 1, 0);
-            memcpy(mem->data, JpegHeap->data, JpegImageSize);
+            camera_memory_t *mem = mGetMemoryCb(-1, jpeg_size, 1, 0);
+            stage = systemTime(SYSTEM_TIME_MONOTONIC);
+            memcpy(mem->data, jpeg_data, jpeg_size);
+            mCaptureMemcpy.recordSince(stage);
             mDataCb(CAMERA_MSG_COMPRESSED_IMAGE, mem, 0, NULL, mCallbackCookie);
             mem->release(mem);
         } else {
-            camera_memory_t *ExifHeap =
-                mGetMemoryCb(-1, EXIF_FILE_SIZE + JPG_STREAM_BUF_SIZE, 1, 0);
-            JpegExifSize = mSecCamera->getExif((unsigned char *)ExifHeap->data,
-                                               (unsigned char *)ThumbnailHeap->base());
-
-            ALOGV("JpegExifSize=%d", JpegExifSize);
-
-            if (JpegExifSize < 0) {
-                ret = UNKNOWN_ERROR;
-                ExifHeap->release(ExifHeap);
+            ret = deliverJpeg(yuv_data, cap_width, cap_height);
+            if (ret != NO_ERROR)
                 goto out;
-            }
-
-            camera_memory_t *mem = mGetMemoryCb(-1, JpegImageSize + JpegExifSize, 1, 0);
-            uint8_t *ptr = (uint8_t *) mem->data;
-            memcpy(ptr, JpegHeap->data, 2); ptr += 2;
-            memcpy(ptr, ExifHeap->data, JpegExifSize); ptr += JpegExifSize;
-            memcpy(ptr, (uint8_t *) JpegHeap->data + 2, JpegImageSize - 2);
-            mDataCb(CAMERA_MSG_COMPRESSED_IMAGE, mem, 0, NULL, mCallbackCookie);
-            mem->release(mem);
-            ExifHeap->release(ExifHeap);
         }
     }
 
-    LOG_TIME_END(0)
-    LOG_CAMERA("pictureThread interval: %lu us", LOG_TIME(0));
-
     ALOGV("%s : pictureThread end", __func__);
 
 out:
-    JpegHeap->release(JpegHeap);
+    if (ret == NO_ERROR)
+        mCaptureTotal.recordSince(start);
     mSecCamera->endSnapshot();
     mCaptureLock.lock();
     mCaptureInProgress = false;
@@ -1184,6 +1679,459 @@ out:
     return ret;
 }
 
+/* thumbnail, EXIF and JPEG for one front camera frame, handed to the
+ * client as a single buffer.  the frame stays in driver memory.
+ */
+int CameraHardwareSec::deliverJpeg(unsigned char *yuv_data, int width, int height)
+{
+    int mThumbWidth, mThumbHeight, mThumbSize;
+    int JpegExifSize;
+    unsigned int output_size = 0;
+    unsigned char *jpeg_data;
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    mSecCamera->getThumbnailConfig(&mThumbWidth, &mThumbHeight, &mThumbSize);
+    scaleDownYuv422((char *)yuv_data, width, height,
+                    (char *)mThumbnailHeap->data, mThumbWidth, mThumbHeight);
+
+    /* the thumbnail goes through its own encoder instance, so
+     * build EXIF before the main image claims the hardware
+     */
+    JpegExifSize = mSecCamera->getExif((unsigned char *)mExifHeap->data,
+                                       (unsigned char *)mThumbnailHeap->data,
+                                       width, height);
+
+    ALOGV("JpegExifSize=%d", JpegExifSize);
+
+    if (JpegExifSize < 0)
+        return UNKNOWN_ERROR;
+    mCaptureExif.recordSince(start);
+
+    start = systemTime(SYSTEM_TIME_MONOTONIC);
+    jpeg_data = mSecCamera->encodeSnapshot(yuv_data, width, height, &output_size);
+    if (jpeg_data == NULL || output_size < 2) {
+        ALOGE("ERR(%s):Fail on SecCamera->encodeSnapshot()", __func__);
+        mSecCamera->releaseSnapshotEncoder();
+        return UNKNOWN_ERROR;
+    }
+    mCaptureEncode.recordSince(start);
+
+    /* SOI, APP1, then the rest of the encoder output */
+    camera_memory_t *mem = mGetMemoryCb(-1, output_size + JpegExifSize, 1, 0);
+    uint8_t *ptr = (uint8_t *) mem->data;
+    start = systemTime(SYSTEM_TIME_MONOTONIC);
+    memcpy(ptr, jpeg_data, 2); ptr += 2;
+    memcpy(ptr, mExifHeap->data, JpegExifSize); ptr += JpegExifSize;
+    memcpy(ptr, jpeg_data + 2, output_size - 2);
+    mCaptureMemcpy.recordSince(start);
+    mSecCamera->releaseSnapshotEncoder();
+    mDataCb(CAMERA_MSG_COMPRESSED_IMAGE, mem, 0, NULL, mCallbackCookie);
+    mem->release(mem);
+
+    return NO_ERROR;
+}
+
+/* only used from the picture thread */
+unsigned char *CameraHardwareSec::getYuyvBuffer(int width, int height)
+{
+    if (mYuyvHeap == NULL || (int)mYuyvHeap->size != width * height * 2) {
+        if (mYuyvHeap)
+            mYuyvHeap->release(mYuyvHeap);
+        mYuyvHeap = mGetMemoryCb(-1, width * height * 2, 1, 0);
+        if (mYuyvHeap == NULL) {
+            ALOGE("ERR(%s):Fail on allocating %dx%d encode buffer", __func__, width, height);
+            return NULL;
+        }
+    }
+
+    return (unsigned char *)mYuyvHeap->data;
+}
+
+/* a still from the record stream: the sensor stays in video mode and
+ * the recording keeps its frame rate
+ */
+int CameraHardwareSec::videoSnapshot()
+{
+    int index = -1;
+    int width, height;
+    unsigned char *y, *cbcr, *yuyv;
+
+    mRecordLock.lock();
+    if (mRecordRunning) {
+        /* the newest frame if the encoder still holds it, otherwise
+         * the next one the preview thread dequeues
+         */
+        if (mSecCamera->acquireRecordFrame(mLastRecordIndex) == 0) {
+            index = mLastRecordIndex;
+        } else {
+            nsecs_t endTime = 1000000000LL + systemTime(SYSTEM_TIME_MONOTONIC);
+            mVideoSnapshotPending = true;
+            while (mVideoSnapshotPending && mRecordRunning) {
+                nsecs_t remainingTime = endTime - systemTime(SYSTEM_TIME_MONOTONIC);
+                if (remainingTime <= 0)
+                    break;
+                mVideoSnapshotCondition.waitRelative(mRecordLock, remainingTime);
+            }
+            if (!mVideoSnapshotPending)
+                index = mVideoSnapshotIndex;
+            mVideoSnapshotPending = false;
+        }
+    }
+    mRecordLock.unlock();
+
+    if (index < 0) {
+        ALOGE("ERR(%s):no record frame for snapshot", __func__);
+        return UNKNOWN_ERROR;
+    }
+
+    if (mMsgEnabled & CAMERA_MSG_SHUTTER)
+        mNotifyCb(CAMERA_MSG_SHUTTER, 0, 0, mCallbackCookie);
+
+    mSecCamera->getRecordingSize(&width, &height);
+    y = mSecCamera->getRecordFrameAddr(index, &cbcr);
+    yuyv = getYuyvBuffer(width, height);
+    if (y == NULL || yuyv == NULL) {
+        ALOGE("ERR(%s):record frame %d is not accessible", __func__, index);
+        mSecCamera->releaseRecordFrame(index);
+        return UNKNOWN_ERROR;
+    }
+
+    nv12tToYuy2(y, cbcr, yuyv, width, height);
+    mSecCamera->releaseRecordFrame(index);
+
+    if (mMsgEnabled & CAMERA_MSG_RAW_IMAGE_NOTIFY)
+        mNotifyCb(CAMERA_MSG_RAW_IMAGE_NOTIFY, 0, 0, mCallbackCookie);
+
+    if (mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE) {
+        int ret = deliverJpeg(yuyv, width, height);
+        if (ret != NO_ERROR)
+            return ret;
+    }
+
+    mVideoSnapshots++;
+    return NO_ERROR;
+}
+
+void CameraHardwareSec::resetZslLocked()
+{
+    for (int i = 0; i < kMaxZslDepth; i++)
+        mZslFrames[i].valid = false;
+    mZslHead = 0;
+    mZslCount = 0;
+}
+
+/* called from the preview thread for every displayed frame.  the slot
+ * is claimed under mZslLock and filled outside it, so takePicture()
+ * never waits for a frame copy.
+ */
+void CameraHardwareSec::pushZslFrame(const char *frame, int width, int height,
+                                     int frame_size, nsecs_t timestamp)
+{
+    int slot;
+    char *dst;
+
+    mZslLock.lock();
+
+    if (mZslDepth == 0) {
+        mZslLock.unlock();
+        return;
+    }
+
+    /* depth x preview frame is all the ring ever holds.  it is not
+     * replaced while zslCapture() converts out of it.
+     */
+    if (mZslHeap == NULL || mZslFrameSize != frame_size || mZslHeapDepth != mZslDepth) {
+        if (mZslReading >= 0) {
+            mZslLock.unlock();
+            return;
+        }
+        if (mZslHeap)
+            mZslHeap->release(mZslHeap);
+        mZslHeap = mGetMemoryCb(-1, frame_size, mZslDepth, 0);
+        if (mZslHeap == NULL) {
+            ALOGE("ERR(%s):Fail on allocating zsl ring", __func__);
+            mZslFrameSize = 0;
+            mZslHeapDepth = 0;
+            mZslLock.unlock();
+            return;
+        }
+        mZslFrameSize = frame_size;
+        mZslHeapDepth = mZslDepth;
+        resetZslLocked();
+    }
+
+    slot = mZslHead;
+    if (slot == mZslReading)
+        slot = (slot + 1) % mZslHeapDepth;
+    if (slot == mZslReading) {
+        mZslLock.unlock();
+        return;
+    }
+    if (mZslFrames[slot].valid) {
+        mZslFrames[slot].valid = false;
+        mZslCount--;
+    }
+    mZslHead = (slot + 1) % mZslHeapDepth;
+    dst = (char *)mZslHeap->data + slot * frame_size;
+    mZslLock.unlock();
+
+    memcpy(dst, frame, frame_size);
+
+    mZslLock.lock();
+    mZslFrames[slot].timestamp = timestamp;
+    mZslFrames[slot].width = width;
+    mZslFrames[slot].height = height;
+    mZslFrames[slot].valid = true;
+    mZslCount++;
+    mZslLock.unlock();
+}
+
+/* the ring holds preview frames, so a zsl shot is scaled down to the
+ * picture size.  setParameters() turns zsl off for pictures larger
+ * than the preview.
+ */
+int CameraHardwareSec::zslCapture()
+{
+    int best = -1;
+    nsecs_t best_diff = 0;
+    int width, height;
+    int pic_width, pic_height, pic_size;
+    const uint8_t *src;
+    unsigned char *yuyv;
+    camera_memory_t *scaled = NULL;
+    int ret = NO_ERROR;
+
+    if (mMsgEnabled & CAMERA_MSG_SHUTTER)
+        mNotifyCb(CAMERA_MSG_SHUTTER, 0, 0, mCallbackCookie);
+
+    mZslLock.lock();
+    for (int i = 0; i < mZslHeapDepth; i++) {
+        if (!mZslFrames[i].valid)
+            continue;
+        nsecs_t diff = mZslFrames[i].timestamp - mZslShutterTime;
+        if (diff < 0)
+            diff = -diff;
+        if (best < 0 || diff < best_diff) {
+            best = i;
+            best_diff = diff;
+        }
+    }
+    if (best < 0) {
+        mZslLock.unlock();
+        ALOGE("ERR(%s):zsl ring is empty", __func__);
+        return UNKNOWN_ERROR;
+    }
+
+    /* the preview thread fills the other slots meanwhile */
+    width = mZslFrames[best].width;
+    height = mZslFrames[best].height;
+    src = (const uint8_t *)mZslHeap->data + best * mZslFrameSize;
+    mZslReading = best;
+    mZslLagUs = (int)(best_diff / 1000);
+    mZslLock.unlock();
+
+    /* the encoder wants YUY2 */
+    yuyv = getYuyvBuffer(width, height);
+    if (yuyv != NULL)
+        yuv420pToYuy2(src, yuyv, width, height);
+
+    mZslLock.lock();
+    mZslReading = -1;
+    mZslLock.unlock();
+
+    if (yuyv == NULL)
+        return NO_MEMORY;
+
+    ALOGV("%s: frame %d, %dx%d, %d us from shutter", __func__,
+         best, width, height, mZslLagUs);
+
+    mSecCamera->getSnapshotSize(&pic_width, &pic_height, &pic_size);
+    if (pic_width != width || pic_height != height) {
+        if (pic_width <= width && pic_height <= height)
+            scaled = mGetMemoryCb(-1, pic_width * pic_height * 2, 1, 0);
+        if (scaled == NULL ||
+                !scaleYuy2(yuyv, width, height, (uint8_t *)scaled->data, pic_width, pic_height)) {
+            ALOGE("ERR(%s):Fail on scaling %dx%d zsl frame to %dx%d", __func__,
+                 width, height, pic_width, pic_height);
+            if (scaled)
+                scaled->release(scaled);
+            return UNKNOWN_ERROR;
+        }
+        yuyv = (unsigned char *)scaled->data;
+        width = pic_width;
+        height = pic_height;
+    }
+
+    if (mMsgEnabled & CAMERA_MSG_RAW_IMAGE_NOTIFY)
+        mNotifyCb(CAMERA_MSG_RAW_IMAGE_NOTIFY, 0, 0, mCallbackCookie);
+
+    if (mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE)
+        ret = deliverJpeg(yuyv, width, height);
+
+    if (scaled)
+        scaled->release(scaled);
+    if (ret != NO_ERROR)
+        return ret;
+
+    mZslShots++;
+    return NO_ERROR;
+}
+
+/* keep the capture stream running and encode frame N on the encoder
+ * thread while the sensor reads out frame N+1
+ */
+int CameraHardwareSec::burstCapture(int count)
+{
+    int shots = 0;
+
+    if (mSecCamera->startBurst(kBurstBuffers) < 0) {
+        ALOGE("ERR(%s):Fail on SecCamera->startBurst()", __func__);
+        return UNKNOWN_ERROR;
+    }
+
+    mBurstLock.lock();
+    mBurstHead = mBurstTail = 0;
+    mBurstDone = false;
+    mBurstCancel = false;
+    mBurstDelivered = 0;
+    /* the client drops CAMERA_MSG_COMPRESSED_IMAGE after the first
+     * picture, latch what was asked for at takePicture() time
+     */
+    mBurstMsgs = mMsgEnabled;
+    mBurstLock.unlock();
+
+    if (mBurstEncodeThread->run("CameraBurstEncodeThread", PRIORITY_DEFAULT) != NO_ERROR) {
+        ALOGE("%s : couldn't run burst encode thread", __func__);
+        mSecCamera->stopBurst();
+        return INVALID_OPERATION;
+    }
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    while (shots < count && !mBurstCancel) {
+        int index;
+        unsigned char *frame = mSecCamera->getBurstFrame(&index);
+        if (frame == NULL) {
+            ALOGE("ERR(%s):Fail on SecCamera->getBurstFrame()", __func__);
+            break;
+        }
+
+        if (mBurstMsgs & CAMERA_MSG_SHUTTER)
+            mNotifyCb(CAMERA_MSG_SHUTTER, 0, 0, mCallbackCookie);
+
+        mBurstLock.lock();
+        mBurstQueue[mBurstTail % MAX_BUFFERS].index = index;
+        mBurstQueue[mBurstTail % MAX_BUFFERS].data = frame;
+        mBurstTail++;
+        mBurstCondition.signal();
+        mBurstLock.unlock();
+        shots++;
+    }
+
+    mBurstLock.lock();
+    mBurstDone = true;
+    mBurstCondition.signal();
+    mBurstLock.unlock();
+
+    /* drains whatever is still queued */
+    mBurstEncodeThread->requestExitAndWait();
+
+    nsecs_t elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    if (elapsed > 0)
+        mBurstShotsPerSec100 = (int)(mBurstDelivered * 100000000000LL / elapsed);
+    ALOGI("%s: %d of %d shots in %lld ms, %d.%02d shots/s", __func__,
+         mBurstDelivered, count, elapsed / 1000000,
+         mBurstShotsPerSec100 / 100, mBurstShotsPerSec100 % 100);
+
+    mSecCamera->stopBurst();
+
+    return mBurstDelivered == count ? NO_ERROR : UNKNOWN_ERROR;
+}
+
+int CameraHardwareSec::burstEncodeThread()
+{
+    int width, height, frame_size;
+
+    mSecCamera->getSnapshotSize(&width, &height, &frame_size);
+
+    while (true) {
+        mBurstLock.lock();
+        while (mBurstHead == mBurstTail && !mBurstDone)
+            mBurstCondition.wait(mBurstLock);
+        if (mBurstHead == mBurstTail) {
+            mBurstLock.unlock();
+            break;
+        }
+        BurstFrame frame = mBurstQueue[mBurstHead % MAX_BUFFERS];
+        mBurstHead++;
+        mBurstLock.unlock();
+
+        if (!(mBurstMsgs & CAMERA_MSG_COMPRESSED_IMAGE) ||
+                deliverJpeg(frame.data, width, height) == NO_ERROR)
+            mBurstDelivered++;
+
+        /* the sensor may refill it while we encode the next one */
+        mSecCamera->releaseBurstFrame(frame.index);
+    }
+
+    return NO_ERROR;
+}
+
+/* (re)allocate the capture scratch when the thumbnail or EXIF size it
+ * needs changes; neither depends on the picture size.  must not run
+ * while a shot is in progress.
+ */
+int CameraHardwareSec::initCaptureBuffers(void)
+{
+    /* the back camera's ISP hands over a finished JPEG with EXIF,
+     * only its zero shutter lag and video snapshots are encoded here
+     */
+    if (mSecCamera->getCameraId() == SecCamera::CAMERA_ID_BACK &&
+            mZslDepth == 0 && !mVideoSnapshot)
+        return 0;
+
+    int thumbWidth, thumbHeight, thumbSize;
+    mSecCamera->getThumbnailConfig(&thumbWidth, &thumbHeight, &thumbSize);
+    const int exifSize = EXIF_FILE_SIZE + JPG_STREAM_BUF_SIZE;
+
+    if (mThumbnailHeap && mExifHeap &&
+            mCaptureThumbBytes == thumbSize && mCaptureExifBytes == exifSize) {
+        mCaptureReuses++;
+        return 0;
+    }
+
+    releaseCaptureBuffers();
+
+    mThumbnailHeap = mGetMemoryCb(-1, thumbSize, 1, 0);
+    mExifHeap = mGetMemoryCb(-1, exifSize, 1, 0);
+    if (!mThumbnailHeap || !mExifHeap) {
+        ALOGE("ERR(%s):Fail on allocating capture buffers (thumbnail %d, exif %d bytes)",
+             __func__, thumbSize, exifSize);
+        releaseCaptureBuffers();
+        return -1;
+    }
+
+    mCaptureThumbBytes = thumbSize;
+    mCaptureExifBytes = exifSize;
+    mCaptureAllocs += 2;
+    ALOGV("%s: thumbnail %d, exif %d bytes", __func__, thumbSize, exifSize);
+    return 0;
+}
+
+void CameraHardwareSec::releaseCaptureBuffers(void)
+{
+    if (mThumbnailHeap) {
+        mThumbnailHeap->release(mThumbnailHeap);
+        mThumbnailHeap = 0;
+    }
+    if (mExifHeap) {
+        mExifHeap->release(mExifHeap);
+        mExifHeap = 0;
+    }
+    mCaptureThumbBytes = 0;
+    mCaptureExifBytes = 0;
+}
+
 status_t CameraHardwareSec::waitCaptureCompletion() {
     // 5 seconds timeout
     nsecs_t endTime = 5000000000LL + systemTime(SYSTEM_TIME_MONOTONIC);
@@ -1204,7 +2152,21 @@ status_t CameraHardwareSec::takePicture()
 {
     ALOGV("%s :", __func__);
 
-    stopPreview();
+    /* with a filled ring and no recording, the shot comes from the
+     * ring and preview keeps running
+     */
+    mRecordLock.lock();
+    mVideoSnapshot = mRecordRunning;
+    mRecordLock.unlock();
+
+    bool preview = previewEnabled();
+    mZslLock.lock();
+    mZslShot = !mVideoSnapshot && preview && mZslDepth > 0 && mZslCount > 0;
+    mZslShutterTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    mZslLock.unlock();
+
+    if (!mZslShot && !mVideoSnapshot)
+        stopPreview();
 
     if (!mRawHeap) {
         int rawHeapSize = mPostViewSize;
@@ -1219,13 +2181,19 @@ status_t CameraHardwareSec::takePicture()
         return TIMED_OUT;
     }
 
+    /* flag the shot before the thread can finish it */
+    mCaptureLock.lock();
+    mCaptureInProgress = true;
+    mCaptureLock.unlock();
+
     if (mPictureThread->run("CameraPictureThread", PRIORITY_DEFAULT) != NO_ERROR) {
         ALOGE("%s : couldn't run picture thread", __func__);
+        mCaptureLock.lock();
+        mCaptureInProgress = false;
+        mCaptureCondition.broadcast();
+        mCaptureLock.unlock();
         return INVALID_OPERATION;
     }
-    mCaptureLock.lock();
-    mCaptureInProgress = true;
-    mCaptureLock.unlock();
 
     return NO_ERROR;
 }
@@ -1234,6 +2202,7 @@ status_t CameraHardwareSec::cancelPicture()
 {
     ALOGV("%s", __func__);
 
+    mBurstCancel = true;
     if (mPictureThread.get()) {
         ALOGV("%s: waiting for picture thread to exit", __func__);
         mPictureThread->requestExitAndWait();
@@ -1303,6 +2272,48 @@ status_t CameraHardwareSec::dump(int fd) const
         mInternalParameters.dump(fd, args);
         snprintf(buffer, 255, " preview running(%s)\n", mPreviewRunning?"true": "false");
         result.append(buffer);
+        snprintf(buffer, 255, " capture buffers: thumbnail %d + exif %d bytes, allocs(%d) reuses(%d)\n",
+                 mCaptureThumbBytes, mCaptureExifBytes,
+                 mCaptureAllocs, mCaptureReuses);
+        result.append(buffer);
+        snprintf(buffer, 255, " burst count(%d), last burst %d shots at %d.%02d shots/s\n",
+                 mBurstCount, mBurstDelivered,
+                 mBurstShotsPerSec100 / 100, mBurstShotsPerSec100 % 100);
+        result.append(buffer);
+        snprintf(buffer, 255, " setParameters calls(%d) unchanged(%d)\n",
+                 mParamCalls, mParamUnchanged);
+        result.append(buffer);
+        snprintf(buffer, 255, " video snapshots(%d)\n", mVideoSnapshots);
+        result.append(buffer);
+        snprintf(buffer, 255, " zsl depth(%d) frames(%d) %d bytes, %d shots, last %d us from shutter\n",
+                 mZslDepth, mZslCount, mZslHeap ? mZslFrameSize * mZslHeapDepth : 0,
+                 mZslShots, mZslLagUs);
+        result.append(buffer);
+        snprintf(buffer, 255, " preview %d.%02d fps, skipped(%d) dropped(%d)\n",
+                 mPreviewFps.rate100() / 100, mPreviewFps.rate100() % 100,
+                 mFramesSkipped, mFramesDropped);
+        result.append(buffer);
+        snprintf(buffer, 255, " display queue drops(%d), callback queue drops(%d)\n",
+                 mDisplayQueue.drops, mCallbackQueue.drops);
+        result.append(buffer);
+        snprintf(buffer, 255, " preview callback buffers(%d), dropped callbacks(%d)\n",
+                 mCallbackPoolSize, mCallbacksDropped);
+        result.append(buffer);
+        snprintf(buffer, 255, " fimc buffers: preview(%d) record(%d)\n",
+                 mSecCamera->getPreviewBufferCount(), mSecCamera->getRecordBufferCount());
+        result.append(buffer);
+        snprintf(buffer, 255, " opened in %d us (%s)\n", mOpenUs, mOpenWarm ? "warm" : "cold");
+        result.append(buffer);
+        g_open_cold.dump(result);
+        g_open_warm.dump(result);
+        mFrameLatency.dump(result);
+        mPreviewCopy.dump(result);
+        mPreviewCallback.dump(result);
+        mCaptureShot.dump(result);
+        mCaptureExif.dump(result);
+        mCaptureEncode.dump(result);
+        mCaptureMemcpy.dump(result);
+        mCaptureTotal.dump(result);
     } else {
         result.append("No camera client yet.\n");
     }
@@ -1351,12 +2362,38 @@ bool CameraHardwareSec::isSupportedParameter(const char * const parm,
     /* NOTREACHED */
 }
 
+bool CameraHardwareSec::paramChanged(const CameraParameters& params,
+                                     const char *key) const
+{
+    if (!mParametersApplied)
+        return true;
+
+    const char *new_str = params.get(key);
+    const char *old_str = mAppliedParameters.get(key);
+
+    if (new_str == NULL || old_str == NULL)
+        return new_str != old_str;
+    return strcmp(new_str, old_str) != 0;
+}
+
 status_t CameraHardwareSec::setParameters(const CameraParameters& params)
 {
     ALOGV("%s :", __func__);
 
     status_t ret = NO_ERROR;
 
+    mParamCalls++;
+
+    /* applications send the whole set for every zoom step or focus
+     * area, usually with nothing else changed.  only the keys that
+     * differ from the last accepted set are applied below.
+     */
+    String8 new_flat = params.flatten();
+    if (mParametersApplied && new_flat == mAppliedFlat) {
+        mParamUnchanged++;
+        return NO_ERROR;
+    }
+
     /* if someone calls us while picture thread is running, it could screw
      * up the sensor quite a bit so return error.
      */
@@ -1364,6 +2401,14 @@ status_t CameraHardwareSec::setParameters(const CameraParameters& params)
         return TIMED_OUT;
     }
 
+    /* the keys below come from mInternalParameters, which only changes
+     * in initDefaultParameters, so they are applied with a full set and
+     * again after one of them failed
+     */
+    bool full_apply = !mInternalApplied;
+    bool internal_failed = false;
+    Vector<const char *> failed;
+
     // preview size
     int new_preview_width  = 0;
     int new_preview_height = 0;
@@ -1378,7 +2423,12 @@ status_t CameraHardwareSec::setParameters(const CameraParameters& params)
         return BAD_VALUE;
     }
 
-    if (0 < new_preview_width && 0 < new_preview_height &&
+    bool preview_changed = paramChanged(params, CameraParameters::KEY_PREVIEW_SIZE) ||
+                           paramChanged(params, CameraParameters::KEY_PREVIEW_FORMAT);
+
+    if (!preview_changed) {
+        ALOGV("%s: preview size and format has not changed", __func__);
+    } else if (0 < new_preview_width && 0 < new_preview_height &&
             new_str_preview_format != NULL &&
             isSupportedPreviewSize(new_preview_width, new_preview_height)) {
         int new_preview_format = V4L2_PIX_FMT_YUV420;
@@ -1397,12 +2447,15 @@ status_t CameraHardwareSec::setParameters(const CameraParameters& params)
                 ALOGE("ERR(%s):Fail on mSecCamera->setPreviewSize(width(%d), height(%d), format(%d))",
                      __func__, new_preview_width, new_preview_height, new_preview_format);
                 ret = UNKNOWN_ERROR;
+                failed.add(CameraParameters::KEY_PREVIEW_SIZE);
             } else {
+                Mutex::Autolock lock(mPreviewWindowLock);
                 if (mPreviewWindow) {
                     if (mPreviewRunning && !mPreviewStartDeferred) {
                         ALOGE("ERR(%s): preview is running, cannot change size and format!",
                              __func__);
                         ret = INVALID_OPERATION;
+                        failed.add(CameraParameters::KEY_PREVIEW_SIZE);
                     }
 
                     ALOGV("%s: mPreviewWindow (%p) set_buffers_geometry", __func__, mPreviewWindow);
@@ -1424,6 +2477,7 @@ status_t CameraHardwareSec::setParameters(const CameraParameters& params)
                 __func__, new_preview_width, new_preview_height);
 
         ret = INVALID_OPERATION;
+        failed.add(CameraParameters::KEY_PREVIEW_SIZE);
     }
 
     int new_picture_width  = 0;
@@ -1431,349 +2485,383 @@ status_t CameraHardwareSec::setParameters(const CameraParameters& params)
 
     params.getPictureSize(&new_picture_width, &new_picture_height);
     ALOGV("%s : new_picture_width x new_picture_height = %dx%d", __func__, new_picture_width, new_picture_height);
-    if (0 < new_picture_width && 0 < new_picture_height) {
+    if (paramChanged(params, CameraParameters::KEY_PICTURE_SIZE) &&
+            0 < new_picture_width && 0 < new_picture_height) {
         ALOGV("%s: setSnapshotSize", __func__);
         if (mSecCamera->setSnapshotSize(new_picture_width, new_picture_height) < 0) {
             ALOGE("ERR(%s):Fail on mSecCamera->setSnapshotSize(width(%d), height(%d))",
                     __func__, new_picture_width, new_picture_height);
             ret = UNKNOWN_ERROR;
+            failed.add(CameraParameters::KEY_PICTURE_SIZE);
         } else {
             mParameters.setPictureSize(new_picture_width, new_picture_height);
+
+            /* a running shot reallocates at its own start if needed */
+            Mutex::Autolock lock(mCaptureLock);
+            if (!mCaptureInProgress)
+                initCaptureBuffers();
         }
     }
 
     // picture format
     const char *new_str_picture_format = params.getPictureFormat();
     ALOGV("%s : new_str_picture_format %s", __func__, new_str_picture_format);
-    if (new_str_picture_format != NULL) {
-        int new_picture_format = 0;
-
-        if (!strcmp(new_str_picture_format, CameraParameters::PIXEL_FORMAT_RGB565))
-            new_picture_format = V4L2_PIX_FMT_RGB565;
-        else if (!strcmp(new_str_picture_format, CameraParameters::PIXEL_FORMAT_RGBA8888))
-            new_picture_format = V4L2_PIX_FMT_RGB32;
-        else if (!strcmp(new_str_picture_format, CameraParameters::PIXEL_FORMAT_YUV420SP))
-            new_picture_format = V4L2_PIX_FMT_NV21;
-        else if (!strcmp(new_str_picture_format, "yuv420sp_custom"))
-            new_picture_format = V4L2_PIX_FMT_NV12T;
-        else if (!strcmp(new_str_picture_format, "yuv420p"))
-            new_picture_format = V4L2_PIX_FMT_YUV420;
-        else if (!strcmp(new_str_picture_format, "yuv422i"))
-            new_picture_format = V4L2_PIX_FMT_YUYV;
-        else if (!strcmp(new_str_picture_format, "uyv422i_custom")) //Zero copy UYVY format
-            new_picture_format = V4L2_PIX_FMT_UYVY;
-        else if (!strcmp(new_str_picture_format, "uyv422i")) //Non-zero copy UYVY format
-            new_picture_format = V4L2_PIX_FMT_UYVY;
-        else if (!strcmp(new_str_picture_format, CameraParameters::PIXEL_FORMAT_JPEG))
-            new_picture_format = V4L2_PIX_FMT_YUYV;
-        else if (!strcmp(new_str_picture_format, "yuv422p"))
-            new_picture_format = V4L2_PIX_FMT_YUV422P;
-        else
-            new_picture_format = V4L2_PIX_FMT_NV21; //for 3rd party
+    if (new_str_picture_format != NULL &&
+            paramChanged(params, CameraParameters::KEY_PICTURE_FORMAT)) {
+        const ParamMap *format = FIND_PARAM(kPictureFormats, new_str_picture_format);
+        int new_picture_format = format ? format->value : V4L2_PIX_FMT_NV21; //for 3rd party
 
         if (mSecCamera->setSnapshotPixelFormat(new_picture_format) < 0) {
             ALOGE("ERR(%s):Fail on mSecCamera->setSnapshotPixelFormat(format(%d))", __func__, new_picture_format);
             ret = UNKNOWN_ERROR;
+            failed.add(CameraParameters::KEY_PICTURE_FORMAT);
         } else {
             mParameters.setPictureFormat(new_str_picture_format);
         }
     }
 
     //JPEG image quality
-    int new_jpeg_quality = params.getInt(CameraParameters::KEY_JPEG_QUALITY);
-    ALOGV("%s : new_jpeg_quality %d", __func__, new_jpeg_quality);
-    /* we ignore bad values */
-    if (new_jpeg_quality >=1 && new_jpeg_quality <= 100) {
-        if (mSecCamera->setJpegQuality(new_jpeg_quality) < 0) {
-            ALOGE("ERR(%s):Fail on mSecCamera->setJpegQuality(quality(%d))", __func__, new_jpeg_quality);
-            ret = UNKNOWN_ERROR;
-        } else {
-            mParameters.set(CameraParameters::KEY_JPEG_QUALITY, new_jpeg_quality);
+    if (paramChanged(params, CameraParameters::KEY_JPEG_QUALITY)) {
+        int new_jpeg_quality = params.getInt(CameraParameters::KEY_JPEG_QUALITY);
+        ALOGV("%s : new_jpeg_quality %d", __func__, new_jpeg_quality);
+        /* we ignore bad values */
+        if (new_jpeg_quality >=1 && new_jpeg_quality <= 100) {
+            if (mSecCamera->setJpegQuality(new_jpeg_quality) < 0) {
+                ALOGE("ERR(%s):Fail on mSecCamera->setJpegQuality(quality(%d))", __func__, new_jpeg_quality);
+                ret = UNKNOWN_ERROR;
+                failed.add(CameraParameters::KEY_JPEG_QUALITY);
+            } else {
+                mParameters.set(CameraParameters::KEY_JPEG_QUALITY, new_jpeg_quality);
+            }
         }
     }
 
     // JPEG thumbnail size
-    int new_jpeg_thumbnail_width = params.getInt(CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH);
-    int new_jpeg_thumbnail_height= params.getInt(CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT);
-    if (0 <= new_jpeg_thumbnail_width && 0 <= new_jpeg_thumbnail_height) {
-        if (mSecCamera->setJpegThumbnailSize(new_jpeg_thumbnail_width, new_jpeg_thumbnail_height) < 0) {
-            ALOGE("ERR(%s):Fail on mSecCamera->setJpegThumbnailSize(width(%d), height(%d))", __func__, new_jpeg_thumbnail_width, new_jpeg_thumbnail_height);
-            ret = UNKNOWN_ERROR;
-        } else {
-            mParameters.set(CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH, new_jpeg_thumbnail_width);
-            mParameters.set(CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT, new_jpeg_thumbnail_height);
+    if (paramChanged(params, CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH) ||
+            paramChanged(params, CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT)) {
+        int new_jpeg_thumbnail_width = params.getInt(CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH);
+        int new_jpeg_thumbnail_height= params.getInt(CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT);
+        if (0 <= new_jpeg_thumbnail_width && 0 <= new_jpeg_thumbnail_height) {
+            if (mSecCamera->setJpegThumbnailSize(new_jpeg_thumbnail_width, new_jpeg_thumbnail_height) < 0) {
+                ALOGE("ERR(%s):Fail on mSecCamera->setJpegThumbnailSize(width(%d), height(%d))", __func__, new_jpeg_thumbnail_width, new_jpeg_thumbnail_height);
+                ret = UNKNOWN_ERROR;
+                failed.add(CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH);
+            } else {
+                mParameters.set(CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH, new_jpeg_thumbnail_width);
+                mParameters.set(CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT, new_jpeg_thumbnail_height);
+            }
         }
     }
 
     // frame rate
-    int new_frame_rate = params.getPreviewFrameRate();
-    /* ignore any fps request, we're determine fps automatically based
-     * on scene mode.  don't return an error because it causes CTS failure.
-     */
-    if (new_frame_rate != mParameters.getPreviewFrameRate()) {
-        ALOGW("WARN(%s): request for preview frame %d not allowed, != %d\n",
-             __func__, new_frame_rate, mParameters.getPreviewFrameRate());
+    if (paramChanged(params, CameraParameters::KEY_PREVIEW_FRAME_RATE)) {
+        int new_frame_rate = params.getPreviewFrameRate();
+        /* ignore any fps request, we're determine fps automatically based
+         * on scene mode.  don't return an error because it causes CTS failure.
+         */
+        if (new_frame_rate != mParameters.getPreviewFrameRate()) {
+            ALOGW("WARN(%s): request for preview frame %d not allowed, != %d\n",
+                 __func__, new_frame_rate, mParameters.getPreviewFrameRate());
+        }
     }
 
     // rotation
-    int new_rotation = params.getInt(CameraParameters::KEY_ROTATION);
-    ALOGV("%s : new_rotation %d", __func__, new_rotation);
-    if (0 <= new_rotation) {
-        ALOGV("%s : set orientation:%d\n", __func__, new_rotation);
-        if (mSecCamera->setExifOrientationInfo(new_rotation) < 0) {
-            ALOGE("ERR(%s):Fail on mSecCamera->setExifOrientationInfo(%d)", __func__, new_rotation);
-            ret = UNKNOWN_ERROR;
-        } else {
-            mParameters.set(CameraParameters::KEY_ROTATION, new_rotation);
+    if (paramChanged(params, CameraParameters::KEY_ROTATION)) {
+        int new_rotation = params.getInt(CameraParameters::KEY_ROTATION);
+        ALOGV("%s : new_rotation %d", __func__, new_rotation);
+        if (0 <= new_rotation) {
+            ALOGV("%s : set orientation:%d\n", __func__, new_rotation);
+            if (mSecCamera->setExifOrientationInfo(new_rotation) < 0) {
+                ALOGE("ERR(%s):Fail on mSecCamera->setExifOrientationInfo(%d)", __func__, new_rotation);
+                ret = UNKNOWN_ERROR;
+                failed.add(CameraParameters::KEY_ROTATION);
+            } else {
+                mParameters.set(CameraParameters::KEY_ROTATION, new_rotation);
+            }
         }
     }
 
     // brightness
-    int new_exposure_compensation = params.getInt(CameraParameters::KEY_EXPOSURE_COMPENSATION);
-    int max_exposure_compensation = params.getInt(CameraParameters::KEY_MAX_EXPOSURE_COMPENSATION);
-    int min_exposure_compensation = params.getInt(CameraParameters::KEY_MIN_EXPOSURE_COMPENSATION);
-    ALOGV("%s : new_exposure_compensation %d", __func__, new_exposure_compensation);
-    if ((min_exposure_compensation <= new_exposure_compensation) &&
-        (max_exposure_compensation >= new_exposure_compensation)) {
-        if (mSecCamera->setBrightness(new_exposure_compensation) < 0) {
-            ALOGE("ERR(%s):Fail on mSecCamera->setBrightness(brightness(%d))", __func__, new_exposure_compensation);
-            ret = UNKNOWN_ERROR;
-        } else {
-            mParameters.set(CameraParameters::KEY_EXPOSURE_COMPENSATION, new_exposure_compensation);
+    if (paramChanged(params, CameraParameters::KEY_EXPOSURE_COMPENSATION)) {
+        int new_exposure_compensation = params.getInt(CameraParameters::KEY_EXPOSURE_COMPENSATION);
+        int max_exposure_compensation = params.getInt(CameraParameters::KEY_MAX_EXPOSURE_COMPENSATION);
+        int min_exposure_compensation = params.getInt(CameraParameters::KEY_MIN_EXPOSURE_COMPENSATION);
+        ALOGV("%s : new_exposure_compensation %d", __func__, new_exposure_compensation);
+        if ((min_exposure_compensation <= new_exposure_compensation) &&
+            (max_exposure_compensation >= new_exposure_compensation)) {
+            if (mSecCamera->setBrightness(new_exposure_compensation) < 0) {
+                ALOGE("ERR(%s):Fail on mSecCamera->setBrightness(brightness(%d))", __func__, new_exposure_compensation);
+                ret = UNKNOWN_ERROR;
+                failed.add(CameraParameters::KEY_EXPOSURE_COMPENSATION);
+            } else {
+                mParameters.set(CameraParameters::KEY_EXPOSURE_COMPENSATION, new_exposure_compensation);
+            }
         }
     }
 
     // ISO
     const char *new_iso_str = params.get("iso");
     ALOGV("%s : new_iso_str %s", __func__, new_iso_str);
-    if (new_iso_str != NULL) {
-        int new_iso = -1;
-
-        if (!strcmp(new_iso_str, "auto")) {
-            new_iso = ISO_AUTO;
-        } else if (!strcmp(new_iso_str, "ISO50")) {
-            new_iso = ISO_50;
-        } else if (!strcmp(new_iso_str, "ISO100")) {
-            new_iso = ISO_100;
-        } else if (!strcmp(new_iso_str, "ISO200")) {
-            new_iso = ISO_200;
-        } else if (!strcmp(new_iso_str, "ISO400")) {
-            new_iso = ISO_400;
-        } else if (!strcmp(new_iso_str, "ISO800")) {
-            new_iso = ISO_800;
-        } else if (!strcmp(new_iso_str, "ISO1600")) {
-            new_iso = ISO_1600;
-        } else {
+    if (new_iso_str != NULL && paramChanged(params, "iso")) {
+        const ParamMap *iso = FIND_PARAM(kIsoValues, new_iso_str);
+
+        if (iso == NULL) {
             ALOGE("ERR(%s):Invalid iso value(%s)", __func__, new_iso_str);
             ret = UNKNOWN_ERROR;
+            failed.add("iso");
+        } else if (mSecCamera->setISO(iso->value) < 0) {
+            ALOGE("ERR(%s):Fail on mSecCamera->setISO(new_iso(%d))", __func__, iso->value);
+            ret = UNKNOWN_ERROR;
+            failed.add("iso");
+        } else {
+            mParameters.set("iso", new_iso_str);
         }
+    }
 
-        if (0 <= new_iso) {
-            if (mSecCamera->setISO(new_iso) < 0) {
-                ALOGE("ERR(%s):Fail on mSecCamera->setISO(new_iso(%d))", __func__, new_iso);
-                ret = UNKNOWN_ERROR;
-            } else {
-                mParameters.set("iso", new_iso_str);
+    // burst capture, front camera only
+    const char *new_burst_str = params.get("burst-capture");
+    if (new_burst_str != NULL && getCameraId() == SecCamera::CAMERA_ID_FRONT &&
+            paramChanged(params, "burst-capture")) {
+        int new_burst = atoi(new_burst_str);
+
+        if (new_burst < 0 || kMaxBurstCount < new_burst) {
+            ALOGE("ERR(%s):Invalid burst count(%s)", __func__, new_burst_str);
+            ret = UNKNOWN_ERROR;
+            failed.add("burst-capture");
+        } else {
+            mBurstCount = new_burst;
+            mParameters.set("burst-capture", new_burst);
+        }
+    }
+
+    // preview callback buffer mode, 0 turns it off.  takes effect on
+    // the next startPreview.
+    const char *new_cb_buffers_str = params.get("preview-callback-buffers");
+    if (new_cb_buffers_str != NULL && paramChanged(params, "preview-callback-buffers")) {
+        int new_cb_buffers = atoi(new_cb_buffers_str);
+
+        if (new_cb_buffers < 0 || kMaxCallbackBuffers < new_cb_buffers) {
+            ALOGE("ERR(%s):Invalid preview callback buffers(%s)", __func__, new_cb_buffers_str);
+            ret = UNKNOWN_ERROR;
+            failed.add("preview-callback-buffers");
+        } else {
+            mCallbackBufferCount = new_cb_buffers;
+            mParameters.set("preview-callback-buffers", new_cb_buffers);
+        }
+    }
+
+    // FIMC buffers per stream, 0 sizes them from the consumers.  take
+    // effect on the next startPreview / startRecording.
+    const char *new_preview_bufs_str = params.get("preview-buffers");
+    if (new_preview_bufs_str != NULL && paramChanged(params, "preview-buffers")) {
+        int new_preview_bufs = atoi(new_preview_bufs_str);
+
+        if (new_preview_bufs != 0 &&
+                (new_preview_bufs < MIN_STREAM_BUFFERS || MAX_BUFFERS < new_preview_bufs)) {
+            ALOGE("ERR(%s):Invalid preview buffers(%s)", __func__, new_preview_bufs_str);
+            ret = UNKNOWN_ERROR;
+            failed.add("preview-buffers");
+        } else {
+            mPreviewBufferCount = new_preview_bufs;
+            mParameters.set("preview-buffers", new_preview_bufs);
+        }
+    }
+
+    const char *new_record_bufs_str = params.get("record-buffers");
+    if (new_record_bufs_str != NULL && paramChanged(params, "record-buffers")) {
+        int new_record_bufs = atoi(new_record_bufs_str);
+
+        if (new_record_bufs != 0 &&
+                (new_record_bufs < MIN_STREAM_BUFFERS || MAX_BUFFERS < new_record_bufs)) {
+            ALOGE("ERR(%s):Invalid record buffers(%s)", __func__, new_record_bufs_str);
+            ret = UNKNOWN_ERROR;
+            failed.add("record-buffers");
+        } else {
+            mRecordBufferCount = new_record_bufs;
+            mParameters.set("record-buffers", new_record_bufs);
+        }
+    }
+
+    // zero shutter lag, back camera only.  takes effect on the next
+    // preview frame; the ring is sized for the preview resolution and
+    // shots are scaled down to the picture size, so a picture larger
+    // than the preview quietly keeps zsl off: the call still succeeds
+    // and getParameters() reports zsl=off.
+    const char *new_zsl_str = params.get("zsl");
+    if (new_zsl_str != NULL && getCameraId() == SecCamera::CAMERA_ID_BACK &&
+            (paramChanged(params, "zsl") || paramChanged(params, "zsl-depth") ||
+             paramChanged(params, CameraParameters::KEY_PICTURE_SIZE) ||
+             paramChanged(params, CameraParameters::KEY_PREVIEW_SIZE))) {
+        int new_zsl_depth = params.getInt("zsl-depth");
+        int zsl_preview_width, zsl_preview_height;
+        int zsl_picture_width, zsl_picture_height;
+
+        params.getPreviewSize(&zsl_preview_width, &zsl_preview_height);
+        params.getPictureSize(&zsl_picture_width, &zsl_picture_height);
+
+        if (strcmp(new_zsl_str, "on") && strcmp(new_zsl_str, "off")) {
+            ALOGE("ERR(%s):Invalid zsl value(%s)", __func__, new_zsl_str);
+            ret = UNKNOWN_ERROR;
+            failed.add("zsl");
+        } else if (new_zsl_depth < 1 || kMaxZslDepth < new_zsl_depth) {
+            ALOGE("ERR(%s):Invalid zsl depth(%d)", __func__, new_zsl_depth);
+            ret = UNKNOWN_ERROR;
+            failed.add("zsl");
+        } else if (!strcmp(new_zsl_str, "on") &&
+                   (zsl_picture_width > zsl_preview_width ||
+                    zsl_picture_height > zsl_preview_height)) {
+            ALOGW("WARN(%s):zsl off, picture size(%dx%d) is larger than the preview(%dx%d)",
+                 __func__, zsl_picture_width, zsl_picture_height,
+                 zsl_preview_width, zsl_preview_height);
+            Mutex::Autolock lock(mZslLock);
+            mZslDepth = 0;
+            resetZslLocked();
+            mParameters.set("zsl", "off");
+        } else {
+            Mutex::Autolock lock(mZslLock);
+            int depth = strcmp(new_zsl_str, "on") ? 0 : new_zsl_depth;
+            if (depth != mZslDepth) {
+                mZslDepth = depth;
+                resetZslLocked();
             }
+            mParameters.set("zsl", new_zsl_str);
+            mParameters.set("zsl-depth", new_zsl_depth);
         }
     }
 
     // whitebalance
     const char *new_white_str = params.get(CameraParameters::KEY_WHITE_BALANCE);
     ALOGV("%s : new_white_str %s", __func__, new_white_str);
-    if (new_white_str != NULL) {
-        int new_white = -1;
-
-        if (!strcmp(new_white_str, CameraParameters::WHITE_BALANCE_AUTO))
-            new_white = WHITE_BALANCE_AUTO;
-        else if (!strcmp(new_white_str,
-                         CameraParameters::WHITE_BALANCE_DAYLIGHT))
-            new_white = WHITE_BALANCE_SUNNY;
-        else if (!strcmp(new_white_str,
-                         CameraParameters::WHITE_BALANCE_CLOUDY_DAYLIGHT))
-            new_white = WHITE_BALANCE_CLOUDY;
-        else if (!strcmp(new_white_str,
-                         CameraParameters::WHITE_BALANCE_FLUORESCENT))
-            new_white = WHITE_BALANCE_FLUORESCENT;
-        else if (!strcmp(new_white_str,
-                         CameraParameters::WHITE_BALANCE_INCANDESCENT))
-            new_white = WHITE_BALANCE_TUNGSTEN;
-        else {
+    if (new_white_str != NULL && paramChanged(params, CameraParameters::KEY_WHITE_BALANCE)) {
+        const ParamMap *white = FIND_PARAM(kWhiteBalances, new_white_str);
+
+        if (white == NULL) {
             ALOGE("ERR(%s):Invalid white balance(%s)", __func__, new_white_str); //twilight, shade, warm_flourescent
             ret = UNKNOWN_ERROR;
-        }
-
-        if (0 <= new_white) {
-            if (mSecCamera->setWhiteBalance(new_white) < 0) {
-                ALOGE("ERR(%s):Fail on mSecCamera->setWhiteBalance(white(%d))", __func__, new_white);
-                ret = UNKNOWN_ERROR;
-            } else {
-                mParameters.set(CameraParameters::KEY_WHITE_BALANCE, new_white_str);
-            }
+            failed.add(CameraParameters::KEY_WHITE_BALANCE);
+        } else if (mSecCamera->setWhiteBalance(white->value) < 0) {
+            ALOGE("ERR(%s):Fail on mSecCamera->setWhiteBalance(white(%d))", __func__, white->value);
+            ret = UNKNOWN_ERROR;
+            failed.add(CameraParameters::KEY_WHITE_BALANCE);
+        } else {
+            mParameters.set(CameraParameters::KEY_WHITE_BALANCE, new_white_str);
         }
     }
 
     // scene mode
     const char *new_scene_mode_str = params.get(CameraParameters::KEY_SCENE_MODE);
     const char *current_scene_mode_str = mParameters.get(CameraParameters::KEY_SCENE_MODE);
+    bool scene_changed = paramChanged(params, CameraParameters::KEY_SCENE_MODE);
 
     // fps range
-    int new_min_fps = 0;
-    int new_max_fps = 0;
-    int current_min_fps, current_max_fps;
-    params.getPreviewFpsRange(&new_min_fps, &new_max_fps);
-    mParameters.getPreviewFpsRange(&current_min_fps, &current_max_fps);
-    /* our fps range is determined by the sensor, reject any request
-     * that isn't exactly what we're already at.
-     * but the check is performed when requesting only changing fps range
-     */
-    if (new_scene_mode_str && current_scene_mode_str) {
-        if (!strcmp(new_scene_mode_str, current_scene_mode_str)) {
-            if ((new_min_fps != current_min_fps) || (new_max_fps != current_max_fps)) {
-                ALOGW("%s : requested new_min_fps = %d, new_max_fps = %d not allowed",
-                        __func__, new_min_fps, new_max_fps);
-                ALOGE("%s : current_min_fps = %d, current_max_fps = %d",
-                        __func__, current_min_fps, current_max_fps);
-                ret = UNKNOWN_ERROR;
+    if (scene_changed || paramChanged(params, CameraParameters::KEY_PREVIEW_FPS_RANGE)) {
+        int new_min_fps = 0;
+        int new_max_fps = 0;
+        int current_min_fps, current_max_fps;
+        params.getPreviewFpsRange(&new_min_fps, &new_max_fps);
+        mParameters.getPreviewFpsRange(&current_min_fps, &current_max_fps);
+        /* our fps range is determined by the sensor, reject any request
+         * that isn't exactly what we're already at.
+         * but the check is performed when requesting only changing fps range
+         */
+        if (new_scene_mode_str && current_scene_mode_str) {
+            if (!strcmp(new_scene_mode_str, current_scene_mode_str)) {
+                if ((new_min_fps != current_min_fps) || (new_max_fps != current_max_fps)) {
+                    ALOGW("%s : requested new_min_fps = %d, new_max_fps = %d not allowed",
+                            __func__, new_min_fps, new_max_fps);
+                    ALOGE("%s : current_min_fps = %d, current_max_fps = %d",
+                            __func__, current_min_fps, current_max_fps);
+                    ret = UNKNOWN_ERROR;
+                    failed.add(CameraParameters::KEY_PREVIEW_FPS_RANGE);
+                }
             }
+        } else {
+            /* Check basic validation if scene mode is different */
+            if ((new_min_fps > new_max_fps) ||
+                (new_min_fps < 0) || (new_max_fps < 0))
+        {
+            ret = UNKNOWN_ERROR;
+            failed.add(CameraParameters::KEY_PREVIEW_FPS_RANGE);
+        }
         }
-    } else {
-        /* Check basic validation if scene mode is different */
-        if ((new_min_fps > new_max_fps) ||
-            (new_min_fps < 0) || (new_max_fps < 0))
-        ret = UNKNOWN_ERROR;
     }
 
     const char *new_focus_mode_str = params.get(CameraParameters::KEY_FOCUS_MODE);
 
     if (mSecCamera->getCameraId() == SecCamera::CAMERA_ID_BACK) {
         int  new_scene_mode = -1;
+        bool focus_changed = scene_changed ||
+                             paramChanged(params, CameraParameters::KEY_FOCUS_MODE);
 
 #ifdef HAVE_FLASH
         const char *new_flash_mode_str = params.get(CameraParameters::KEY_FLASH_MODE);
+        bool flash_changed = scene_changed ||
+                             paramChanged(params, CameraParameters::KEY_FLASH_MODE);
 #endif
 
-        // fps range is (15000,30000) by default.
-        mParameters.set(CameraParameters::KEY_SUPPORTED_PREVIEW_FPS_RANGE, "(15000,30000)");
-        mParameters.set(CameraParameters::KEY_PREVIEW_FPS_RANGE,
-                "15000,30000");
+        const SceneModeMap *scene = FIND_PARAM(kSceneModes, new_scene_mode_str);
 
-        if (!strcmp(new_scene_mode_str, CameraParameters::SCENE_MODE_AUTO)) {
-            new_scene_mode = SCENE_MODE_NONE;
-#ifdef HAVE_FLASH
-            mParameters.set(CameraParameters::KEY_SUPPORTED_FLASH_MODES, "on,off,auto,torch");
-#endif
-        } else {
-            // defaults for non-auto scene modes
-            if (mSecCamera->getCameraId() == SecCamera::CAMERA_ID_BACK) {
-                new_focus_mode_str = CameraParameters::FOCUS_MODE_AUTO;
+        if (scene == NULL) {
+            if (scene_changed) {
+                ALOGE("%s::unmatched scene_mode(%s)",
+                        __func__, new_scene_mode_str); //action, night-portrait, theatre, steadyphoto
+                ret = UNKNOWN_ERROR;
+                failed.add(CameraParameters::KEY_SCENE_MODE);
             }
+        } else if (scene->value != SCENE_MODE_NONE) {
+            // defaults for non-auto scene modes
+            new_focus_mode_str = CameraParameters::FOCUS_MODE_AUTO;
 #ifdef HAVE_FLASH
-            new_flash_mode_str = CameraParameters::FLASH_MODE_OFF;
+            new_flash_mode_str = scene->flash_mode;
 #endif
+        }
 
-            if (!strcmp(new_scene_mode_str,
-                       CameraParameters::SCENE_MODE_PORTRAIT)) {
-                new_scene_mode = SCENE_MODE_PORTRAIT;
-#ifdef HAVE_FLASH
-                new_flash_mode_str = CameraParameters::FLASH_MODE_AUTO;
-                mParameters.set(CameraParameters::KEY_SUPPORTED_FLASH_MODES, "auto");
-#endif
-            } else if (!strcmp(new_scene_mode_str,
-                               CameraParameters::SCENE_MODE_LANDSCAPE)) {
-                new_scene_mode = SCENE_MODE_LANDSCAPE;
-#ifdef HAVE_FLASH
-                new_flash_mode_str = CameraParameters::FLASH_MODE_OFF;
-                mParameters.set(CameraParameters::KEY_SUPPORTED_FLASH_MODES, "off");
-#endif
-            } else if (!strcmp(new_scene_mode_str,
-                               CameraParameters::SCENE_MODE_SPORTS)) {
-                new_scene_mode = SCENE_MODE_SPORTS;
-#ifdef HAVE_FLASH
-                new_flash_mode_str = CameraParameters::FLASH_MODE_OFF;
-                mParameters.set(CameraParameters::KEY_SUPPORTED_FLASH_MODES, "off");
-#endif
-            } else if (!strcmp(new_scene_mode_str,
-                               CameraParameters::SCENE_MODE_PARTY)) {
-                new_scene_mode = SCENE_MODE_PARTY_INDOOR;
-#ifdef HAVE_FLASH
-                new_flash_mode_str = CameraParameters::FLASH_MODE_AUTO;
-                mParameters.set(CameraParameters::KEY_SUPPORTED_FLASH_MODES, "auto");
-#endif
-            } else if ((!strcmp(new_scene_mode_str,
-                                CameraParameters::SCENE_MODE_BEACH)) ||
-                        (!strcmp(new_scene_mode_str,
-                                 CameraParameters::SCENE_MODE_SNOW))) {
-                new_scene_mode = SCENE_MODE_BEACH_SNOW;
-#ifdef HAVE_FLASH
-                new_flash_mode_str = CameraParameters::FLASH_MODE_OFF;
-                mParameters.set(CameraParameters::KEY_SUPPORTED_FLASH_MODES, "off");
-#endif
-            } else if (!strcmp(new_scene_mode_str,
-                               CameraParameters::SCENE_MODE_SUNSET)) {
-                new_scene_mode = SCENE_MODE_SUNSET;
-#ifdef HAVE_FLASH
-                new_flash_mode_str = CameraParameters::FLASH_MODE_OFF;
-                mParameters.set(CameraParameters::KEY_SUPPORTED_FLASH_MODES, "off");
-#endif
-            } else if (!strcmp(new_scene_mode_str,
-                               CameraParameters::SCENE_MODE_NIGHT)) {
-                new_scene_mode = SCENE_MODE_NIGHTSHOT;
+        if (scene != NULL && scene_changed) {
+            new_scene_mode = scene->value;
+
+            // fps range is (15000,30000) by default.
+            if (new_scene_mode == SCENE_MODE_NIGHTSHOT) {
                 mParameters.set(CameraParameters::KEY_SUPPORTED_PREVIEW_FPS_RANGE, "(4000,30000)");
                 mParameters.set(CameraParameters::KEY_PREVIEW_FPS_RANGE,
                                 "4000,30000");
-#ifdef HAVE_FLASH
-                new_flash_mode_str = CameraParameters::FLASH_MODE_OFF;
-                mParameters.set(CameraParameters::KEY_SUPPORTED_FLASH_MODES, "off");
-#endif
-            } else if (!strcmp(new_scene_mode_str,
-                               CameraParameters::SCENE_MODE_FIREWORKS)) {
-                new_scene_mode = SCENE_MODE_FIREWORKS;
-#ifdef HAVE_FLASH
-                new_flash_mode_str = CameraParameters::FLASH_MODE_OFF;
-                mParameters.set(CameraParameters::KEY_SUPPORTED_FLASH_MODES, "off");
-#endif
-            } else if (!strcmp(new_scene_mode_str,
-                               CameraParameters::SCENE_MODE_CANDLELIGHT)) {
-                new_scene_mode = SCENE_MODE_CANDLE_LIGHT;
-#ifdef HAVE_FLASH
-                new_flash_mode_str = CameraParameters::FLASH_MODE_OFF;
-                mParameters.set(CameraParameters::KEY_SUPPORTED_FLASH_MODES, "off");
-#endif
             } else {
-                ALOGE("%s::unmatched scene_mode(%s)",
-                        __func__, new_scene_mode_str); //action, night-portrait, theatre, steadyphoto
-                ret = UNKNOWN_ERROR;
+                mParameters.set(CameraParameters::KEY_SUPPORTED_PREVIEW_FPS_RANGE, "(15000,30000)");
+                mParameters.set(CameraParameters::KEY_PREVIEW_FPS_RANGE,
+                                "15000,30000");
             }
+#ifdef HAVE_FLASH
+            mParameters.set(CameraParameters::KEY_SUPPORTED_FLASH_MODES, scene->flash_modes);
+#endif
         }
 
         // focus mode
-        if (new_focus_mode_str != NULL) {
-            int  new_focus_mode = -1;
+        if (new_focus_mode_str != NULL && focus_changed) {
+            const FocusModeMap *focus = FIND_PARAM(kFocusModes, new_focus_mode_str);
 
-            if (!strcmp(new_focus_mode_str,
-                        CameraParameters::FOCUS_MODE_AUTO)) {
-                new_focus_mode = FOCUS_MODE_AUTO;
-                mParameters.set(CameraParameters::KEY_FOCUS_DISTANCES,
-                                BACK_CAMERA_AUTO_FOCUS_DISTANCES_STR);
-            }
-            else if (!strcmp(new_focus_mode_str,
-                             CameraParameters::FOCUS_MODE_MACRO)) {
-                new_focus_mode = FOCUS_MODE_MACRO;
-                mParameters.set(CameraParameters::KEY_FOCUS_DISTANCES,
-                                BACK_CAMERA_MACRO_FOCUS_DISTANCES_STR);
-            }
-            else if (!strcmp(new_focus_mode_str,
-                             CameraParameters::FOCUS_MODE_INFINITY)) {
-                new_focus_mode = FOCUS_MODE_INFINITY;
-                mParameters.set(CameraParameters::KEY_FOCUS_DISTANCES,
-                                BACK_CAMERA_INFINITY_FOCUS_DISTANCES_STR);
+            if (focus != NULL) {
+                mParameters.set(CameraParameters::KEY_FOCUS_DISTANCES, focus->distances);
+
+                // Disable face-detect
+                if (mSecCamera->setFaceDetect(FACE_DETECTION_OFF) < 0) {
+                    ALOGE("%s::mSecCamera->setFaceDetect(%d) fail", __func__, FACE_DETECTION_OFF);
+                    ret = UNKNOWN_ERROR;
+                    failed.add(CameraParameters::KEY_FOCUS_MODE);
+                }
+
+                if (mSecCamera->setFocusMode(focus->value) < 0) {
+                    ALOGE("%s::mSecCamera->setFocusMode(%d) fail", __func__, focus->value);
+                    ret = UNKNOWN_ERROR;
+                    failed.add(CameraParameters::KEY_FOCUS_MODE);
+                } else {
+                    mParameters.set(CameraParameters::KEY_FOCUS_MODE, new_focus_mode_str);
+                }
             }
             else if (!strcmp(new_focus_mode_str, FOCUS_MODE_FACEDETECT)) {
                 // Enable face detect here, SecCamera will take care of the rest
                 if (mSecCamera->setFaceDetect(FACE_DETECTION_ON) < 0) {
                     ALOGE("%s::mSecCamera->setFaceDetect(%d) fail", __func__, FACE_DETECTION_ON);
                     ret = UNKNOWN_ERROR;
+                    failed.add(CameraParameters::KEY_FOCUS_MODE);
                 }
                 mParameters.set(CameraParameters::KEY_FOCUS_MODE, new_focus_mode_str);
                 mParameters.set(CameraParameters::KEY_FOCUS_DISTANCES,
@@ -1782,48 +2870,25 @@ status_t CameraHardwareSec::setParameters(const CameraParameters& params)
             else {
                 ALOGE("%s::unmatched focus_mode(%s)", __func__, new_focus_mode_str);
                 ret = UNKNOWN_ERROR;
-            }
-
-            if (0 <= new_focus_mode) {
-                // Disable face-detect
-                if (mSecCamera->setFaceDetect(FACE_DETECTION_OFF) < 0) {
-                    ALOGE("%s::mSecCamera->setFaceDetect(%d) fail", __func__, FACE_DETECTION_OFF);
-                    ret = UNKNOWN_ERROR;
-                }
-
-                if (mSecCamera->setFocusMode(new_focus_mode) < 0) {
-                    ALOGE("%s::mSecCamera->setFocusMode(%d) fail", __func__, new_focus_mode);
-                    ret = UNKNOWN_ERROR;
-                } else {
-                    mParameters.set(CameraParameters::KEY_FOCUS_MODE, new_focus_mode_str);
-                }
+                failed.add(CameraParameters::KEY_FOCUS_MODE);
             }
         }
 
 #ifdef HAVE_FLASH
         // flash..
-        if (new_flash_mode_str != NULL) {
-            int  new_flash_mode = -1;
-
-            if (!strcmp(new_flash_mode_str, CameraParameters::FLASH_MODE_OFF))
-                new_flash_mode = FLASH_MODE_OFF;
-            else if (!strcmp(new_flash_mode_str, CameraParameters::FLASH_MODE_AUTO))
-                new_flash_mode = FLASH_MODE_AUTO;
-            else if (!strcmp(new_flash_mode_str, CameraParameters::FLASH_MODE_ON))
-                new_flash_mode = FLASH_MODE_ON;
-            else if (!strcmp(new_flash_mode_str, CameraParameters::FLASH_MODE_TORCH))
-                new_flash_mode = FLASH_MODE_TORCH;
-            else {
+        if (new_flash_mode_str != NULL && flash_changed) {
+            const ParamMap *flash = FIND_PARAM(kFlashModes, new_flash_mode_str);
+
+            if (flash == NULL) {
                 ALOGE("%s::unmatched flash_mode(%s)", __func__, new_flash_mode_str); //red-eye
                 ret = UNKNOWN_ERROR;
-            }
-            if (0 <= new_flash_mode) {
-                if (mSecCamera->setFlashMode(new_flash_mode) < 0) {
-                    ALOGE("%s::mSecCamera->setFlashMode(%d) fail", __func__, new_flash_mode);
-                    ret = UNKNOWN_ERROR;
-                } else {
-                    mParameters.set(CameraParameters::KEY_FLASH_MODE, new_flash_mode_str);
-                }
+                failed.add(CameraParameters::KEY_FLASH_MODE);
+            } else if (mSecCamera->setFlashMode(flash->value) < 0) {
+                ALOGE("%s::mSecCamera->setFlashMode(%d) fail", __func__, flash->value);
+                ret = UNKNOWN_ERROR;
+                failed.add(CameraParameters::KEY_FLASH_MODE);
+            } else {
+                mParameters.set(CameraParameters::KEY_FLASH_MODE, new_flash_mode_str);
             }
         }
 #endif
@@ -1833,14 +2898,16 @@ status_t CameraHardwareSec::setParameters(const CameraParameters& params)
             if (mSecCamera->setSceneMode(new_scene_mode) < 0) {
                 ALOGE("%s::mSecCamera->setSceneMode(%d) fail", __func__, new_scene_mode);
                 ret = UNKNOWN_ERROR;
+                failed.add(CameraParameters::KEY_SCENE_MODE);
             } else {
                 mParameters.set(CameraParameters::KEY_SCENE_MODE, new_scene_mode_str);
             }
         }
 
-        // touch to focus
+        // touch to focus.  autoFocus() forgets the applied area, so the
+        // same area sent again before the next focus still triggers it.
         const char *new_focus_area = params.get(CameraParameters::KEY_FOCUS_AREAS);
-        if (new_focus_area != NULL) {
+        if (new_focus_area != NULL && paramChanged(params, CameraParameters::KEY_FOCUS_AREAS)) {
             ALOGV("focus area: %s", new_focus_area);
             SecCameraArea area(new_focus_area);
 
@@ -1855,6 +2922,7 @@ status_t CameraHardwareSec::setParameters(const CameraParameters& params)
                 if (mSecCamera->setObjectPosition(x, y) < 0) {
                     ALOGE("ERR(%s):Fail on mSecCamera->setObjectPosition(%s)", __func__, new_focus_area);
                     ret = UNKNOWN_ERROR;
+                    failed.add(CameraParameters::KEY_FOCUS_AREAS);
                 }
             }
 
@@ -1862,27 +2930,32 @@ status_t CameraHardwareSec::setParameters(const CameraParameters& params)
             if (mSecCamera->setTouchAFStartStop(val) < 0) {
                 ALOGE("ERR(%s):Fail on mSecCamera->setTouchAFStartStop(%d)", __func__, val);
                 ret = UNKNOWN_ERROR;
+                failed.add(CameraParameters::KEY_FOCUS_AREAS);
             }
         }
 
         // zoom
-        int new_zoom = params.getInt(CameraParameters::KEY_ZOOM);
-        int max_zoom = params.getInt(CameraParameters::KEY_MAX_ZOOM);
-        ALOGV("%s : new_zoom %d", __func__, new_zoom);
-        if (0 <= new_zoom && new_zoom <= max_zoom) {
-            ALOGV("%s : set zoom:%d\n", __func__, new_zoom);
-            if (mSecCamera->setZoom(new_zoom) < 0) {
-                ALOGE("ERR(%s):Fail on mSecCamera->setZoom(%d)", __func__, new_zoom);
-                ret = UNKNOWN_ERROR;
-            } else {
-                mParameters.set(CameraParameters::KEY_ZOOM, new_zoom);
+        if (paramChanged(params, CameraParameters::KEY_ZOOM)) {
+            int new_zoom = params.getInt(CameraParameters::KEY_ZOOM);
+            int max_zoom = params.getInt(CameraParameters::KEY_MAX_ZOOM);
+            ALOGV("%s : new_zoom %d", __func__, new_zoom);
+            if (0 <= new_zoom && new_zoom <= max_zoom) {
+                ALOGV("%s : set zoom:%d\n", __func__, new_zoom);
+                if (mSecCamera->setZoom(new_zoom) < 0) {
+                    ALOGE("ERR(%s):Fail on mSecCamera->setZoom(%d)", __func__, new_zoom);
+                    ret = UNKNOWN_ERROR;
+                    failed.add(CameraParameters::KEY_ZOOM);
+                } else {
+                    mParameters.set(CameraParameters::KEY_ZOOM, new_zoom);
+                }
             }
         }
-    } else {
+    } else if (paramChanged(params, CameraParameters::KEY_FOCUS_MODE)) {
         if (!isSupportedParameter(new_focus_mode_str,
                     mParameters.get(CameraParameters::KEY_SUPPORTED_FOCUS_MODES))) {
             ALOGE("%s: Unsupported focus mode: %s", __func__, new_focus_mode_str);
             ret = UNKNOWN_ERROR;
+            failed.add(CameraParameters::KEY_FOCUS_MODE);
         }
     }
 
@@ -1890,263 +2963,303 @@ status_t CameraHardwareSec::setParameters(const CameraParameters& params)
 
     // image effect
     const char *new_image_effect_str = params.get(CameraParameters::KEY_EFFECT);
-    if (new_image_effect_str != NULL) {
-
-        int  new_image_effect = -1;
-
-        if (!strcmp(new_image_effect_str, CameraParameters::EFFECT_NONE))
-            new_image_effect = IMAGE_EFFECT_NONE;
-        else if (!strcmp(new_image_effect_str, CameraParameters::EFFECT_MONO))
-            new_image_effect = IMAGE_EFFECT_BNW;
-        else if (!strcmp(new_image_effect_str, CameraParameters::EFFECT_SEPIA))
-            new_image_effect = IMAGE_EFFECT_SEPIA;
-        else if (!strcmp(new_image_effect_str, CameraParameters::EFFECT_AQUA))
-            new_image_effect = IMAGE_EFFECT_AQUA;
-        else if (!strcmp(new_image_effect_str, CameraParameters::EFFECT_NEGATIVE))
-            new_image_effect = IMAGE_EFFECT_NEGATIVE;
-        else {
+    if (new_image_effect_str != NULL && paramChanged(params, CameraParameters::KEY_EFFECT)) {
+        const ParamMap *effect = FIND_PARAM(kImageEffects, new_image_effect_str);
+
+        if (effect == NULL) {
             //posterize, whiteboard, blackboard, solarize
             ALOGE("ERR(%s):Invalid effect(%s)", __func__, new_image_effect_str);
             ret = UNKNOWN_ERROR;
-        }
-
-        if (new_image_effect >= 0) {
-            if (mSecCamera->setImageEffect(new_image_effect) < 0) {
-                ALOGE("ERR(%s):Fail on mSecCamera->setImageEffect(effect(%d))", __func__, new_image_effect);
-                ret = UNKNOWN_ERROR;
-            } else {
-                const char *old_image_effect_str = mParameters.get(CameraParameters::KEY_EFFECT);
+            failed.add(CameraParameters::KEY_EFFECT);
+        } else if (mSecCamera->setImageEffect(effect->value) < 0) {
+            ALOGE("ERR(%s):Fail on mSecCamera->setImageEffect(effect(%d))", __func__, effect->value);
+            ret = UNKNOWN_ERROR;
+            failed.add(CameraParameters::KEY_EFFECT);
+        } else {
+            const char *old_image_effect_str = mParameters.get(CameraParameters::KEY_EFFECT);
 
-                if (old_image_effect_str) {
-                    if (strcmp(old_image_effect_str, new_image_effect_str)) {
-                        setSkipFrame(EFFECT_SKIP_FRAME);
-                    }
+            if (old_image_effect_str) {
+                if (strcmp(old_image_effect_str, new_image_effect_str)) {
+                    setSkipFrame(EFFECT_SKIP_FRAME);
                 }
-
-                mParameters.set(CameraParameters::KEY_EFFECT, new_image_effect_str);
             }
+
+            mParameters.set(CameraParameters::KEY_EFFECT, new_image_effect_str);
         }
     }
 
-    //vt mode
-    int new_vtmode = mInternalParameters.getInt("vtmode");
-    if (0 <= new_vtmode) {
-        if (mSecCamera->setVTmode(new_vtmode) < 0) {
-            ALOGE("ERR(%s):Fail on mSecCamera->setVTMode(%d)", __func__, new_vtmode);
-            ret = UNKNOWN_ERROR;
+    if (full_apply) {
+        //vt mode
+        int new_vtmode = mInternalParameters.getInt("vtmode");
+        if (0 <= new_vtmode) {
+            if (mSecCamera->setVTmode(new_vtmode) < 0) {
+                ALOGE("ERR(%s):Fail on mSecCamera->setVTMode(%d)", __func__, new_vtmode);
+                ret = UNKNOWN_ERROR;
+                internal_failed = true;
+            }
         }
-    }
 
-    //contrast
-    int new_contrast = mInternalParameters.getInt("contrast");
+        //contrast
+        int new_contrast = mInternalParameters.getInt("contrast");
 
-    if (0 <= new_contrast) {
-        if (mSecCamera->setContrast(new_contrast) < 0) {
-            ALOGE("ERR(%s):Fail on mSecCamera->setContrast(%d)", __func__, new_contrast);
-            ret = UNKNOWN_ERROR;
+        if (0 <= new_contrast) {
+            if (mSecCamera->setContrast(new_contrast) < 0) {
+                ALOGE("ERR(%s):Fail on mSecCamera->setContrast(%d)", __func__, new_contrast);
+                ret = UNKNOWN_ERROR;
+                internal_failed = true;
+            }
         }
-    }
 
-    //WDR
-    int new_wdr = mInternalParameters.getInt("wdr");
+        //WDR
+        int new_wdr = mInternalParameters.getInt("wdr");
 
-    if (0 <= new_wdr) {
-        if (mSecCamera->setWDR(new_wdr) < 0) {
-            ALOGE("ERR(%s):Fail on mSecCamera->setWDR(%d)", __func__, new_wdr);
-            ret = UNKNOWN_ERROR;
+        if (0 <= new_wdr) {
+            if (mSecCamera->setWDR(new_wdr) < 0) {
+                ALOGE("ERR(%s):Fail on mSecCamera->setWDR(%d)", __func__, new_wdr);
+                ret = UNKNOWN_ERROR;
+                internal_failed = true;
+            }
         }
-    }
 
-    //anti shake
-    int new_anti_shake = mInternalParameters.getInt("anti-shake");
+        //anti shake
+        int new_anti_shake = mInternalParameters.getInt("anti-shake");
 
-    if (0 <= new_anti_shake) {
-        if (mSecCamera->setAntiShake(new_anti_shake) < 0) {
-            ALOGE("ERR(%s):Fail on mSecCamera->setWDR(%d)", __func__, new_anti_shake);
-            ret = UNKNOWN_ERROR;
+        if (0 <= new_anti_shake) {
+            if (mSecCamera->setAntiShake(new_anti_shake) < 0) {
+                ALOGE("ERR(%s):Fail on mSecCamera->setWDR(%d)", __func__, new_anti_shake);
+                ret = UNKNOWN_ERROR;
+                internal_failed = true;
+            }
         }
     }
 
     // gps latitude
-    const char *new_gps_latitude_str = params.get(CameraParameters::KEY_GPS_LATITUDE);
-    if (mSecCamera->setGPSLatitude(new_gps_latitude_str) < 0) {
-        ALOGE("%s::mSecCamera->setGPSLatitude(%s) fail", __func__, new_gps_latitude_str);
-        ret = UNKNOWN_ERROR;
-    } else {
-        if (new_gps_latitude_str) {
-            mParameters.set(CameraParameters::KEY_GPS_LATITUDE, new_gps_latitude_str);
+    if (paramChanged(params, CameraParameters::KEY_GPS_LATITUDE)) {
+        const char *new_gps_latitude_str = params.get(CameraParameters::KEY_GPS_LATITUDE);
+        if (mSecCamera->setGPSLatitude(new_gps_latitude_str) < 0) {
+            ALOGE("%s::mSecCamera->setGPSLatitude(%s) fail", __func__, new_gps_latitude_str);
+            ret = UNKNOWN_ERROR;
+            failed.add(CameraParameters::KEY_GPS_LATITUDE);
         } else {
-            mParameters.remove(CameraParameters::KEY_GPS_LATITUDE);
+            if (new_gps_latitude_str) {
+                mParameters.set(CameraParameters::KEY_GPS_LATITUDE, new_gps_latitude_str);
+            } else {
+                mParameters.remove(CameraParameters::KEY_GPS_LATITUDE);
+            }
         }
     }
 
     // gps longitude
-    const char *new_gps_longitude_str = params.get(CameraParameters::KEY_GPS_LONGITUDE);
+    if (paramChanged(params, CameraParameters::KEY_GPS_LONGITUDE)) {
+        const char *new_gps_longitude_str = params.get(CameraParameters::KEY_GPS_LONGITUDE);
 
-    if (mSecCamera->setGPSLongitude(new_gps_longitude_str) < 0) {
-        ALOGE("%s::mSecCamera->setGPSLongitude(%s) fail", __func__, new_gps_longitude_str);
-        ret = UNKNOWN_ERROR;
-    } else {
-        if (new_gps_longitude_str) {
-            mParameters.set(CameraParameters::KEY_GPS_LONGITUDE, new_gps_longitude_str);
+        if (mSecCamera->setGPSLongitude(new_gps_longitude_str) < 0) {
+            ALOGE("%s::mSecCamera->setGPSLongitude(%s) fail", __func__, new_gps_longitude_str);
+            ret = UNKNOWN_ERROR;
+            failed.add(CameraParameters::KEY_GPS_LONGITUDE);
         } else {
-            mParameters.remove(CameraParameters::KEY_GPS_LONGITUDE);
+            if (new_gps_longitude_str) {
+                mParameters.set(CameraParameters::KEY_GPS_LONGITUDE, new_gps_longitude_str);
+            } else {
+                mParameters.remove(CameraParameters::KEY_GPS_LONGITUDE);
+            }
         }
     }
 
     // gps altitude
-    const char *new_gps_altitude_str = params.get(CameraParameters::KEY_GPS_ALTITUDE);
+    if (paramChanged(params, CameraParameters::KEY_GPS_ALTITUDE)) {
+        const char *new_gps_altitude_str = params.get(CameraParameters::KEY_GPS_ALTITUDE);
 
-    if (mSecCamera->setGPSAltitude(new_gps_altitude_str) < 0) {
-        ALOGE("%s::mSecCamera->setGPSAltitude(%s) fail", __func__, new_gps_altitude_str);
-        ret = UNKNOWN_ERROR;
-    } else {
-        if (new_gps_altitude_str) {
-            mParameters.set(CameraParameters::KEY_GPS_ALTITUDE, new_gps_altitude_str);
+        if (mSecCamera->setGPSAltitude(new_gps_altitude_str) < 0) {
+            ALOGE("%s::mSecCamera->setGPSAltitude(%s) fail", __func__, new_gps_altitude_str);
+            ret = UNKNOWN_ERROR;
+            failed.add(CameraParameters::KEY_GPS_ALTITUDE);
         } else {
-            mParameters.remove(CameraParameters::KEY_GPS_ALTITUDE);
+            if (new_gps_altitude_str) {
+                mParameters.set(CameraParameters::KEY_GPS_ALTITUDE, new_gps_altitude_str);
+            } else {
+                mParameters.remove(CameraParameters::KEY_GPS_ALTITUDE);
+            }
         }
     }
 
     // gps timestamp
-    const char *new_gps_timestamp_str = params.get(CameraParameters::KEY_GPS_TIMESTAMP);
+    if (paramChanged(params, CameraParameters::KEY_GPS_TIMESTAMP)) {
+        const char *new_gps_timestamp_str = params.get(CameraParameters::KEY_GPS_TIMESTAMP);
 
-    if (mSecCamera->setGPSTimeStamp(new_gps_timestamp_str) < 0) {
-        ALOGE("%s::mSecCamera->setGPSTimeStamp(%s) fail", __func__, new_gps_timestamp_str);
-        ret = UNKNOWN_ERROR;
-    } else {
-        if (new_gps_timestamp_str) {
-            mParameters.set(CameraParameters::KEY_GPS_TIMESTAMP, new_gps_timestamp_str);
+        if (mSecCamera->setGPSTimeStamp(new_gps_timestamp_str) < 0) {
+            ALOGE("%s::mSecCamera->setGPSTimeStamp(%s) fail", __func__, new_gps_timestamp_str);
+            ret = UNKNOWN_ERROR;
+            failed.add(CameraParameters::KEY_GPS_TIMESTAMP);
         } else {
-            mParameters.remove(CameraParameters::KEY_GPS_TIMESTAMP);
+            if (new_gps_timestamp_str) {
+                mParameters.set(CameraParameters::KEY_GPS_TIMESTAMP, new_gps_timestamp_str);
+            } else {
+                mParameters.remove(CameraParameters::KEY_GPS_TIMESTAMP);
+            }
         }
     }
 
     // gps processing method
-    const char *new_gps_processing_method_str = params.get(CameraParameters::KEY_GPS_PROCESSING_METHOD);
+    if (paramChanged(params, CameraParameters::KEY_GPS_PROCESSING_METHOD)) {
+        const char *new_gps_processing_method_str = params.get(CameraParameters::KEY_GPS_PROCESSING_METHOD);
 
-    if (mSecCamera->setGPSProcessingMethod(new_gps_processing_method_str) < 0) {
-        ALOGE("%s::mSecCamera->setGPSProcessingMethod(%s) fail", __func__, new_gps_processing_method_str);
-        ret = UNKNOWN_ERROR;
-    } else {
-        if (new_gps_processing_method_str) {
-            mParameters.set(CameraParameters::KEY_GPS_PROCESSING_METHOD, new_gps_processing_method_str);
+        if (mSecCamera->setGPSProcessingMethod(new_gps_processing_method_str) < 0) {
+            ALOGE("%s::mSecCamera->setGPSProcessingMethod(%s) fail", __func__, new_gps_processing_method_str);
+            ret = UNKNOWN_ERROR;
+            failed.add(CameraParameters::KEY_GPS_PROCESSING_METHOD);
         } else {
-            mParameters.remove(CameraParameters::KEY_GPS_PROCESSING_METHOD);
+            if (new_gps_processing_method_str) {
+                mParameters.set(CameraParameters::KEY_GPS_PROCESSING_METHOD, new_gps_processing_method_str);
+            } else {
+                mParameters.remove(CameraParameters::KEY_GPS_PROCESSING_METHOD);
+            }
         }
     }
 
     // Recording size
-    int new_recording_width = mInternalParameters.getInt("recording-size-width");
-    int new_recording_height= mInternalParameters.getInt("recording-size-height");
+    if (full_apply || preview_changed) {
+        int new_recording_width = mInternalParameters.getInt("recording-size-width");
+        int new_recording_height= mInternalParameters.getInt("recording-size-height");
 
-    if (0 < new_recording_width && 0 < new_recording_height) {
-        if (mSecCamera->setRecordingSize(new_recording_width, new_recording_height) < 0) {
-            ALOGE("ERR(%s):Fail on mSecCamera->setRecordingSize(width(%d), height(%d))", __func__, new_recording_width, new_recording_height);
-            ret = UNKNOWN_ERROR;
-        }
-    } else {
-        if (mSecCamera->setRecordingSize(new_preview_width, new_preview_height) < 0) {
-            ALOGE("ERR(%s):Fail on mSecCamera->setRecordingSize(width(%d), height(%d))", __func__, new_preview_width, new_preview_height);
-            ret = UNKNOWN_ERROR;
+        if (0 < new_recording_width && 0 < new_recording_height) {
+            if (mSecCamera->setRecordingSize(new_recording_width, new_recording_height) < 0) {
+                ALOGE("ERR(%s):Fail on mSecCamera->setRecordingSize(width(%d), height(%d))", __func__, new_recording_width, new_recording_height);
+                ret = UNKNOWN_ERROR;
+                internal_failed = true;
+            }
+        } else {
+            if (mSecCamera->setRecordingSize(new_preview_width, new_preview_height) < 0) {
+                ALOGE("ERR(%s):Fail on mSecCamera->setRecordingSize(width(%d), height(%d))", __func__, new_preview_width, new_preview_height);
+                ret = UNKNOWN_ERROR;
+                internal_failed = true;
+            }
         }
     }
 
-    //gamma
-    const char *new_gamma_str = mInternalParameters.get("video_recording_gamma");
+    if (full_apply) {
+        //gamma
+        const char *new_gamma_str = mInternalParameters.get("video_recording_gamma");
 
-    if (new_gamma_str != NULL) {
-        int new_gamma = -1;
-        if (!strcmp(new_gamma_str, "off"))
-            new_gamma = GAMMA_OFF;
-        else if (!strcmp(new_gamma_str, "on"))
-            new_gamma = GAMMA_ON;
-        else {
-            ALOGE("%s::unmatched gamma(%s)", __func__, new_gamma_str);
-            ret = UNKNOWN_ERROR;
-        }
-
-        if (0 <= new_gamma) {
-            if (mSecCamera->setGamma(new_gamma) < 0) {
-                ALOGE("%s::mSecCamera->setGamma(%d) fail", __func__, new_gamma);
+        if (new_gamma_str != NULL) {
+            int new_gamma = -1;
+            if (!strcmp(new_gamma_str, "off"))
+                new_gamma = GAMMA_OFF;
+            else if (!strcmp(new_gamma_str, "on"))
+                new_gamma = GAMMA_ON;
+            else {
+                ALOGE("%s::unmatched gamma(%s)", __func__, new_gamma_str);
                 ret = UNKNOWN_ERROR;
+                internal_failed = true;
             }
-        }
-    }
 
-    //slow ae
-    const char *new_slow_ae_str = mInternalParameters.get("slow_ae");
+            if (0 <= new_gamma) {
+                if (mSecCamera->setGamma(new_gamma) < 0) {
+                    ALOGE("%s::mSecCamera->setGamma(%d) fail", __func__, new_gamma);
+                    ret = UNKNOWN_ERROR;
+                    internal_failed = true;
+                }
+            }
+        }
 
-    if (new_slow_ae_str != NULL) {
-        int new_slow_ae = -1;
+        //slow ae
+        const char *new_slow_ae_str = mInternalParameters.get("slow_ae");
 
-        if (!strcmp(new_slow_ae_str, "off"))
-            new_slow_ae = SLOW_AE_OFF;
-        else if (!strcmp(new_slow_ae_str, "on"))
-            new_slow_ae = SLOW_AE_ON;
-        else {
-            ALOGE("%s::unmatched slow_ae(%s)", __func__, new_slow_ae_str);
-            ret = UNKNOWN_ERROR;
-        }
+        if (new_slow_ae_str != NULL) {
+            int new_slow_ae = -1;
 
-        if (0 <= new_slow_ae) {
-            if (mSecCamera->setSlowAE(new_slow_ae) < 0) {
-                ALOGE("%s::mSecCamera->setSlowAE(%d) fail", __func__, new_slow_ae);
+            if (!strcmp(new_slow_ae_str, "off"))
+                new_slow_ae = SLOW_AE_OFF;
+            else if (!strcmp(new_slow_ae_str, "on"))
+                new_slow_ae = SLOW_AE_ON;
+            else {
+                ALOGE("%s::unmatched slow_ae(%s)", __func__, new_slow_ae_str);
                 ret = UNKNOWN_ERROR;
+                internal_failed = true;
+            }
+
+            if (0 <= new_slow_ae) {
+                if (mSecCamera->setSlowAE(new_slow_ae) < 0) {
+                    ALOGE("%s::mSecCamera->setSlowAE(%d) fail", __func__, new_slow_ae);
+                    ret = UNKNOWN_ERROR;
+                    internal_failed = true;
+                }
             }
         }
-    }
 
-    /*Camcorder fix fps*/
-    int new_sensor_mode = mInternalParameters.getInt("cam_mode");
+        /*Camcorder fix fps*/
+        int new_sensor_mode = mInternalParameters.getInt("cam_mode");
 
-    if (0 <= new_sensor_mode) {
-        if (mSecCamera->setSensorMode(new_sensor_mode) < 0) {
-            ALOGE("ERR(%s):Fail on mSecCamera->setSensorMode(%d)", __func__, new_sensor_mode);
-            ret = UNKNOWN_ERROR;
+        if (0 <= new_sensor_mode) {
+            if (mSecCamera->setSensorMode(new_sensor_mode) < 0) {
+                ALOGE("ERR(%s):Fail on mSecCamera->setSensorMode(%d)", __func__, new_sensor_mode);
+                ret = UNKNOWN_ERROR;
+                internal_failed = true;
+            }
+        } else {
+            new_sensor_mode=0;
         }
-    } else {
-        new_sensor_mode=0;
-    }
 
-    /*Shot mode*/
-    int new_shot_mode = mInternalParameters.getInt("shot_mode");
+        /*Shot mode*/
+        int new_shot_mode = mInternalParameters.getInt("shot_mode");
 
-    if (0 <= new_shot_mode) {
-        if (mSecCamera->setShotMode(new_shot_mode) < 0) {
-            ALOGE("ERR(%s):Fail on mSecCamera->setShotMode(%d)", __func__, new_shot_mode);
-            ret = UNKNOWN_ERROR;
+        if (0 <= new_shot_mode) {
+            if (mSecCamera->setShotMode(new_shot_mode) < 0) {
+                ALOGE("ERR(%s):Fail on mSecCamera->setShotMode(%d)", __func__, new_shot_mode);
+                ret = UNKNOWN_ERROR;
+                internal_failed = true;
+            }
+        } else {
+            new_shot_mode=0;
         }
-    } else {
-        new_shot_mode=0;
-    }
 
-    //blur for Video call
-    int new_blur_level = mInternalParameters.getInt("blur");
+        //blur for Video call
+        int new_blur_level = mInternalParameters.getInt("blur");
 
-    if (0 <= new_blur_level) {
-        if (mSecCamera->setBlur(new_blur_level) < 0) {
-            ALOGE("ERR(%s):Fail on mSecCamera->setBlur(%d)", __func__, new_blur_level);
-            ret = UNKNOWN_ERROR;
+        if (0 <= new_blur_level) {
+            if (mSecCamera->setBlur(new_blur_level) < 0) {
+                ALOGE("ERR(%s):Fail on mSecCamera->setBlur(%d)", __func__, new_blur_level);
+                ret = UNKNOWN_ERROR;
+            }
         }
-    }
 
 
-    // chk_dataline
-    int new_dataline = mInternalParameters.getInt("chk_dataline");
+        // chk_dataline
+        int new_dataline = mInternalParameters.getInt("chk_dataline");
 
-    if (0 <= new_dataline) {
-        if (mSecCamera->setDataLineCheck(new_dataline) < 0) {
-            ALOGE("ERR(%s):Fail on mSecCamera->setDataLineCheck(%d)", __func__, new_dataline);
-            ret = UNKNOWN_ERROR;
+        if (0 <= new_dataline) {
+            if (mSecCamera->setDataLineCheck(new_dataline) < 0) {
+                ALOGE("ERR(%s):Fail on mSecCamera->setDataLineCheck(%d)", __func__, new_dataline);
+                ret = UNKNOWN_ERROR;
+            }
         }
     }
 
-    if (mSecCamera->setBatchReflection()) {
+    bool reflect = full_apply;
+    for (size_t i = 0; !reflect && i < NUM_REFLECTED_KEYS; i++)
+        reflect = paramChanged(params, kReflectedKeys[i]);
+
+    if (reflect && mSecCamera->setBatchReflection()) {
         ALOGE("ERR(%s):Fail on mSecCamera->setBatchReflection()", __func__);
         ret = UNKNOWN_ERROR;
+        internal_failed = full_apply;
+        for (size_t i = 0; i < NUM_REFLECTED_KEYS; i++)
+            failed.add(kReflectedKeys[i]);
     }
 
+    /* keys that failed are left out of the applied set, so the next
+     * call tries them again and still skips the ones that went through
+     */
+    mAppliedParameters = params;
+    for (size_t i = 0; i < failed.size(); i++)
+        mAppliedParameters.remove(failed[i]);
+    if (failed.isEmpty())
+        mAppliedFlat = new_flat;
+    else
+        mAppliedFlat.setTo("");
+    mParametersApplied = true;
+    mInternalApplied = !internal_failed;
+
     ALOGV("%s return ret = %d", __func__, ret);
 
     return ret;
@@ -2189,6 +3302,19 @@ void CameraHardwareSec::release()
         mPreviewThread->requestExitAndWait();
         mPreviewThread.clear();
     }
+    /* the preview thread flushed both queues on its way out */
+    if (mPreviewDisplayThread != NULL) {
+        mPreviewDisplayThread->requestExit();
+        exitPreviewFrames(&mDisplayQueue);
+        mPreviewDisplayThread->requestExitAndWait();
+        mPreviewDisplayThread.clear();
+    }
+    if (mPreviewCallbackThread != NULL) {
+        mPreviewCallbackThread->requestExit();
+        exitPreviewFrames(&mCallbackQueue);
+        mPreviewCallbackThread->requestExitAndWait();
+        mPreviewCallbackThread.clear();
+    }
     if (mAutoFocusThread != NULL) {
         /* this thread is normally already in it's threadLoop but blocked
          * on the condition variable.  signal it so it wakes up and can exit.
@@ -2205,15 +3331,38 @@ void CameraHardwareSec::release()
         mPictureThread->requestExitAndWait();
         mPictureThread.clear();
     }
+    if (mBurstEncodeThread != NULL) {
+        mBurstEncodeThread->requestExitAndWait();
+        mBurstEncodeThread.clear();
+    }
 
     if (mRawHeap) {
         mRawHeap->release(mRawHeap);
         mRawHeap = 0;
     }
+    releaseCaptureBuffers();
     if (mPreviewHeap) {
         mPreviewHeap->release(mPreviewHeap);
         mPreviewHeap = 0;
     }
+    if (mPreviewCallbackHeap) {
+        mPreviewCallbackHeap->release(mPreviewCallbackHeap);
+        mPreviewCallbackHeap = 0;
+    }
+    if (mCallbackPool) {
+        mCallbackPool->release(mCallbackPool);
+        mCallbackPool = NULL;
+        mCallbackPoolSize = 0;
+    }
+    if (mZslHeap) {
+        mZslHeap->release(mZslHeap);
+        mZslHeap = 0;
+        mZslHeapDepth = 0;
+    }
+    if (mYuyvHeap) {
+        mYuyvHeap->release(mYuyvHeap);
+        mYuyvHeap = 0;
+    }
     if (mRecordHeap) {
         mRecordHeap->release(mRecordHeap);
         mRecordHeap = 0;
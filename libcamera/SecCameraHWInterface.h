@@ -20,6 +20,7 @@
 #define ANDROID_HARDWARE_CAMERA_HARDWARE_SEC_H
 
 #include "SecCamera.h"
+#include "SecCameraImage.h"
 #include <utils/threads.h>
 #include <utils/RefBase.h>
 #include <binder/MemoryBase.h>
@@ -88,6 +89,34 @@ private:
         }
     };
 
+    class PreviewDisplayThread : public Thread {
+        CameraHardwareSec *mHardware;
+    public:
+        PreviewDisplayThread(CameraHardwareSec *hw):
+        Thread(false),
+        mHardware(hw) { }
+        virtual void onFirstRef() {
+            run("CameraPreviewDisplayThread", PRIORITY_URGENT_DISPLAY);
+        }
+        virtual bool threadLoop() {
+            return mHardware->previewDisplayThread();
+        }
+    };
+
+    class PreviewCallbackThread : public Thread {
+        CameraHardwareSec *mHardware;
+    public:
+        PreviewCallbackThread(CameraHardwareSec *hw):
+        Thread(false),
+        mHardware(hw) { }
+        virtual void onFirstRef() {
+            run("CameraPreviewCallbackThread", PRIORITY_DEFAULT);
+        }
+        virtual bool threadLoop() {
+            return mHardware->previewCallbackThread();
+        }
+    };
+
     class PictureThread : public Thread {
         CameraHardwareSec *mHardware;
     public:
@@ -100,6 +129,18 @@ private:
         }
     };
 
+    class BurstEncodeThread : public Thread {
+        CameraHardwareSec *mHardware;
+    public:
+        BurstEncodeThread(CameraHardwareSec *hw):
+        Thread(false),
+        mHardware(hw) { }
+        virtual bool threadLoop() {
+            mHardware->burstEncodeThread();
+            return false;
+        }
+    };
+
     class AutoFocusThread : public Thread {
         CameraHardwareSec *mHardware;
     public:
@@ -114,12 +155,74 @@ private:
     };
 
             void        initDefaultParameters(int cameraId);
+            void        buildDefaultParameters(int cameraId, CameraParameters &p,
+                                               CameraParameters &ip);
             void        initHeapLocked();
 
     sp<PreviewThread>   mPreviewThread;
             int         previewThread();
             int         previewThreadWrapper();
 
+    /* the preview thread only dequeues; display and client callbacks
+     * each run on their own thread behind a short queue, so a slow
+     * consumer loses its own frames instead of stalling the sensor.
+     * every queued frame holds a reference on its FIMC buffer.
+     */
+    struct PreviewFrame {
+        int             index;
+        int             slot;       /* callback pool buffer, or -1 */
+        nsecs_t         timestamp;
+    };
+
+    static  const int   kFrameQueueDepth = 2;
+
+    struct FrameQueue {
+        Mutex           lock;
+        Condition       cond;
+        PreviewFrame    frames[kFrameQueueDepth];
+        int             head;
+        int             count;
+        bool            busy;       /* consumer is working on a frame */
+        bool            exit;
+        int             drops;
+    };
+
+            void        initFrameQueue(FrameQueue *q);
+            void        pushPreviewFrame(FrameQueue *q, int index, int slot,
+                                         nsecs_t timestamp);
+            void        releaseQueuedFrame(const PreviewFrame *frame);
+            bool        popPreviewFrame(FrameQueue *q, PreviewFrame *frame);
+            void        flushPreviewFrames(FrameQueue *q);
+            void        exitPreviewFrames(FrameQueue *q);
+
+    sp<PreviewDisplayThread> mPreviewDisplayThread;
+            bool        previewDisplayThread();
+            FrameQueue  mDisplayQueue;
+
+    sp<PreviewCallbackThread> mPreviewCallbackThread;
+            bool        previewCallbackThread();
+            FrameQueue  mCallbackQueue;
+
+    /* callback buffer mode: frames are converted straight into a few
+     * buffers of their own and the FIMC buffer goes back at once.
+     * with every buffer taken the frame is not converted at all.
+     */
+    static  const int   kMaxCallbackBuffers = kFrameQueueDepth + 1;
+
+            void        queueCallbackBuffer(int index, nsecs_t timestamp);
+    mutable Mutex       mCallbackPoolLock;
+    camera_memory_t     *mCallbackPool;
+            int         mCallbackPoolSize;
+            bool        mCallbackPoolBusy[kMaxCallbackBuffers];
+            int         mCallbackBufferCount;
+    volatile int32_t    mCallbacksDropped;
+
+    /* FIMC buffers per stream, 0 sizes them from the consumers */
+            int         previewBuffersWanted();
+            bool        hasPreviewWindow() const;
+            int         mPreviewBufferCount;
+            int         mRecordBufferCount;
+
     sp<AutoFocusThread> mAutoFocusThread;
             int         autoFocusThread();
 
@@ -127,6 +230,82 @@ private:
             int         pictureThread();
             bool        mCaptureInProgress;
 
+            int         deliverJpeg(unsigned char *yuv_data, int width, int height);
+
+    /* YUY2 staging for stills that do not come from the capture
+     * stream (zsl ring, video snapshot)
+     */
+            unsigned char *getYuyvBuffer(int width, int height);
+    camera_memory_t     *mYuyvHeap;
+
+    /* stills during recording are taken from the record stream */
+            int         videoSnapshot();
+            bool        mVideoSnapshot;
+            bool        mVideoSnapshotPending;
+            int         mVideoSnapshotIndex;
+            int         mLastRecordIndex;
+    mutable Condition   mVideoSnapshotCondition;
+            int         mVideoSnapshots;
+
+    /* zero shutter lag: the last mZslDepth preview frames, so a shot
+     * can be encoded from the frame that was on screen at takePicture()
+     * without switching the sensor to capture mode.  frames are copied
+     * and converted outside mZslLock; a slot is only valid once its
+     * copy is complete.
+     */
+    struct ZslFrame {
+        nsecs_t         timestamp;
+        int             width;
+        int             height;
+        bool            valid;
+    };
+
+    static  const int   kMaxZslDepth = 8;
+
+            void        pushZslFrame(const char *frame, int width, int height,
+                                     int frame_size, nsecs_t timestamp);
+            int         zslCapture();
+            void        resetZslLocked();
+    mutable Mutex       mZslLock;
+    camera_memory_t     *mZslHeap;
+            ZslFrame    mZslFrames[kMaxZslDepth];
+            int         mZslDepth;
+            int         mZslFrameSize;
+            int         mZslHeapDepth;
+            int         mZslHead;
+            int         mZslCount;
+            int         mZslReading;
+            bool        mZslShot;
+            nsecs_t     mZslShutterTime;
+            int         mZslShots;
+            int         mZslLagUs;
+
+    /* burst capture: pictureThread() dequeues frames into mBurstQueue,
+     * the encoder thread turns them into JPEGs and hands them back
+     */
+    struct BurstFrame {
+        int             index;
+        unsigned char   *data;
+    };
+
+    static  const int   kBurstBuffers = 4;
+    static  const int   kMaxBurstCount = 20;
+
+    sp<BurstEncodeThread> mBurstEncodeThread;
+            int         burstCapture(int count);
+            int         burstEncodeThread();
+    mutable Mutex       mBurstLock;
+    mutable Condition   mBurstCondition;
+            BurstFrame  mBurstQueue[MAX_BUFFERS];
+            int         mBurstHead;
+            int         mBurstTail;
+            bool        mBurstDone;
+    volatile bool       mBurstCancel;
+            int32_t     mBurstMsgs;
+            int         mBurstCount;
+            int         mBurstDelivered;
+            int         mBurstShotsPerSec100;
+
             int         save_jpeg(unsigned char *real_jpeg, int jpeg_size);
             void        save_postview(const char *fname, uint8_t *buf,
                                         uint32_t size);
@@ -137,7 +316,8 @@ private:
                                                 int *pJpegSize,
                                                 void *pJpegData,
                                                 void *pYuvData);
-            bool        YUY2toNV21(void *srcBuf, void *dstBuf, uint32_t srcWidth, uint32_t srcHeight);
+            int         initCaptureBuffers(void);
+            void        releaseCaptureBuffers(void);
             bool        scaleDownYuv422(char *srcBuf, uint32_t srcWidth,
                                         uint32_t srcHight, char *dstBuf,
                                         uint32_t dstWidth, uint32_t dstHight);
@@ -156,6 +336,8 @@ private:
                                                const int height) const;
             bool        isSupportedParameter(const char * const parm,
                             const char * const supported_parm) const;
+            bool        paramChanged(const CameraParameters& params,
+                                     const char *key) const;
             status_t    waitCaptureCompletion();
     /* used by auto focus thread to block until it's told to run */
     mutable Mutex       mFocusLock;
@@ -171,6 +353,10 @@ private:
             bool        mExitPreviewThread;
 
             preview_stream_ops *mPreviewWindow;
+    /* guards mPreviewWindow, which the display worker draws into
+     * without holding mPreviewLock
+     */
+    mutable Mutex       mPreviewWindowLock;
 
     /* used to guard mCaptureInProgress */
     mutable Mutex       mCaptureLock;
@@ -178,11 +364,32 @@ private:
 
     CameraParameters    mParameters;
     CameraParameters    mInternalParameters;
+    /* the last parameters a client set, less the keys that failed;
+     * setParameters only applies the keys that differ from them.
+     * mInternalApplied is false until mInternalParameters went through
+     */
+    CameraParameters    mAppliedParameters;
+    String8             mAppliedFlat;
+            bool        mParametersApplied;
+            bool        mInternalApplied;
+            int         mParamCalls;
+            int         mParamUnchanged;
 
     camera_memory_t     *mPreviewHeap;
+    camera_memory_t     *mPreviewCallbackHeap;
     camera_memory_t     *mRawHeap;
     camera_memory_t     *mRecordHeap;
 
+    /* capture scratch, sized for the camera's thumbnail and EXIF and
+     * reused across shots
+     */
+            int         mCaptureThumbBytes;
+            int         mCaptureExifBytes;
+    camera_memory_t     *mThumbnailHeap;
+    camera_memory_t     *mExifHeap;
+            int         mCaptureAllocs;
+            int         mCaptureReuses;
+
     SecCamera           *mSecCamera;
             const __u8  *mCameraSensorName;
 
@@ -207,6 +414,21 @@ private:
 
     camera_device_t *mHalDevice;
     static gralloc_module_t const* mGrallocHal;
+
+    /* preview and capture timings, see dump() */
+    SecCameraHistogram  mFrameLatency;
+    SecCameraHistogram  mPreviewCopy;
+    SecCameraHistogram  mPreviewCallback;
+    SecCameraHistogram  mCaptureShot;
+    SecCameraHistogram  mCaptureMemcpy;
+    SecCameraHistogram  mCaptureExif;
+    SecCameraHistogram  mCaptureEncode;
+    SecCameraHistogram  mCaptureTotal;
+    SecCameraRate       mPreviewFps;
+    volatile int32_t    mFramesSkipped;
+    volatile int32_t    mFramesDropped;
+            int         mOpenUs;
+            bool        mOpenWarm;
 };
 
 }; // namespace android
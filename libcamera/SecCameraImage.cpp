@@ -0,0 +1,305 @@
+/*
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include "SecCameraImage.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+namespace android {
+
+/* interleave n Cr/Cb pairs, Cr first */
+static void interleaveVu(const uint8_t *u, const uint8_t *v, uint8_t *vu, int n)
+{
+#if defined(__ARM_NEON__)
+    for (; n >= 16; n -= 16) {
+        uint8x16x2_t out;
+        out.val[0] = vld1q_u8(v);
+        out.val[1] = vld1q_u8(u);
+        vst2q_u8(vu, out);
+        u += 16;
+        v += 16;
+        vu += 32;
+    }
+#endif
+    while (n-- > 0) {
+        *vu++ = *v++;
+        *vu++ = *u++;
+    }
+}
+
+void yuv420pToNv21(const uint8_t *src, uint8_t *dst, int width, int height)
+{
+    const int y_size = width * height;
+    const int c_size = y_size >> 2;
+
+    memcpy(dst, src, y_size);
+    interleaveVu(src + y_size, src + y_size + c_size, dst + y_size, c_size);
+}
+
+void yuv420pToYuy2(const uint8_t *src, uint8_t *dst, int width, int height)
+{
+    const uint8_t *y = src;
+    const uint8_t *u = src + width * height;
+    const uint8_t *v = u + (width * height >> 2);
+
+    for (int row = 0; row < height; row++) {
+        const uint8_t *cu = u + (row >> 1) * (width >> 1);
+        const uint8_t *cv = v + (row >> 1) * (width >> 1);
+        int n = width >> 1;
+
+#if defined(__ARM_NEON__)
+        for (; n >= 16; n -= 16) {
+            uint8x16x2_t luma = vld2q_u8(y);
+            uint8x16x4_t out;
+
+            out.val[0] = luma.val[0];
+            out.val[1] = vld1q_u8(cu);
+            out.val[2] = luma.val[1];
+            out.val[3] = vld1q_u8(cv);
+            vst4q_u8(dst, out);
+            y += 32;
+            cu += 16;
+            cv += 16;
+            dst += 64;
+        }
+#endif
+        while (n-- > 0) {
+            *dst++ = *y++;
+            *dst++ = *cu++;
+            *dst++ = *y++;
+            *dst++ = *cv++;
+        }
+    }
+}
+
+/* index of the 64x32 tile (x, y) in an NV12T plane of x_tiles by
+ * y_tiles.  pairs of tile rows are laid out as Z, flipped Z, Z...; an
+ * odd last row is linear.
+ */
+static inline int nv12tTile(int x, int y, int x_tiles, int y_tiles)
+{
+    int index = (y & ~1) * x_tiles + x;
+
+    if (y & 1)
+        index += (x & ~3) + 2;
+    else if ((y_tiles & 1) == 0 || y != y_tiles - 1)
+        index += (x + 2) & ~3;
+
+    return index;
+}
+
+void nv12tToYuy2(const uint8_t *y, const uint8_t *c, uint8_t *dst, int width, int height)
+{
+    const int x_tiles = ((width + 127) & ~127) >> 6;
+    const int y_tiles = (height + 31) >> 5;
+    const int c_tiles = ((height >> 1) + 31) >> 5;
+
+    for (int row = 0; row < height; row++) {
+        const int crow = row >> 1;
+
+        for (int tx = 0; tx < x_tiles && (tx << 6) < width; tx++) {
+            const uint8_t *ys = y + (nv12tTile(tx, row >> 5, x_tiles, y_tiles) << 11)
+                                  + ((row & 31) << 6);
+            const uint8_t *cs = c + (nv12tTile(tx, crow >> 5, x_tiles, c_tiles) << 11)
+                                  + ((crow & 31) << 6);
+            int n = (width - (tx << 6)) >> 1;
+            if (n > 32)
+                n = 32;
+
+#if defined(__ARM_NEON__)
+            for (; n >= 16; n -= 16) {
+                uint8x16x2_t luma = vld2q_u8(ys);
+                uint8x16x2_t chroma = vld2q_u8(cs);
+                uint8x16x4_t out;
+
+                out.val[0] = luma.val[0];
+                out.val[1] = chroma.val[0];
+                out.val[2] = luma.val[1];
+                out.val[3] = chroma.val[1];
+                vst4q_u8(dst, out);
+                ys += 32;
+                cs += 32;
+                dst += 64;
+            }
+#endif
+            while (n-- > 0) {
+                *dst++ = *ys++;
+                *dst++ = *cs++;
+                *dst++ = *ys++;
+                *dst++ = *cs++;
+            }
+        }
+    }
+}
+
+/* [*start, *end) of the source span covered by destination index i;
+ * never empty as long as src >= dst
+ */
+static inline void span(int i, int src, int dst, int *start, int *end)
+{
+    *start = i * src / dst;
+    *end = (i + 1) * src / dst;
+}
+
+#if defined(__ARM_NEON__)
+/* one destination line at a 1:1 horizontal ratio, the mean of rows
+ * source lines where rows is 1 << shift.  returns the number of
+ * destination pixels done.
+ */
+static int scaleLine1to1(const uint8_t *line, int stride, int rows, int shift,
+                         uint8_t *dst, int width)
+{
+    const int16x8_t rshift = vdupq_n_s16(-shift);
+    int x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+        const uint8_t *p = line + x * 2;
+        uint16x8_t lo = vdupq_n_u16(0), hi = lo;
+
+        for (int r = 0; r < rows; r++, p += stride) {
+            uint8x16_t in = vld1q_u8(p);
+            lo = vaddw_u8(lo, vget_low_u8(in));
+            hi = vaddw_u8(hi, vget_high_u8(in));
+        }
+        vst1q_u8(dst + x * 2, vcombine_u8(vmovn_u16(vrshlq_u16(lo, rshift)),
+                                          vmovn_u16(vrshlq_u16(hi, rshift))));
+    }
+    return x;
+}
+
+/* the same at 2:1: a destination pixel's luma is one source pair, a
+ * destination pair's chroma two source pairs
+ */
+static int scaleLine2to1(const uint8_t *line, int stride, int rows, int shift,
+                         uint8_t *dst, int width)
+{
+    const int16x8_t rshift = vdupq_n_s16(-(shift + 1));
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        const uint8_t *p = line + x * 4;
+        uint16x8_t ylo = vdupq_n_u16(0), yhi = ylo, u = ylo, v = ylo;
+
+        for (int r = 0; r < rows; r++, p += stride) {
+            uint8x16x4_t in = vld4q_u8(p);
+            ylo = vaddw_u8(vaddw_u8(ylo, vget_low_u8(in.val[0])), vget_low_u8(in.val[2]));
+            yhi = vaddw_u8(vaddw_u8(yhi, vget_high_u8(in.val[0])), vget_high_u8(in.val[2]));
+            u = vpadalq_u8(u, in.val[1]);
+            v = vpadalq_u8(v, in.val[3]);
+        }
+
+        uint8x8x2_t luma = vuzp_u8(vmovn_u16(vrshlq_u16(ylo, rshift)),
+                                   vmovn_u16(vrshlq_u16(yhi, rshift)));
+        uint8x8x4_t out;
+        out.val[0] = luma.val[0];
+        out.val[1] = vmovn_u16(vrshlq_u16(u, rshift));
+        out.val[2] = luma.val[1];
+        out.val[3] = vmovn_u16(vrshlq_u16(v, rshift));
+        vst4_u8(dst + x * 2, out);
+    }
+    return x;
+}
+#endif
+
+bool scaleYuy2(const uint8_t *src, int srcWidth, int srcHeight,
+               uint8_t *dst, int dstWidth, int dstHeight)
+{
+    const int stride = srcWidth * 2;
+
+    if (dstWidth <= 0 || dstHeight <= 0 || (dstWidth & 1) || (srcWidth & 1) ||
+            srcWidth < dstWidth || srcHeight < dstHeight)
+        return false;
+
+    /* luma span of every destination pixel and chroma pairs of every
+     * destination pair, the same for all lines
+     */
+    int *spans = (int *)malloc(sizeof(int) * dstWidth * 3);
+    if (spans == NULL)
+        return false;
+
+    int *lx0 = spans, *lx1 = spans + dstWidth;
+    int *cp0 = spans + dstWidth * 2, *cp1 = cp0 + dstWidth / 2;
+
+    for (int dx = 0; dx < dstWidth; dx++)
+        span(dx, srcWidth, dstWidth, &lx0[dx], &lx1[dx]);
+    for (int dx = 0; dx < dstWidth; dx += 2) {
+        cp0[dx / 2] = lx0[dx] >> 1;
+        cp1[dx / 2] = (lx1[dx + 1] + 1) >> 1;
+    }
+
+#if defined(__ARM_NEON__)
+    const int hratio = srcWidth == dstWidth ? 1 : srcWidth == dstWidth * 2 ? 2 : 0;
+#endif
+
+    for (int dy = 0; dy < dstHeight; dy++) {
+        int y0, y1;
+        span(dy, srcHeight, dstHeight, &y0, &y1);
+
+        const uint8_t *first = src + y0 * stride;
+        const uint32_t rows = y1 - y0;
+        int dx = 0;
+
+#if defined(__ARM_NEON__)
+        /* a power of two rows divides with a rounding shift, and up to
+         * 128 of them fit the 16 bit sums
+         */
+        if (hratio && (rows & (rows - 1)) == 0 && rows <= 128) {
+            const int shift = 31 - __builtin_clz(rows);
+
+            if (hratio == 1)
+                dx = scaleLine1to1(first, stride, rows, shift, dst, dstWidth);
+            else
+                dx = scaleLine2to1(first, stride, rows, shift, dst, dstWidth);
+            dst += dx * 2;
+        }
+#endif
+
+        for (; dx < dstWidth; dx += 2) {
+            const int x0 = lx0[dx], x1 = lx1[dx];
+            const int x2 = lx0[dx + 1], x3 = lx1[dx + 1];
+            const int p0 = cp0[dx / 2], p1 = cp1[dx / 2];
+            uint32_t sy0 = 0, sy1 = 0, su = 0, sv = 0;
+
+            const uint8_t *line = first;
+            for (uint32_t r = 0; r < rows; r++, line += stride) {
+                for (int x = x0; x < x1; x++)
+                    sy0 += line[x * 2];
+                for (int x = x2; x < x3; x++)
+                    sy1 += line[x * 2];
+                for (int p = p0; p < p1; p++) {
+                    su += line[p * 4 + 1];
+                    sv += line[p * 4 + 3];
+                }
+            }
+
+            const uint32_t n0 = rows * (x1 - x0);
+            const uint32_t n1 = rows * (x3 - x2);
+            const uint32_t nc = rows * (p1 - p0);
+
+            *dst++ = (sy0 + n0 / 2) / n0;
+            *dst++ = (su + nc / 2) / nc;
+            *dst++ = (sy1 + n1 / 2) / n1;
+            *dst++ = (sv + nc / 2) / nc;
+        }
+    }
+
+    free(spans);
+    return true;
+}
+
+}; // namespace android
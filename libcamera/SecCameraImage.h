@@ -0,0 +1,54 @@
+/*
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_HARDWARE_CAMERA_SEC_IMAGE_H
+#define ANDROID_HARDWARE_CAMERA_SEC_IMAGE_H
+
+#include <stdint.h>
+
+namespace android {
+
+/* pixel kernels used on the preview and capture paths.  each has a
+ * NEON body and a plain C version that handles the tail and non-NEON
+ * builds.
+ */
+
+/* planar Y/Cb/Cr (I420) -> NV21 into a separate buffer.  width and
+ * height must be even.
+ */
+void yuv420pToNv21(const uint8_t *src, uint8_t *dst, int width, int height);
+
+/* planar Y/Cb/Cr (I420) -> packed YUY2, the JPEG encoder's input
+ * layout.  width and height must be even.
+ */
+void yuv420pToYuy2(const uint8_t *src, uint8_t *dst, int width, int height);
+
+/* FIMC's NV12T (64x32 tiles in Z-flipped-Z order, the layout MFC
+ * reads) -> packed YUY2, detiling and interleaving in one pass.  c is
+ * the start of the tiled CbCr plane.  width and height must be even.
+ */
+void nv12tToYuy2(const uint8_t *y, const uint8_t *c, uint8_t *dst, int width, int height);
+
+/* area-averaging YUY2 down-scaler for any ratio; each destination
+ * pixel is the rounded mean of the source pixels it covers.  the
+ * destination must not be larger than the source in either direction,
+ * there is no upscaling path.  1:1 and 2:1 horizontal ratios have NEON
+ * bodies.  dstWidth must be even.
+ */
+bool scaleYuy2(const uint8_t *src, int srcWidth, int srcHeight,
+               uint8_t *dst, int dstWidth, int dstHeight);
+
+}; // namespace android
+
+#endif // ANDROID_HARDWARE_CAMERA_SEC_IMAGE_H
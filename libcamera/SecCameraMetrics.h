@@ -0,0 +1,303 @@
+/*
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_HARDWARE_CAMERA_SEC_METRICS_H
+#define ANDROID_HARDWARE_CAMERA_SEC_METRICS_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <cutils/atomic.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+/* microsecond histogram that is always compiled in.  buckets are
+ * log-linear, four per power of two, so percentiles are within 25%
+ * over 1 us .. 33 s.  record() only does atomic adds and may be
+ * called from any thread; dump() reads without stopping writers.
+ */
+class SecCameraHistogram {
+public:
+    enum {
+        SUB_BITS    = 2,
+        SUB_BUCKETS = 1 << SUB_BITS,
+        MAX_BITS    = 25,
+        BUCKETS     = (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS,
+    };
+
+    SecCameraHistogram(const char *name) : m_name(name)
+    {
+        reset();
+    }
+
+    static int elapsedUs(nsecs_t start)
+    {
+        return (int)((systemTime(SYSTEM_TIME_MONOTONIC) - start) / 1000);
+    }
+
+    void record(int us)
+    {
+        int32_t old_max;
+
+        if (us < 0)
+            us = 0;
+        if (us >= (1 << MAX_BITS))
+            us = (1 << MAX_BITS) - 1;
+
+        android_atomic_inc(&m_buckets[bucket(us)]);
+        android_atomic_inc(&m_count);
+        do {
+            old_max = m_max;
+            if (us <= old_max)
+                break;
+        } while (android_atomic_cmpxchg(old_max, us, &m_max));
+    }
+
+    void recordSince(nsecs_t start)
+    {
+        record(elapsedUs(start));
+    }
+
+    void reset()
+    {
+        memset((void *)m_buckets, 0, sizeof(m_buckets));
+        m_count = 0;
+        m_max   = 0;
+    }
+
+    int count() const
+    {
+        return m_count;
+    }
+
+    /* upper bound of the bucket holding the pct-th percentile, at most
+     * the largest value recorded; 0 while empty
+     */
+    int percentile(int pct) const
+    {
+        int n = m_count;
+
+        return n ? percentile(n, pct) : 0;
+    }
+
+    void dump(String8 &result) const
+    {
+        char buffer[256];
+        int n = m_count;
+
+        if (n == 0) {
+            snprintf(buffer, 255, "  %-16s n(0)\n", m_name);
+        } else {
+            snprintf(buffer, 255, "  %-16s n(%d) p50(%d) p90(%d) p99(%d) max(%d) us\n",
+                     m_name, n, percentile(n, 50), percentile(n, 90),
+                     percentile(n, 99), (int)m_max);
+        }
+        result.append(buffer);
+    }
+
+private:
+    static int bucket(int us)
+    {
+        int msb;
+
+        if (us < SUB_BUCKETS)
+            return us;
+        msb = 31 - __builtin_clz(us);
+        return (msb - SUB_BITS + 1) * SUB_BUCKETS +
+               ((us >> (msb - SUB_BITS)) & (SUB_BUCKETS - 1));
+    }
+
+    /* largest value that lands in bucket i */
+    static int upperBound(int i)
+    {
+        int shift;
+
+        if (i < SUB_BUCKETS)
+            return i;
+        shift = i / SUB_BUCKETS - 1;
+        return ((SUB_BUCKETS + i % SUB_BUCKETS + 1) << shift) - 1;
+    }
+
+    int percentile(int n, int pct) const
+    {
+        int64_t want = ((int64_t)n * pct + 99) / 100;
+        int64_t seen = 0;
+
+        for (int i = 0; i < BUCKETS; i++) {
+            seen += m_buckets[i];
+            if (seen >= want)
+                return upperBound(i) < m_max ? upperBound(i) : (int)m_max;
+        }
+        return m_max;
+    }
+
+    const char        *m_name;
+    volatile int32_t   m_buckets[BUCKETS];
+    volatile int32_t   m_count;
+    volatile int32_t   m_max;
+};
+
+/* events per second over windows of about one second, x100.  tick()
+ * must come from a single thread; rate() may be read from any.
+ */
+class SecCameraRate {
+public:
+    SecCameraRate() : m_window_start(0), m_events(0), m_rate100(0) {}
+
+    void tick(nsecs_t now)
+    {
+        if (m_window_start == 0 || now - m_window_start > 5000000000LL) {
+            /* first event, or we were stopped for a while */
+            m_window_start = now;
+            m_events = 0;
+            return;
+        }
+
+        m_events++;
+        if (now - m_window_start >= 1000000000LL) {
+            m_rate100 = (int32_t)(m_events * 100000000000LL / (now - m_window_start));
+            m_window_start = now;
+            m_events = 0;
+        }
+    }
+
+    int rate100() const
+    {
+        return m_rate100;
+    }
+
+private:
+    nsecs_t            m_window_start;
+    int64_t            m_events;
+    volatile int32_t   m_rate100;
+};
+
+/* checks driver frame timestamps against the monotonic clock at
+ * dequeue.  latency is how long a frame waited for us, jitter how far
+ * each frame interval is from the running average, and drift how the
+ * smallest latency of each second moves, in ppm.  frame() must come
+ * from a single thread.
+ */
+class SecCameraFrameClock {
+public:
+    SecCameraFrameClock(const char *name, const char *latency_name,
+                        const char *jitter_name) :
+        m_name(name),
+        m_latency(latency_name),
+        m_jitter(jitter_name),
+        m_invalid(0),
+        m_clamped(0),
+        m_drift_ppm(0)
+    {
+        restart();
+    }
+
+    /* a new stream: forget the previous interval and drift baseline */
+    void restart()
+    {
+        m_last = 0;
+        m_interval = 0;
+        m_window_start = 0;
+        m_window_min = 0;
+        m_base_time = 0;
+        m_base_min = 0;
+    }
+
+    /* returns the timestamp to hand on: the driver's, or the dequeue
+     * time if the driver's cannot be right, never at or before the
+     * last one handed on
+     */
+    nsecs_t frame(nsecs_t timestamp, nsecs_t now)
+    {
+        nsecs_t latency;
+
+        if (timestamp <= 0 || timestamp > now || now - timestamp > 1000000000LL) {
+            android_atomic_inc(&m_invalid);
+            timestamp = now;
+        }
+        /* a fallback or a wall clock converted at dequeue can land
+         * behind a frame already handed on
+         */
+        if (m_last != 0 && timestamp <= m_last) {
+            android_atomic_inc(&m_clamped);
+            timestamp = m_last + 1;
+        }
+
+        latency = now - timestamp;
+        m_latency.record((int)(latency / 1000));
+
+        if (m_last != 0 && timestamp > m_last) {
+            nsecs_t interval = timestamp - m_last;
+            nsecs_t deviation;
+
+            if (m_interval == 0)
+                m_interval = interval;
+            deviation = interval > m_interval ? interval - m_interval : m_interval - interval;
+            m_jitter.record((int)(deviation / 1000));
+            m_interval += (interval - m_interval) / 16;
+        }
+        m_last = timestamp;
+
+        if (m_window_start == 0 || latency < m_window_min)
+            m_window_min = latency;
+        if (m_window_start == 0)
+            m_window_start = now;
+
+        if (now - m_window_start >= 1000000000LL) {
+            if (m_base_time == 0) {
+                m_base_time = now;
+                m_base_min = m_window_min;
+            } else {
+                m_drift_ppm = (int32_t)((m_window_min - m_base_min) * 1000000LL /
+                                        (now - m_base_time));
+            }
+            m_window_start = 0;
+        }
+
+        return timestamp;
+    }
+
+    void dump(String8 &result) const
+    {
+        char buffer[256];
+
+        snprintf(buffer, 255, "  %s: interval %d us, drift %d ppm, %d unusable timestamps, "
+                 "%d moved forward\n", m_name, (int)(m_interval / 1000), (int)m_drift_ppm,
+                 (int)m_invalid, (int)m_clamped);
+        result.append(buffer);
+        m_latency.dump(result);
+        m_jitter.dump(result);
+    }
+
+private:
+    const char         *m_name;
+    SecCameraHistogram m_latency;
+    SecCameraHistogram m_jitter;
+    nsecs_t            m_last;
+    nsecs_t            m_interval;
+    nsecs_t            m_window_start;
+    nsecs_t            m_window_min;
+    nsecs_t            m_base_time;
+    nsecs_t            m_base_min;
+    volatile int32_t   m_invalid;
+    volatile int32_t   m_clamped;
+    volatile int32_t   m_drift_ppm;
+};
+
+}; // namespace android
+
+#endif // ANDROID_HARDWARE_CAMERA_SEC_METRICS_H
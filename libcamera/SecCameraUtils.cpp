@@ -17,6 +17,7 @@
 */
 
 #include "SecCameraUtils.h"
+#include <errno.h>
 #include <stdlib.h>
 
 namespace android {
@@ -69,4 +70,19 @@ String8 SecCameraArea::toString8() {
         m_left, m_top, m_right, m_bottom, m_weight);
 }
 
+int fitBufferCount(int count, int min, int (*request)(int count, void *ctx), void *ctx)
+{
+    for (; count >= min; count--) {
+        int granted = request(count, ctx);
+
+        /* the driver may also grant fewer than asked */
+        if (granted >= 0)
+            return granted >= min ? granted : -1;
+        if (errno != ENOMEM)
+            break;
+    }
+
+    return -1;
+}
+
 }
\ No newline at end of file
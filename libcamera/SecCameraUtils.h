@@ -39,6 +39,12 @@ struct SecCameraArea {
     String8 toString8();
 };
 
+/* asks request(count, ctx) for count buffers and steps down while it
+ * fails with ENOMEM.  request returns the count granted, or -1 with
+ * errno set.  returns the granted count, or -1 if min could not be had.
+ */
+int fitBufferCount(int count, int min, int (*request)(int count, void *ctx), void *ctx);
+
 }; // namespace android
 
 #endif // ANDROID_HARDWARE_CAMERA_SEC_UTILS_H
\ No newline at end of file
@@ -0,0 +1,160 @@
+/*
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * Times set_parameters() through the camera HAL module, the way an
+ * application drives it: the full set sent unchanged, then with the
+ * zoom stepped on every call.  Before timing, checks that zsl falls
+ * back to off for a picture larger than the preview without failing
+ * the call.  Needs the sensor, so it runs on the device with the
+ * camera service stopped.
+ *
+ *   camera_params_bench [camera id] [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <hardware/hardware.h>
+#include <hardware/camera.h>
+#include <camera/CameraParameters.h>
+
+using namespace android;
+
+static double now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+/* sets params iterations times, the zoom stepped if max_zoom > 0 */
+static double run(camera_device_t *dev, CameraParameters &params, int iterations,
+                  int max_zoom)
+{
+    double start = now_us();
+
+    for (int i = 0; i < iterations; i++) {
+        if (max_zoom > 0)
+            params.set(CameraParameters::KEY_ZOOM, i % (max_zoom + 1));
+        if (dev->ops->set_parameters(dev, params.flatten().string()) != 0)
+            printf("set_parameters failed on call %d\n", i);
+    }
+
+    return (now_us() - start) / iterations;
+}
+
+static bool set(camera_device_t *dev, CameraParameters &params)
+{
+    return dev->ops->set_parameters(dev, params.flatten().string()) == 0;
+}
+
+static const char *get_zsl(camera_device_t *dev)
+{
+    static char zsl[8];
+    char *str = dev->ops->get_parameters(dev);
+    CameraParameters params;
+
+    params.unflatten(String8(str));
+    dev->ops->put_parameters(dev, str);
+    snprintf(zsl, sizeof(zsl), "%s", params.get("zsl") ? params.get("zsl") : "");
+    return zsl;
+}
+
+/* zsl=on with a picture larger than the preview succeeds with zsl off,
+ * and a later zsl=on with a picture that fits the preview turns it on */
+static bool check_zsl(camera_device_t *dev, CameraParameters params)
+{
+    Vector<Size> sizes;
+    int width, height, fit = -1, large = -1;
+    bool ok = true;
+
+    if (params.get("zsl-values") == NULL)
+        return true;
+
+    params.getPreviewSize(&width, &height);
+    params.getSupportedPictureSizes(sizes);
+    for (size_t i = 0; i < sizes.size(); i++) {
+        bool fits = sizes[i].width <= width && sizes[i].height <= height;
+        if (fits && (fit < 0 || sizes[i].width > sizes[fit].width))
+            fit = i;
+        if (!fits && large < 0)
+            large = i;
+    }
+    if (fit < 0 || large < 0) {
+        printf("zsl check skipped, no picture sizes around %dx%d\n", width, height);
+        return true;
+    }
+
+    params.set("zsl", "on");
+    params.setPictureSize(sizes[large].width, sizes[large].height);
+    if (!set(dev, params) || strcmp(get_zsl(dev), "off")) {
+        printf("zsl check failed: %dx%d picture did not fall back to zsl off\n",
+               sizes[large].width, sizes[large].height);
+        ok = false;
+    }
+
+    params.setPictureSize(sizes[fit].width, sizes[fit].height);
+    if (!set(dev, params) || strcmp(get_zsl(dev), "on")) {
+        printf("zsl check failed: %dx%d picture did not turn zsl on\n",
+               sizes[fit].width, sizes[fit].height);
+        ok = false;
+    }
+
+    params.set("zsl", "off");
+    set(dev, params);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    const char *id = argc > 1 ? argv[1] : "0";
+    int iterations = argc > 2 ? atoi(argv[2]) : 200;
+    camera_module_t *module;
+    camera_device_t *dev;
+
+    if (iterations < 1)
+        iterations = 1;
+
+    if (hw_get_module(CAMERA_HARDWARE_MODULE_ID, (const hw_module_t **)&module) < 0) {
+        printf("no camera module\n");
+        return 1;
+    }
+    if (module->common.methods->open(&module->common, id, (hw_device_t **)&dev) < 0) {
+        printf("cannot open camera %s\n", id);
+        return 1;
+    }
+
+    char *str = dev->ops->get_parameters(dev);
+    CameraParameters params;
+    params.unflatten(String8(str));
+    dev->ops->put_parameters(dev, str);
+
+    int max_zoom = params.getInt(CameraParameters::KEY_MAX_ZOOM);
+    bool zsl_ok = check_zsl(dev, params);
+
+    double same = run(dev, params, iterations, 0);
+    double zoom = max_zoom > 0 ? run(dev, params, iterations, max_zoom) : 0;
+
+    printf("camera %s, %d calls each\n", id, iterations);
+    printf("  unchanged       %10.1f us/call\n", same);
+    if (max_zoom > 0)
+        printf("  zoom stepped    %10.1f us/call\n", zoom);
+
+    dev->common.close(&dev->common);
+    return zsl_ok ? 0 : 1;
+}
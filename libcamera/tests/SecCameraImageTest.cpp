@@ -0,0 +1,411 @@
+/*
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * Checks the SecCameraImage kernels bit for bit against plain per-pixel
+ * C references and times both at the HAL's preview sizes.  The host
+ * build runs the C paths, the device build the NEON ones.
+ *
+ *   camera_image_test [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "SecCameraImage.h"
+
+using namespace android;
+
+struct Size {
+    int width;
+    int height;
+};
+
+/* both cameras' preview sizes, then sizes that leave NEON tails and
+ * odd tile rows
+ */
+static const Size kSizes[] = {
+    { 800, 480 }, { 720, 480 }, { 640, 480 }, { 592, 480 },
+    { 352, 288 }, { 320, 240 }, { 176, 144 },
+    { 2, 2 }, { 34, 6 }, { 66, 34 }, { 130, 98 },
+};
+
+static int g_failures;
+
+static void fill(uint8_t *buf, int size, unsigned int seed)
+{
+    for (int i = 0; i < size; i++) {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = seed >> 16;
+    }
+}
+
+static void check(const char *name, const Size &s, const uint8_t *got,
+                  const uint8_t *want, int size)
+{
+    for (int i = 0; i < size; i++) {
+        if (got[i] != want[i]) {
+            printf("FAIL %s %dx%d: byte %d is %d, expected %d\n",
+                   name, s.width, s.height, i, got[i], want[i]);
+            g_failures++;
+            return;
+        }
+    }
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* ---- references ---- */
+
+static void refYuv420pToNv21(const uint8_t *src, uint8_t *dst, int width, int height)
+{
+    const uint8_t *u = src + width * height;
+    const uint8_t *v = u + width * height / 4;
+    uint8_t *vu = dst + width * height;
+
+    for (int i = 0; i < width * height; i++)
+        dst[i] = src[i];
+    for (int i = 0; i < width * height / 4; i++) {
+        vu[2 * i] = v[i];
+        vu[2 * i + 1] = u[i];
+    }
+}
+
+static void refYuv420pToYuy2(const uint8_t *src, uint8_t *dst, int width, int height)
+{
+    const uint8_t *u = src + width * height;
+    const uint8_t *v = u + width * height / 4;
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += 2) {
+            uint8_t *p = dst + (y * width + x) * 2;
+            int c = (y / 2) * (width / 2) + x / 2;
+
+            p[0] = src[y * width + x];
+            p[1] = u[c];
+            p[2] = src[y * width + x + 1];
+            p[3] = v[c];
+        }
+    }
+}
+
+/* tile number of every 64x32 tile, built by walking the plane in
+ * storage order: pairs of tile rows in groups of two columns, Z then
+ * flipped Z, with an odd last tile row stored linearly
+ */
+static void nv12tTileMap(int x_tiles, int y_tiles, int *map)
+{
+    int n = 0;
+
+    for (int ty = 0; ty + 1 < y_tiles; ty += 2) {
+        for (int tx = 0; tx < x_tiles; tx += 2) {
+            bool flipped = (tx / 2) & 1;
+            int first = flipped ? ty + 1 : ty;
+            int second = flipped ? ty : ty + 1;
+
+            map[first * x_tiles + tx] = n++;
+            map[first * x_tiles + tx + 1] = n++;
+            map[second * x_tiles + tx] = n++;
+            map[second * x_tiles + tx + 1] = n++;
+        }
+    }
+    if (y_tiles & 1) {
+        for (int tx = 0; tx < x_tiles; tx++)
+            map[(y_tiles - 1) * x_tiles + tx] = n++;
+    }
+}
+
+static int nv12tPlaneSize(int width, int rows)
+{
+    const int x_tiles = ((width + 127) & ~127) >> 6;
+    const int y_tiles = (rows + 31) >> 5;
+
+    return x_tiles * y_tiles * 2048;
+}
+
+static void refNv12tToYuy2(const uint8_t *ys, const uint8_t *cs, uint8_t *dst,
+                           int width, int height)
+{
+    const int x_tiles = ((width + 127) & ~127) >> 6;
+    const int y_tiles = (height + 31) >> 5;
+    const int c_tiles = ((height / 2) + 31) >> 5;
+    int *ymap = new int[x_tiles * y_tiles];
+    int *cmap = new int[x_tiles * c_tiles];
+
+    nv12tTileMap(x_tiles, y_tiles, ymap);
+    nv12tTileMap(x_tiles, c_tiles, cmap);
+
+    for (int y = 0; y < height; y++) {
+        const int cy = y / 2;
+
+        for (int x = 0; x < width; x++) {
+            int yt = ymap[(y / 32) * x_tiles + x / 64];
+            int ct = cmap[(cy / 32) * x_tiles + x / 64];
+            int yoff = yt * 2048 + (y % 32) * 64 + x % 64;
+            int coff = ct * 2048 + (cy % 32) * 64 + (x % 64 & ~1);
+            uint8_t *p = dst + (y * width + x) * 2;
+
+            p[0] = ys[yoff];
+            p[1] = cs[coff + (x & 1)];
+        }
+    }
+
+    delete[] ymap;
+    delete[] cmap;
+}
+
+/* first and one past the last source index covered by destination
+ * index i, at least one source sample wide
+ */
+static void refSpan(int i, int src, int dst, int *first, int *end)
+{
+    *first = i * src / dst;
+    *end = (i + 1) * src / dst;
+    if (*end < *first + 1)
+        *end = *first + 1;
+}
+
+/* box average: every luma sample is the rounded mean of the source
+ * luma its box covers, the chroma of a pair the mean of every source
+ * pair either of its boxes touches
+ */
+static void refScaleYuy2(const uint8_t *src, int src_width, int src_height,
+                         uint8_t *dst, int dst_width, int dst_height)
+{
+    for (int dy = 0; dy < dst_height; dy++) {
+        int y0, y1;
+        refSpan(dy, src_height, dst_height, &y0, &y1);
+
+        for (int dx = 0; dx < dst_width; dx++) {
+            int x0, x1;
+            unsigned int sum = 0, n = 0;
+
+            refSpan(dx, src_width, dst_width, &x0, &x1);
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++, n++)
+                    sum += src[(y * src_width + x) * 2];
+            }
+            dst[(dy * dst_width + dx) * 2] = (sum + n / 2) / n;
+        }
+
+        for (int dx = 0; dx < dst_width; dx += 2) {
+            int first, end, unused;
+            unsigned int su = 0, sv = 0, n = 0;
+
+            refSpan(dx, src_width, dst_width, &first, &unused);
+            refSpan(dx + 1, src_width, dst_width, &unused, &end);
+            for (int y = y0; y < y1; y++) {
+                for (int pair = first / 2; pair * 2 < end; pair++, n++) {
+                    su += src[(y * src_width + pair * 2) * 2 + 1];
+                    sv += src[(y * src_width + pair * 2) * 2 + 3];
+                }
+            }
+            dst[(dy * dst_width + dx) * 2 + 1] = (su + n / 2) / n;
+            dst[(dy * dst_width + dx) * 2 + 3] = (sv + n / 2) / n;
+        }
+    }
+}
+
+/* ---- checks and timings ---- */
+
+typedef void (*Kernel)(const uint8_t *src, uint8_t *dst, int width, int height);
+
+/* checks a planar kernel against its reference and times both */
+static void runPlanar(const char *name, Kernel kernel, Kernel ref, const Size &s,
+                      int in_size, int out_size, int iterations)
+{
+    uint8_t *src = new uint8_t[in_size];
+    uint8_t *got = new uint8_t[out_size];
+    uint8_t *want = new uint8_t[out_size];
+    double t0, t1, t2;
+
+    fill(src, in_size, s.width * 31 + s.height);
+    memset(got, 0, out_size);
+    memset(want, 0, out_size);
+
+    kernel(src, got, s.width, s.height);
+    ref(src, want, s.width, s.height);
+    check(name, s, got, want, out_size);
+
+    t0 = now_ms();
+    for (int i = 0; i < iterations; i++)
+        kernel(src, got, s.width, s.height);
+    t1 = now_ms();
+    for (int i = 0; i < iterations; i++)
+        ref(src, want, s.width, s.height);
+    t2 = now_ms();
+
+    printf("%-16s %4dx%-4d %8.3f ms %8.3f ms reference\n", name, s.width, s.height,
+           (t1 - t0) / iterations, (t2 - t1) / iterations);
+
+    delete[] src;
+    delete[] got;
+    delete[] want;
+}
+
+static void runNv12t(const Size &s, int iterations)
+{
+    const int y_size = nv12tPlaneSize(s.width, s.height);
+    const int c_size = nv12tPlaneSize(s.width, s.height / 2);
+    const int out_size = s.width * s.height * 2;
+    uint8_t *y = new uint8_t[y_size];
+    uint8_t *c = new uint8_t[c_size];
+    uint8_t *got = new uint8_t[out_size];
+    uint8_t *want = new uint8_t[out_size];
+    double t0, t1, t2;
+
+    fill(y, y_size, s.width);
+    fill(c, c_size, s.height);
+    memset(got, 0, out_size);
+    memset(want, 0, out_size);
+
+    nv12tToYuy2(y, c, got, s.width, s.height);
+    refNv12tToYuy2(y, c, want, s.width, s.height);
+    check("nv12tToYuy2", s, got, want, out_size);
+
+    t0 = now_ms();
+    for (int i = 0; i < iterations; i++)
+        nv12tToYuy2(y, c, got, s.width, s.height);
+    t1 = now_ms();
+    for (int i = 0; i < iterations; i++)
+        refNv12tToYuy2(y, c, want, s.width, s.height);
+    t2 = now_ms();
+
+    printf("%-16s %4dx%-4d %8.3f ms %8.3f ms reference\n", "nv12tToYuy2",
+           s.width, s.height, (t1 - t0) / iterations, (t2 - t1) / iterations);
+
+    delete[] y;
+    delete[] c;
+    delete[] got;
+    delete[] want;
+}
+
+/* capture -> postview, thumbnail and zsl picture sizes, then 1:1 and
+ * 2:1 horizontal ratios with power of two and other line counts, an
+ * identity and odd ratios
+ */
+static const Size kScales[][2] = {
+    { { 640, 480 }, { 160, 120 } },
+    { { 800, 480 }, { 640, 480 } },
+    { { 720, 480 }, { 320, 240 } },
+    { { 2560, 1920 }, { 320, 240 } },
+    { { 640, 480 }, { 320, 240 } },
+    { { 720, 480 }, { 360, 120 } },
+    { { 68, 9 }, { 34, 4 } },
+    { { 640, 480 }, { 640, 240 } },
+    { { 74, 16 }, { 74, 4 } },
+    { { 36, 12 }, { 36, 4 } },
+    { { 640, 480 }, { 640, 480 } },
+    { { 34, 6 }, { 10, 4 } },
+    { { 2, 2 }, { 2, 2 } },
+};
+
+/* upscaling has no path and is refused */
+static const Size kUpscales[][2] = {
+    { { 640, 480 }, { 800, 480 } },
+    { { 640, 240 }, { 640, 480 } },
+};
+
+static void runScale(const Size &from, const Size &to, int iterations)
+{
+    const int in_size = from.width * from.height * 2;
+    const int out_size = to.width * to.height * 2;
+    uint8_t *src = new uint8_t[in_size];
+    uint8_t *got = new uint8_t[out_size];
+    uint8_t *want = new uint8_t[out_size];
+    double t0, t1, t2;
+
+    fill(src, in_size, from.width + to.width);
+    memset(got, 0, out_size);
+    memset(want, 0, out_size);
+
+    if (!scaleYuy2(src, from.width, from.height, got, to.width, to.height)) {
+        printf("FAIL scaleYuy2 %dx%d -> %dx%d refused\n",
+               from.width, from.height, to.width, to.height);
+        g_failures++;
+    }
+    refScaleYuy2(src, from.width, from.height, want, to.width, to.height);
+    check("scaleYuy2", to, got, want, out_size);
+    if (from.width == to.width && from.height == to.height)
+        check("scaleYuy2 identity", to, got, src, out_size);
+
+    t0 = now_ms();
+    for (int i = 0; i < iterations; i++)
+        scaleYuy2(src, from.width, from.height, got, to.width, to.height);
+    t1 = now_ms();
+    for (int i = 0; i < iterations; i++)
+        refScaleYuy2(src, from.width, from.height, want, to.width, to.height);
+    t2 = now_ms();
+
+    printf("%-16s %4dx%-4d -> %4dx%-4d %8.3f ms %8.3f ms reference\n", "scaleYuy2",
+           from.width, from.height, to.width, to.height,
+           (t1 - t0) / iterations, (t2 - t1) / iterations);
+
+    delete[] src;
+    delete[] got;
+    delete[] want;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 20;
+
+    if (iterations < 1)
+        iterations = 1;
+
+    for (size_t i = 0; i < sizeof(kSizes) / sizeof(kSizes[0]); i++) {
+        const Size &s = kSizes[i];
+        const int planar = s.width * s.height * 3 / 2;
+        const int packed = s.width * s.height * 2;
+
+        runPlanar("yuv420pToNv21", yuv420pToNv21, refYuv420pToNv21, s,
+                  planar, planar, iterations);
+        runPlanar("yuv420pToYuy2", yuv420pToYuy2, refYuv420pToYuy2, s,
+                  planar, packed, iterations);
+        runNv12t(s, iterations);
+    }
+
+    for (size_t i = 0; i < sizeof(kScales) / sizeof(kScales[0]); i++)
+        runScale(kScales[i][0], kScales[i][1], iterations);
+
+    for (size_t i = 0; i < sizeof(kUpscales) / sizeof(kUpscales[0]); i++) {
+        const Size &from = kUpscales[i][0], &to = kUpscales[i][1];
+        uint8_t *src = new uint8_t[from.width * from.height * 2];
+        uint8_t *dst = new uint8_t[to.width * to.height * 2];
+
+        fill(src, from.width * from.height * 2, from.width);
+        if (scaleYuy2(src, from.width, from.height, dst, to.width, to.height)) {
+            printf("FAIL scaleYuy2 %dx%d -> %dx%d upscale accepted\n",
+                   from.width, from.height, to.width, to.height);
+            g_failures++;
+        }
+        delete[] src;
+        delete[] dst;
+    }
+
+    if (g_failures) {
+        printf("%d FAILED\n", g_failures);
+        return 1;
+    }
+    printf("all kernels match\n");
+    return 0;
+}
@@ -0,0 +1,211 @@
+/*
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * Checks the bookkeeping behind the camera dump: SecCameraHistogram
+ * buckets and percentiles, SecCameraFrameClock timestamp clamping, and
+ * the buffer count step-down used for VIDIOC_REQBUFS.  Needs no sensor.
+ *
+ *   camera_metrics_test
+ */
+
+#include <errno.h>
+#include <stdio.h>
+
+#include "SecCameraMetrics.h"
+#include "SecCameraUtils.h"
+
+using namespace android;
+
+static int g_failures;
+
+static void expect(const char *what, long long got, long long want)
+{
+    if (got != want) {
+        printf("FAIL %s: %lld, expected %lld\n", what, got, want);
+        g_failures++;
+    }
+}
+
+/* ---- histogram ---- */
+
+/* largest value sharing a bucket with us: four buckets per power of
+ * two, exact below four
+ */
+static int refUpperBound(int us)
+{
+    int msb = 0, step;
+
+    if (us < 4)
+        return us;
+    while ((us >> msb) > 1)
+        msb++;
+    step = 1 << (msb - 2);
+    return (us / step + 1) * step - 1;
+}
+
+static void testHistogramBuckets(void)
+{
+    static const int kLarge = 1 << 24;
+    char what[64];
+
+    for (int us = 0; us < 70000; us += us < 4200 ? 1 : 97) {
+        SecCameraHistogram h("bucket");
+
+        /* the large sample keeps the max from clamping the bound */
+        h.record(us);
+        h.record(kLarge);
+        snprintf(what, sizeof(what), "bucket bound of %d", us);
+        expect(what, h.percentile(50), refUpperBound(us));
+    }
+}
+
+static void testHistogramPercentiles(void)
+{
+    SecCameraHistogram h("percentiles");
+
+    expect("empty p50", h.percentile(50), 0);
+
+    for (int us = 1; us <= 100; us++)
+        h.record(us);
+    expect("count", h.count(), 100);
+    expect("p50 of 1..100", h.percentile(50), 55);
+    expect("p90 of 1..100", h.percentile(90), 95);
+    /* 99 falls in 96..111, clamped to the largest value recorded */
+    expect("p99 of 1..100", h.percentile(99), 100);
+    expect("p100 of 1..100", h.percentile(100), 100);
+    expect("p1 of 1..100", h.percentile(1), 1);
+
+    h.reset();
+    expect("count after reset", h.count(), 0);
+    expect("p50 after reset", h.percentile(50), 0);
+}
+
+static void testHistogramClamp(void)
+{
+    SecCameraHistogram h("clamp");
+
+    h.record(-5);
+    expect("negative p100", h.percentile(100), 0);
+
+    h.record(1 << 30);
+    expect("overflow count", h.count(), 2);
+    expect("overflow p100", h.percentile(100), (1 << SecCameraHistogram::MAX_BITS) - 1);
+}
+
+/* ---- frame clock ---- */
+
+static const nsecs_t kMs = 1000000LL;
+
+static void testFrameClock(void)
+{
+    SecCameraFrameClock clock("clock", "latency", "jitter");
+    nsecs_t now = 10000 * kMs;
+
+    /* good timestamps pass unchanged */
+    expect("good frame", clock.frame(now - 5 * kMs, now), now - 5 * kMs);
+    now += 33 * kMs;
+    expect("next good frame", clock.frame(now - 5 * kMs, now), now - 5 * kMs);
+
+    /* unusable ones become the dequeue time */
+    now += 33 * kMs;
+    expect("zero timestamp", clock.frame(0, now), now);
+    now += 33 * kMs;
+    expect("negative timestamp", clock.frame(-1, now), now);
+    now += 33 * kMs;
+    expect("future timestamp", clock.frame(now + kMs, now), now);
+    now += 33 * kMs;
+    expect("stale timestamp", clock.frame(now - 1001 * kMs, now), now);
+
+    /* never at or before the last one handed on */
+    nsecs_t last = now;
+    now += 33 * kMs;
+    expect("repeated timestamp", clock.frame(last, now), last + 1);
+    now += 33 * kMs;
+    expect("earlier timestamp", clock.frame(last - 10 * kMs, now), last + 2);
+
+    /* a new stream may start behind the old one */
+    clock.restart();
+    now += 33 * kMs;
+    expect("after restart", clock.frame(last - 20 * kMs, now), last - 20 * kMs);
+}
+
+/* ---- buffer count step-down ---- */
+
+struct FakeNode {
+    int capacity;   /* most buffers the reserved memory holds */
+    int grant;      /* at most this many granted, 0 for no limit */
+    int error;      /* errno for any request when set */
+    int calls;
+};
+
+static int fakeRequest(int count, void *ctx)
+{
+    FakeNode *node = (FakeNode *)ctx;
+
+    node->calls++;
+    if (node->error) {
+        errno = node->error;
+        return -1;
+    }
+    if (count > node->capacity) {
+        errno = ENOMEM;
+        return -1;
+    }
+    return node->grant && count > node->grant ? node->grant : count;
+}
+
+static void testFitBufferCount(void)
+{
+    FakeNode fits = { 8, 0, 0, 0 };
+    expect("fits count", fitBufferCount(6, 3, fakeRequest, &fits), 6);
+    expect("fits calls", fits.calls, 1);
+
+    FakeNode steps = { 4, 0, 0, 0 };
+    expect("steps count", fitBufferCount(8, 3, fakeRequest, &steps), 4);
+    expect("steps calls", steps.calls, 5);
+
+    FakeNode small = { 2, 0, 0, 0 };
+    expect("too small count", fitBufferCount(8, 3, fakeRequest, &small), -1);
+    expect("too small calls", small.calls, 6);
+
+    FakeNode fewer = { 8, 5, 0, 0 };
+    expect("fewer count", fitBufferCount(8, 3, fakeRequest, &fewer), 5);
+    expect("fewer calls", fewer.calls, 1);
+
+    /* a short grant is final, asking for less would not help */
+    FakeNode short_grant = { 8, 2, 0, 0 };
+    expect("short grant count", fitBufferCount(8, 3, fakeRequest, &short_grant), -1);
+    expect("short grant calls", short_grant.calls, 1);
+
+    FakeNode broken = { 8, 0, EINVAL, 0 };
+    expect("error count", fitBufferCount(8, 3, fakeRequest, &broken), -1);
+    expect("error calls", broken.calls, 1);
+}
+
+int main(void)
+{
+    testHistogramBuckets();
+    testHistogramPercentiles();
+    testHistogramClamp();
+    testFrameClock();
+    testFitBufferCount();
+
+    if (g_failures) {
+        printf("%d FAILED\n", g_failures);
+        return 1;
+    }
+    printf("all metrics checks pass\n");
+    return 0;
+}
@@ -31,3 +31,15 @@ LOCAL_C_INCLUDES += \
 LOCAL_MODULE := gps.wave
 
 include $(BUILD_SHARED_LIBRARY)
+
+# Fused location HAL doing location batching on top of gps.wave, stored in
+# hw/<FUSED_LOCATION_HARDWARE_MODULE_ID>.<ro.hardware>.so
+include $(CLEAR_VARS)
+
+LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
+LOCAL_SHARED_LIBRARIES := liblog libcutils libhardware
+LOCAL_SRC_FILES := flp_wave.c
+
+LOCAL_MODULE := flp.wave
+
+include $(BUILD_SHARED_LIBRARY)
@@ -0,0 +1,552 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Fused location HAL doing location batching on top of gps.wave. The
+ * modem has no batching of its own and still reports every fix over the
+ * SRS socket, so this saves framework callbacks and binder traffic, not
+ * modem-to-AP wakeups. GNSS is the only source.
+ */
+
+#include <errno.h>
+#include <hardware/fused_location.h>
+#include <hardware/gps.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gps_wave.h"
+
+#define  LOG_TAG  "flp_wave"
+#include <utils/Log.h>
+
+#define  FLP_DEBUG  1
+
+#if FLP_DEBUG
+#  define  D(...)   ALOGD(__VA_ARGS__)
+#else
+#  define  D(...)   ((void)0)
+#endif
+
+/* Number of fixes held by the batching ring */
+#define FLP_BATCH_SIZE			64
+/* Number of batching requests that can be active at once */
+#define FLP_MAX_REQUESTS		8
+/* A fix arriving up to this early (ms) still counts as on time */
+#define FIX_INTERVAL_SLACK		200
+
+typedef struct {
+	int active;
+	int id;
+	int64_t period_ms;
+	uint32_t flags;
+} FlpRequest;
+
+typedef struct {
+	int init;
+	FlpCallbacks callbacks;
+	const WaveGpsFlpInterface* gps;
+
+	FlpRequest requests[FLP_MAX_REQUESTS];
+	/* any request active, shortest period and combined flags of them */
+	int batching;
+	int64_t period_ms;
+	uint32_t flags;
+	int64_t last_fix_time;
+	/* navigation mode requested from gps.wave, only touched by the
+	 * framework thread calling the FLP interface */
+	int navigation;
+
+	/* ring of fixes, ring[head] is the oldest one */
+	FlpLocation ring[FLP_BATCH_SIZE];
+	int head;
+	int count;
+
+	/* location_cb is only called from deliver_thread: deliver_last is
+	 * the number of newest fixes asked for by get_batched_location,
+	 * deliver_full hands over the whole ring and empties it */
+	pthread_t deliver_thread;
+	pthread_cond_t deliver_cond;
+	int deliver_run;
+	int deliver_last;
+	int deliver_full;
+
+	pthread_mutex_t FlpMutex;
+} FlpState;
+
+static FlpState _flp_state[1] = {
+	{
+		.deliver_cond = PTHREAD_COND_INITIALIZER,
+		.FlpMutex = PTHREAD_MUTEX_INITIALIZER,
+	}
+};
+
+#define FLP_LOCK() pthread_mutex_lock(&_flp_state->FlpMutex)
+#define FLP_UNLOCK() pthread_mutex_unlock(&_flp_state->FlpMutex)
+
+static int64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Opens gps.wave, which hw_get_module() finds already loaded when the
+ * framework uses it, and returns its FLP extension.
+ */
+static const WaveGpsFlpInterface* flp_gps_interface(void)
+{
+	const struct hw_module_t* module;
+	struct gps_device_t* dev;
+	const GpsInterface* gps;
+	const WaveGpsFlpInterface* flp;
+
+	if (hw_get_module(GPS_HARDWARE_MODULE_ID, &module) != 0) {
+		ALOGE("%s: no GPS module", __FUNCTION__);
+		return NULL;
+	}
+
+	if (module->methods->open(module, GPS_HARDWARE_MODULE_ID,
+			(struct hw_device_t**)&dev) != 0) {
+		ALOGE("%s: cannot open GPS device", __FUNCTION__);
+		return NULL;
+	}
+
+	gps = dev->get_gps_interface(dev);
+	flp = gps ? gps->get_extension(WAVE_GPS_FLP_INTERFACE) : NULL;
+	if (!flp || flp->size < sizeof(WaveGpsFlpInterface)) {
+		ALOGE("%s: GPS module has no %s extension", __FUNCTION__,
+			WAVE_GPS_FLP_INTERFACE);
+		return NULL;
+	}
+
+	return flp;
+}
+
+/* Must be called with FLP_LOCK held */
+static void flp_update_requests(FlpState* s)
+{
+	FlpRequest* r;
+	int i;
+
+	s->batching = 0;
+	s->period_ms = 0;
+	s->flags = 0;
+
+	for (i = 0; i < FLP_MAX_REQUESTS; i++) {
+		r = &s->requests[i];
+		if (!r->active)
+			continue;
+		if (!s->batching || r->period_ms < s->period_ms)
+			s->period_ms = r->period_ms;
+		s->flags |= r->flags;
+		s->batching = 1;
+	}
+}
+
+/* Must be called with FLP_LOCK held */
+static FlpRequest* flp_find_request(FlpState* s, int id)
+{
+	int i;
+
+	for (i = 0; i < FLP_MAX_REQUESTS; i++)
+		if (s->requests[i].active && s->requests[i].id == id)
+			return &s->requests[i];
+	return NULL;
+}
+
+/*
+ * Keeps gps.wave navigating while any request is active. Must be called
+ * without FLP_LOCK held: gps.wave may wait for the modem, whose fixes
+ * come in through flp_fix_listener.
+ */
+static int flp_sync_navigation(FlpState* s)
+{
+	int enabled;
+
+	FLP_LOCK();
+	enabled = s->batching;
+	FLP_UNLOCK();
+
+	if (enabled == s->navigation)
+		return 0;
+
+	if (s->gps->set_navigation(enabled) != 0) {
+		ALOGE("%s: set_navigation(%d) failed", __FUNCTION__, enabled);
+		return -1;
+	}
+
+	s->navigation = enabled;
+	return 0;
+}
+
+static void flp_location(FlpLocation* l, const GpsLocation* fix)
+{
+	memset(l, 0, sizeof(*l));
+	l->size = sizeof(FlpLocation);
+	/* the FLP_LOCATION_HAS_* bits match GPS_LOCATION_HAS_* */
+	l->flags = fix->flags;
+	l->latitude = fix->latitude;
+	l->longitude = fix->longitude;
+	l->altitude = fix->altitude;
+	l->speed = fix->speed;
+	l->bearing = fix->bearing;
+	l->accuracy = fix->accuracy;
+	l->timestamp = fix->timestamp;
+	l->sources_used = FLP_TECH_MASK_GNSS;
+}
+
+/* Stores fixes from gps.wave in the ring at the batching period */
+static void flp_fix_listener(const GpsLocation* fix)
+{
+	FlpState* s = _flp_state;
+	int64_t now = now_ms();
+
+	if (!(fix->flags & GPS_LOCATION_HAS_LAT_LONG))
+		return;
+
+	FLP_LOCK();
+	if (!s->batching || (s->last_fix_time &&
+			now - s->last_fix_time + FIX_INTERVAL_SLACK < s->period_ms)) {
+		FLP_UNLOCK();
+		return;
+	}
+	s->last_fix_time = now;
+
+	if (s->count == FLP_BATCH_SIZE) {
+		/* overwrite the oldest fix */
+		s->head = (s->head + 1) % FLP_BATCH_SIZE;
+		s->count--;
+	}
+	flp_location(&s->ring[(s->head + s->count) % FLP_BATCH_SIZE], fix);
+	s->count++;
+
+	if (s->count == FLP_BATCH_SIZE && (s->flags & FLP_BATCH_WAKEUP_ON_FIFO_FULL)
+			&& !s->deliver_full) {
+		/* released by deliver_thread once the batch is handed over */
+		if (s->callbacks.acquire_wakelock_cb)
+			s->callbacks.acquire_wakelock_cb();
+		s->deliver_full = 1;
+		pthread_cond_signal(&s->deliver_cond);
+	}
+	FLP_UNLOCK();
+}
+
+static void* flp_deliver_thread(void* arg)
+{
+	FlpState* s = _flp_state;
+	FlpLocation locations[FLP_BATCH_SIZE];
+	FlpLocation* pointers[FLP_BATCH_SIZE];
+	int i, first, count, full;
+
+	if (s->callbacks.set_thread_event_cb)
+		s->callbacks.set_thread_event_cb(ASSOCIATE_JVM);
+
+	FLP_LOCK();
+	while (s->deliver_run) {
+		if (!s->deliver_full && !s->deliver_last) {
+			pthread_cond_wait(&s->deliver_cond, &s->FlpMutex);
+			continue;
+		}
+
+		full = s->deliver_full;
+		count = s->count;
+		if (!full && s->deliver_last < count)
+			count = s->deliver_last;
+		first = s->count - count;
+		for (i = 0; i < count; i++) {
+			locations[i] = s->ring[(s->head + first + i) % FLP_BATCH_SIZE];
+			pointers[i] = &locations[i];
+		}
+		if (full) {
+			s->head = 0;
+			s->count = 0;
+		}
+		s->deliver_full = 0;
+		s->deliver_last = 0;
+		FLP_UNLOCK();
+
+		D("%s(): %d locations", __FUNCTION__, count);
+
+		if (count && s->callbacks.location_cb)
+			s->callbacks.location_cb(count, pointers);
+		if (full && s->callbacks.release_wakelock_cb)
+			s->callbacks.release_wakelock_cb();
+
+		FLP_LOCK();
+	}
+	FLP_UNLOCK();
+
+	if (s->callbacks.set_thread_event_cb)
+		s->callbacks.set_thread_event_cb(DISASSOCIATE_JVM);
+
+	return NULL;
+}
+
+/********************************* FLP interface *********************************/
+
+static int
+wave_flp_init(FlpCallbacks* callbacks)
+{
+	D("%s() is called", __FUNCTION__);
+
+	FlpState* s = _flp_state;
+
+	if (s->init)
+		return FLP_RESULT_SUCCESS;
+
+	s->gps = flp_gps_interface();
+	if (!s->gps)
+		return FLP_RESULT_ERROR;
+
+	s->callbacks = *callbacks;
+	s->deliver_run = 1;
+	if (pthread_create(&s->deliver_thread, NULL, flp_deliver_thread, NULL) != 0) {
+		ALOGE("%s: could not create delivery thread", __FUNCTION__);
+		s->deliver_run = 0;
+		return FLP_RESULT_ERROR;
+	}
+
+	s->gps->set_fix_listener(flp_fix_listener);
+	s->init = 1;
+
+	return FLP_RESULT_SUCCESS;
+}
+
+static int
+wave_flp_get_batch_size(void)
+{
+	return FLP_BATCH_SIZE;
+}
+
+static int
+wave_flp_start_batching(int id, FlpBatchOptions* options)
+{
+	D("%s() is called", __FUNCTION__);
+	D("id=%d, sources_to_use=%d, flags=%d, period_ns=%lld", id,
+		options->sources_to_use, options->flags, options->period_ns);
+
+	FlpState* s = _flp_state;
+	FlpRequest* r = NULL;
+	int i;
+
+	if (!s->init) {
+		D("%s: called with uninitialized state !!", __FUNCTION__);
+		return FLP_RESULT_ERROR;
+	}
+
+	FLP_LOCK();
+	if (flp_find_request(s, id)) {
+		FLP_UNLOCK();
+		return FLP_RESULT_ID_EXISTS;
+	}
+
+	for (i = 0; i < FLP_MAX_REQUESTS && !r; i++)
+		if (!s->requests[i].active)
+			r = &s->requests[i];
+	if (!r) {
+		FLP_UNLOCK();
+		return FLP_RESULT_INSUFFICIENT_MEMORY;
+	}
+
+	r->active = 1;
+	r->id = id;
+	r->period_ms = options->period_ns / 1000000;
+	r->flags = options->flags;
+	s->last_fix_time = 0;
+	flp_update_requests(s);
+	FLP_UNLOCK();
+
+	if (flp_sync_navigation(s) != 0) {
+		FLP_LOCK();
+		r->active = 0;
+		flp_update_requests(s);
+		FLP_UNLOCK();
+		return FLP_RESULT_ERROR;
+	}
+
+	return FLP_RESULT_SUCCESS;
+}
+
+static int
+wave_flp_update_batching_options(int id, FlpBatchOptions* options)
+{
+	D("%s() is called", __FUNCTION__);
+	D("id=%d, sources_to_use=%d, flags=%d, period_ns=%lld", id,
+		options->sources_to_use, options->flags, options->period_ns);
+
+	FlpState* s = _flp_state;
+	FlpRequest* r;
+
+	FLP_LOCK();
+	r = flp_find_request(s, id);
+	if (!r) {
+		FLP_UNLOCK();
+		return FLP_RESULT_ID_UNKNOWN;
+	}
+
+	r->period_ms = options->period_ns / 1000000;
+	r->flags = options->flags;
+	flp_update_requests(s);
+	FLP_UNLOCK();
+
+	return FLP_RESULT_SUCCESS;
+}
+
+static int
+wave_flp_stop_batching(int id)
+{
+	D("%s() is called", __FUNCTION__);
+	D("id=%d", id);
+
+	FlpState* s = _flp_state;
+	FlpRequest* r;
+
+	FLP_LOCK();
+	r = flp_find_request(s, id);
+	if (!r) {
+		FLP_UNLOCK();
+		return FLP_RESULT_ID_UNKNOWN;
+	}
+
+	r->active = 0;
+	flp_update_requests(s);
+	FLP_UNLOCK();
+
+	flp_sync_navigation(s);
+
+	return FLP_RESULT_SUCCESS;
+}
+
+static void
+wave_flp_cleanup(void)
+{
+	D("%s() is called", __FUNCTION__);
+
+	FlpState* s = _flp_state;
+
+	if (!s->init)
+		return;
+
+	s->gps->set_fix_listener(NULL);
+
+	FLP_LOCK();
+	memset(s->requests, 0, sizeof(s->requests));
+	flp_update_requests(s);
+	s->deliver_run = 0;
+	pthread_cond_signal(&s->deliver_cond);
+	FLP_UNLOCK();
+
+	pthread_join(s->deliver_thread, NULL);
+	flp_sync_navigation(s);
+
+	/* a full batch that was never handed over still holds the wakelock */
+	if (s->deliver_full && s->callbacks.release_wakelock_cb)
+		s->callbacks.release_wakelock_cb();
+	s->deliver_full = 0;
+	s->deliver_last = 0;
+	s->head = 0;
+	s->count = 0;
+	s->init = 0;
+}
+
+static void
+wave_flp_get_batched_location(int last_n_locations)
+{
+	D("%s() is called", __FUNCTION__);
+	D("last_n_locations=%d", last_n_locations);
+
+	FlpState* s = _flp_state;
+
+	if (last_n_locations <= 0)
+		return;
+
+	/* the fixes stay in the ring */
+	FLP_LOCK();
+	if (last_n_locations > s->deliver_last)
+		s->deliver_last = last_n_locations;
+	pthread_cond_signal(&s->deliver_cond);
+	FLP_UNLOCK();
+}
+
+static int
+wave_flp_inject_location(FlpLocation* location)
+{
+	D("%s() is called", __FUNCTION__);
+
+	/* nothing to do with it, the modem takes no aiding data */
+	return FLP_RESULT_SUCCESS;
+}
+
+static const void*
+wave_flp_get_extension(const char* name)
+{
+	D("%s('%s') is called", __FUNCTION__, name);
+	/* no geofencing */
+	return NULL;
+}
+
+static const FlpLocationInterface waveFlpInterface = {
+    sizeof(FlpLocationInterface),
+    wave_flp_init,
+    wave_flp_get_batch_size,
+    wave_flp_start_batching,
+    wave_flp_update_batching_options,
+    wave_flp_stop_batching,
+    wave_flp_cleanup,
+    wave_flp_get_batched_location,
+    wave_flp_inject_location,
+    wave_flp_get_extension,
+};
+
+const FlpLocationInterface* flp__get_flp_interface(struct flp_device_t* dev)
+{
+    return &waveFlpInterface;
+}
+
+static int open_flp(const struct hw_module_t* module, char const* name,
+        struct hw_device_t** device)
+{
+    struct flp_device_t *dev = malloc(sizeof(struct flp_device_t));
+    if (!dev)
+        return -ENOMEM;
+    memset(dev, 0, sizeof(*dev));
+
+    dev->common.tag = HARDWARE_DEVICE_TAG;
+    dev->common.version = 0;
+    dev->common.module = (struct hw_module_t*)module;
+    dev->get_flp_interface = flp__get_flp_interface;
+
+    *device = (struct hw_device_t*)dev;
+
+    return 0;
+}
+
+static struct hw_module_methods_t flp_module_methods = {
+    .open = open_flp
+};
+
+struct hw_module_t HAL_MODULE_INFO_SYM = {
+    .tag = HARDWARE_MODULE_TAG,
+    .version_major = 0,
+    .version_minor = 1,
+    .id = FUSED_LOCATION_HARDWARE_MODULE_ID,
+    .name = "Wave FLP Module",
+    .author = "omni_wave",
+    .methods = &flp_module_methods,
+};
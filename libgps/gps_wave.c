@@ -15,14 +15,21 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
 #include <fcntl.h>
 #include <hardware/gps.h>
 #include <secril-client.h>
 #include <samsung-ril-socket.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <dlfcn.h>
+#include <poll.h>
 #include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gps_wave.h"
 
 #define  LOG_TAG  "gps_wave"
 #include <utils/Log.h>
@@ -41,6 +48,34 @@ enum {
 	STATE_START = 2
 };
 
+/* With min_interval at or above this (ms) the modem is taken out of
+ * navigation mode between fixes instead of only dropping callbacks */
+#define NAV_DUTY_CYCLE_MIN_INTERVAL	60000
+/* Navigation mode is re-enabled this long (ms) before the next fix is due */
+#define NAV_WARMUP_TIME			15000
+/* A fix arriving up to this early (ms) still counts as on time */
+#define FIX_INTERVAL_SLACK		200
+/* Retry delay (ms) after a failed GpsSetNavigationMode() */
+#define NAV_RETRY_DELAY			1000
+
+typedef struct {
+	/* whether time or a position (injected, or a fix of our own) is
+	 * known since boot or the last delete_aiding_data; only used for
+	 * the TTFF log, the modem cannot be given either */
+	int time_valid;
+	int position_valid;
+
+	/* time to first fix statistics */
+	int64_t session_start;
+	int session_fixed;
+	int session_time_aided;
+	int session_position_aided;
+	int ttff_count;
+	int64_t ttff_total;
+	int64_t ttff_min;
+	int64_t ttff_max;
+} GpsAiding;
+
 typedef struct {
 	int init;
 	GpsCallbacks callbacks;
@@ -48,14 +83,44 @@ typedef struct {
 	GpsLocation location;
 	GpsSvStatus svStatus;
 
+	GpsPositionRecurrence recurrence;
+	uint32_t min_interval;
+	int64_t last_fix_time;
+
+	/* navigation mode is only switched from nav_thread */
+	pthread_t nav_thread;
+	int nav_fd[2];
+	int nav_run;
+	int nav_wanted;
+	int nav_active;
+	int64_t nav_wake_time;
+
+	GpsAiding aiding;
+
+	/* set by flp.wave, see gps_wave.h */
+	wave_gps_fix_listener flp_listener;
+	int flp_navigation;
+
 	pthread_mutex_t GpsMutex;
 } GpsState;
 
-static GpsState _gps_state[1];
+/* flp.wave opens the device a second time, so the mutex is not set up
+ * in open_gps */
+static GpsState _gps_state[1] = {
+	{ .GpsMutex = PTHREAD_MUTEX_INITIALIZER }
+};
 
 #define GPS_LOCK() pthread_mutex_lock(&_gps_state->GpsMutex)
 #define GPS_UNLOCK() pthread_mutex_unlock(&_gps_state->GpsMutex)
 
+static int64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 void update_gps_location(void* arg) {
 	GpsState* state = _gps_state;
 	D("%s(): GpsLocation=%f, %f", __FUNCTION__, state->location.latitude, state->location.longitude);
@@ -89,9 +154,188 @@ void update_gps_svstatus(void* arg) {
 /********************************* RIL interface *********************************/
 HRilClient	mRilClient;
 
+/* Must be called with GPS_LOCK held */
+static void nav_mode_request(GpsState* s, int enabled, int64_t wake_time)
+{
+	char c = 0;
+
+	s->nav_wanted = enabled;
+	s->nav_wake_time = wake_time;
+	if (s->nav_run)
+		write(s->nav_fd[1], &c, 1);
+}
+
+/*
+ * Applies nav_wanted directly when nav_thread could not be started, as
+ * start and stop did before duty cycling. Must be called without
+ * GPS_LOCK held since the SRS client thread takes it in _GpsHandler.
+ */
+static void nav_mode_sync(GpsState* s)
+{
+	int enabled;
+
+	GPS_LOCK();
+	if (s->nav_run || s->nav_wanted == s->nav_active) {
+		GPS_UNLOCK();
+		return;
+	}
+	enabled = s->nav_wanted;
+	GPS_UNLOCK();
+
+	if (GpsSetNavigationMode(mRilClient, enabled) != RIL_CLIENT_ERR_SUCCESS) {
+		ALOGE("%s: GpsSetNavigationMode(%d) failed", __FUNCTION__, enabled);
+		return;
+	}
+
+	GPS_LOCK();
+	s->nav_active = enabled;
+	GPS_UNLOCK();
+}
+
+/*
+ * Applies nav_wanted to the modem and re-enables navigation mode when
+ * nav_wake_time is reached. Runs outside the SRS client thread so that
+ * GpsSetNavigationMode() is never issued from within _GpsHandler.
+ */
+static void* nav_mode_thread(void* arg)
+{
+	GpsState* s = _gps_state;
+	struct pollfd pfd;
+	char buf[16];
+	int enabled, timeout;
+	int64_t now;
+
+	pfd.fd = s->nav_fd[0];
+	pfd.events = POLLIN;
+
+	GPS_LOCK();
+	while (s->nav_run) {
+		now = now_ms();
+		if (s->nav_wake_time && s->nav_wake_time <= now) {
+			s->nav_wanted = 1;
+			s->nav_wake_time = 0;
+		}
+
+		timeout = s->nav_wake_time ? (int)(s->nav_wake_time - now) : -1;
+		enabled = s->nav_wanted;
+		if (enabled != s->nav_active) {
+			GPS_UNLOCK();
+			if (GpsSetNavigationMode(mRilClient, enabled) == RIL_CLIENT_ERR_SUCCESS) {
+				D("%s: navigation mode %s", __FUNCTION__, enabled ? "on" : "off");
+				GPS_LOCK();
+				s->nav_active = enabled;
+				continue;
+			}
+			ALOGE("%s: GpsSetNavigationMode(%d) failed", __FUNCTION__, enabled);
+			GPS_LOCK();
+			if (timeout < 0 || timeout > NAV_RETRY_DELAY)
+				timeout = NAV_RETRY_DELAY;
+		}
+		GPS_UNLOCK();
+
+		if (poll(&pfd, 1, timeout) > 0)
+			read(s->nav_fd[0], buf, sizeof(buf));
+
+		GPS_LOCK();
+	}
+	GPS_UNLOCK();
+
+	return NULL;
+}
+
+/******************************** Aiding data ********************************/
+
+/*
+ * Notes which aiding data the session starting now could have used, for
+ * the TTFF log. Samsung-RIL has no SRS command that hands time or
+ * position to the modem, so nothing is sent. Must be called with
+ * GPS_LOCK held.
+ */
+static void aiding_session_start(GpsState* s)
+{
+	GpsAiding* a = &s->aiding;
+
+	a->session_time_aided = a->time_valid;
+	a->session_position_aided = a->position_valid;
+	a->session_start = now_ms();
+	a->session_fixed = 0;
+}
+
+/*
+ * Accounts time to first fix for the fix just stored in state->location.
+ * Must be called with GPS_LOCK held.
+ */
+static void aiding_fix(GpsState* s)
+{
+	GpsAiding* a = &s->aiding;
+	int64_t ttff;
+
+	if (!(s->location.flags & GPS_LOCATION_HAS_LAT_LONG))
+		return;
+
+	a->position_valid = 1;
+
+	if (s->init != STATE_START || a->session_fixed)
+		return;
+
+	a->session_fixed = 1;
+	ttff = now_ms() - a->session_start;
+	if (!a->ttff_count || ttff < a->ttff_min)
+		a->ttff_min = ttff;
+	if (ttff > a->ttff_max)
+		a->ttff_max = ttff;
+	a->ttff_total += ttff;
+	a->ttff_count++;
+
+	ALOGI("TTFF %lld ms (time known %d, position known %d), "
+		"%d sessions: min %lld, avg %lld, max %lld ms",
+		ttff, a->session_time_aided, a->session_position_aided,
+		a->ttff_count, a->ttff_min, a->ttff_total / a->ttff_count, a->ttff_max);
+}
+
+/*
+ * Decides whether the fix just stored in state->location is passed on to
+ * the framework, honoring the recurrence and min_interval requested in
+ * set_position_mode. Must be called with GPS_LOCK held.
+ */
+static int gps_fix_due(GpsState* s)
+{
+	int64_t now = now_ms();
+
+	if (s->init != STATE_START)
+		return 0;
+
+	if (s->last_fix_time) {
+		if (s->recurrence == GPS_POSITION_RECURRENCE_SINGLE)
+			return 0;
+		if (now - s->last_fix_time + FIX_INTERVAL_SLACK < (int64_t)s->min_interval)
+			return 0;
+	}
+
+	s->last_fix_time = now;
+
+	/* duty cycling needs nav_thread, without it navigation stays on */
+	if (!s->nav_run)
+		return 1;
+
+	/* flp.wave keeps navigating to batch fixes at its own rate */
+	if (s->flp_navigation)
+		return 1;
+
+	if (s->recurrence == GPS_POSITION_RECURRENCE_SINGLE)
+		nav_mode_request(s, 0, 0);
+	else if (s->min_interval >= NAV_DUTY_CYCLE_MIN_INTERVAL)
+		nav_mode_request(s, 0, now + s->min_interval - NAV_WARMUP_TIME);
+
+	return 1;
+}
+
 int _GpsHandler(int type, void *data)
 {
 	GpsState* state = _gps_state;
+	wave_gps_fix_listener listener;
+	int deliver;
+
 	if(type == SRS_GPS_SV_STATUS) {
 		GPS_LOCK();
 		memcpy(&state->svStatus, data, sizeof(GpsSvStatus));
@@ -101,8 +345,13 @@ int _GpsHandler(int type, void *data)
 	} else if (type == SRS_GPS_LOCATION) {
 		GPS_LOCK();
 		memcpy(&state->location, data, sizeof(GpsLocation));
+		aiding_fix(state);
+		deliver = gps_fix_due(state);
+		listener = state->flp_listener;
 		GPS_UNLOCK();
-		if(state->callbacks.create_thread_cb)
+		if(listener)
+			listener((const GpsLocation*)data);
+		if(deliver && state->callbacks.create_thread_cb)
 			state->callbacks.create_thread_cb("update_gps_location", update_gps_location, NULL);
 	} else if (type == SRS_GPS_STATE) {
 		GPS_LOCK();
@@ -164,6 +413,20 @@ wave_gps_init(GpsCallbacks* callbacks)
 
 		s->init = STATE_INIT;
 	}
+
+	if (!s->nav_run) {
+		if (pipe(s->nav_fd) < 0) {
+			ALOGE("%s: pipe() failed: %s", __FUNCTION__, strerror(errno));
+		} else {
+			s->nav_run = 1;
+			if (pthread_create(&s->nav_thread, NULL, nav_mode_thread, NULL) != 0) {
+				ALOGE("%s: could not create navigation mode thread", __FUNCTION__);
+				s->nav_run = 0;
+				close(s->nav_fd[0]);
+				close(s->nav_fd[1]);
+			}
+		}
+	}
 	return 0;
 }
 
@@ -182,6 +445,16 @@ wave_gps_cleanup(void)
 			s->callbacks.create_thread_cb("update_gps_status", update_gps_status, NULL);
 		s->init = STATE_QUIT;
 	}
+
+	if (s->nav_run) {
+		GPS_LOCK();
+		s->nav_run = 0;
+		GPS_UNLOCK();
+		write(s->nav_fd[1], "", 1);
+		pthread_join(s->nav_thread, NULL);
+		close(s->nav_fd[0]);
+		close(s->nav_fd[1]);
+	}
 }
 
 static int
@@ -197,8 +470,13 @@ wave_gps_start()
 	}
 
 	if (connectRILDIfRequired() == 0) {
-		GpsSetNavigationMode(mRilClient, 1);
+		GPS_LOCK();
+		aiding_session_start(s);
+		s->last_fix_time = 0;
 		s->init = STATE_START;
+		nav_mode_request(s, 1, 0);
+		GPS_UNLOCK();
+		nav_mode_sync(s);
 	}
 
 	return 0;
@@ -217,9 +495,18 @@ wave_gps_stop()
 		return -1;
 	}
 
+	GPS_LOCK();
+	if (s->init == STATE_START && !s->aiding.session_fixed)
+		ALOGI("TTFF: session stopped after %lld ms without a fix",
+			now_ms() - s->aiding.session_start);
+	GPS_UNLOCK();
+
 	if (connectRILDIfRequired() == 0) {
-		GpsSetNavigationMode(mRilClient, 0);
+		GPS_LOCK();
 		s->init = STATE_INIT;
+		nav_mode_request(s, s->flp_navigation, 0);
+		GPS_UNLOCK();
+		nav_mode_sync(s);
 	}
 
 	return 0;
@@ -231,7 +518,12 @@ wave_gps_inject_time(GpsUtcTime time, int64_t timeReference, int uncertainty)
 {
 	D("%s() is called", __FUNCTION__);
 	D("time=%lld, timeReference=%lld, uncertainty=%d", time, timeReference, uncertainty);
-	/* not yet implemented */
+
+	GpsState* s = _gps_state;
+
+	GPS_LOCK();
+	s->aiding.time_valid = 1;
+	GPS_UNLOCK();
 	return 0;
 }
 
@@ -240,8 +532,13 @@ wave_gps_inject_location(double latitude, double longitude, float accuracy)
 {
 	D("%s() is called", __FUNCTION__);
 	D("latitude=%f, longitude=%f, accuracy=%f", latitude, longitude, accuracy);
+
+	GpsState* s = _gps_state;
+
+	GPS_LOCK();
+	s->aiding.position_valid = 1;
+	GPS_UNLOCK();
 	return 0;
-	/* not yet implemented */
 }
 
 static void
@@ -249,7 +546,15 @@ wave_gps_delete_aiding_data(GpsAidingData flags)
 {
 	D("%s() is called", __FUNCTION__);
 	D("flags=%d", flags);
-	/* not yet implemented */
+
+	GpsState* s = _gps_state;
+
+	GPS_LOCK();
+	if (flags & GPS_DELETE_TIME)
+		s->aiding.time_valid = 0;
+	if (flags & GPS_DELETE_POSITION)
+		s->aiding.position_valid = 0;
+	GPS_UNLOCK();
 }
 
 static int wave_gps_set_position_mode(GpsPositionMode mode, GpsPositionRecurrence recurrence,
@@ -257,14 +562,76 @@ static int wave_gps_set_position_mode(GpsPositionMode mode, GpsPositionRecurrenc
 {
 	D("%s() is called", __FUNCTION__);
 	D("GpsPositionMode=%d, GpsPositionRecurrence=%d, min_interval=%d, preferred_accuracy=%d, preferred_time=%d,", mode, recurrence, min_interval, preferred_accuracy, preferred_time);
-	/* not yet implemented */
+
+	GpsState* s = _gps_state;
+
+	GPS_LOCK();
+	s->recurrence = recurrence;
+	s->min_interval = min_interval;
+
+	/* resume navigating if a running session was waiting for its next fix
+	 * under the old interval; the next fix reschedules with the new one */
+	if (s->init == STATE_START && s->nav_wake_time)
+		nav_mode_request(s, 1, 0);
+	GPS_UNLOCK();
+	return 0;
+}
+
+/******************************** flp.wave interface ********************************/
+
+static void
+wave_gps_flp_set_fix_listener(wave_gps_fix_listener listener)
+{
+	D("%s() is called", __FUNCTION__);
+
+	GpsState* s = _gps_state;
+
+	GPS_LOCK();
+	s->flp_listener = listener;
+	GPS_UNLOCK();
+}
+
+static int
+wave_gps_flp_set_navigation(int enabled)
+{
+	D("%s(%d) is called", __FUNCTION__, enabled);
+
+	GpsState* s = _gps_state;
+
+	if (!mRilClient) {
+		mRilClient = OpenClient_RILD();
+		if (!mRilClient) {
+			ALOGE("OpenClient_RILD() error");
+			return -1;
+		}
+	}
+
+	if (connectRILDIfRequired() != 0)
+		return -1;
+
+	GPS_LOCK();
+	s->flp_navigation = enabled;
+	/* a running session goes back to its own duty cycle on the next fix */
+	if (enabled || s->init != STATE_START)
+		nav_mode_request(s, enabled, 0);
+	GPS_UNLOCK();
+	nav_mode_sync(s);
+
 	return 0;
 }
 
+static const WaveGpsFlpInterface waveGpsFlpInterface = {
+	sizeof(WaveGpsFlpInterface),
+	wave_gps_flp_set_fix_listener,
+	wave_gps_flp_set_navigation,
+};
+
 static const void*
 wave_gps_get_extension(const char* name)
 {
 	D("%s('%s') is called", __FUNCTION__, name);
+	if (!strcmp(name, WAVE_GPS_FLP_INTERFACE))
+		return &waveGpsFlpInterface;
 	/* not yet implemented */
 	return NULL;
 }
@@ -300,7 +667,6 @@ static int open_gps(const struct hw_module_t* module, char const* name,
 
     *device = (struct hw_device_t*)dev;
 
-	pthread_mutex_init(&_gps_state->GpsMutex, NULL);
     return 0;
 }
 
@@ -0,0 +1,48 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GPS_WAVE_H
+#define GPS_WAVE_H
+
+#include <hardware/gps.h>
+
+__BEGIN_DECLS
+
+/*
+ * Extension of gps.wave used by flp.wave, which is loaded into the same
+ * process and reaches it through hw_get_module() and get_extension().
+ * Not meant for the framework.
+ */
+#define WAVE_GPS_FLP_INTERFACE	"wave-flp"
+
+/* Called on the SRS client thread for every fix the modem reports,
+ * without any gps.wave lock held */
+typedef void (*wave_gps_fix_listener)(const GpsLocation* location);
+
+typedef struct {
+	/* set to sizeof(WaveGpsFlpInterface) */
+	size_t size;
+
+	/* NULL unregisters the listener */
+	void (*set_fix_listener)(wave_gps_fix_listener listener);
+
+	/* keeps navigation mode on while enabled, whether or not a GPS
+	 * session is running; returns 0 on success */
+	int (*set_navigation)(int enabled);
+} WaveGpsFlpInterface;
+
+__END_DECLS
+
+#endif /* GPS_WAVE_H */
@@ -22,39 +22,271 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
 #include <sys/ioctl.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <hardware/lights.h>
 
-static pthread_once_t g_init = PTHREAD_ONCE_INIT;
-static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LCD_FILE "/sys/class/backlight/s5p_bl/brightness"
+#define LED_FILE "/sys/class/misc/notification/led"
 
-char const *const LCD_FILE = "/sys/class/backlight/s5p_bl/brightness";
-char const *const LED_FILE = "/sys/class/misc/notification/led";
+/* sysfs attribute kept open between writes */
+struct light_file {
+	char const *path;
+	int fd;
+	/* last value written, -1 if unknown */
+	int value;
+	int warned;
+	pthread_mutex_t lock;
+};
+
+static struct light_file g_lcd = {
+	LCD_FILE, -1, -1, 0, PTHREAD_MUTEX_INITIALIZER
+};
+
+static struct light_file g_led = {
+	LED_FILE, -1, -1, 0, PTHREAD_MUTEX_INITIALIZER
+};
+
+/*
+ * Notification LED blinking. Notifications and attention share the LED,
+ * the highest priority source that is lit drives it. Blinking sources
+ * are timed by one thread sleeping on an absolute timerfd deadline per
+ * edge; the thread exits once no source blinks.
+ */
+enum {
+	LED_SOURCE_NOTIFICATIONS = 0,
+	LED_SOURCE_ATTENTION,
+	LED_SOURCE_COUNT	/* sources further down win */
+};
+
+struct led_pattern {
+	int lit;
+	int on_ms;
+	int off_ms;
+};
+
+struct led_blink {
+	pthread_mutex_t lock;
+	int timer_fd;
+	int thread_running;
+	struct led_pattern patterns[LED_SOURCE_COUNT];
+	/* pattern currently blinking, on_ms == 0 if none */
+	struct led_pattern current;
+	int on;
+	struct timespec next_edge;
+};
+
+static struct led_blink g_blink = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.timer_fd = -1,
+};
 
-static int write_int(char const *path, int value)
+static int open_light_file(struct light_file *lf)
 {
-	int fd;
-	static int already_warned;
+	lf->fd = open(lf->path, O_WRONLY);
+	if (lf->fd < 0) {
+		if (!lf->warned) {
+			ALOGE("write_int failed to open %s\n", lf->path);
+			lf->warned = 1;
+		}
+		return -errno;
+	}
+	lf->warned = 0;
+	return 0;
+}
+
+static int write_int(struct light_file *lf, int value)
+{
+	char buffer[20];
+	int bytes, amt;
+	int err = 0;
+
+	pthread_mutex_lock(&lf->lock);
 
-	already_warned = 0;
+	if (value == lf->value)
+		goto out;
 
-	ALOGV("write_int: path %s, value %d", path, value);
-	fd = open(path, O_RDWR);
+	ALOGV("write_int: path %s, value %d", lf->path, value);
 
-	if (fd >= 0) {
-		char buffer[20];
-		int bytes = sprintf(buffer, "%d\n", value);
-		int amt = write(fd, buffer, bytes);
-		close(fd);
-		return amt == -1 ? -errno : 0;
+	if (lf->fd < 0 && (err = open_light_file(lf)) < 0)
+		goto out;
+
+	bytes = sprintf(buffer, "%d\n", value);
+	amt = pwrite(lf->fd, buffer, bytes, 0);
+	if (amt < 0) {
+		/* the attribute may have gone away and come back, reopen once */
+		close(lf->fd);
+		if ((err = open_light_file(lf)) < 0)
+			goto out;
+		amt = pwrite(lf->fd, buffer, bytes, 0);
+	}
+
+	if (amt < 0) {
+		err = -errno;
+		lf->value = -1;
 	} else {
-		if (already_warned == 0) {
-			ALOGE("write_int failed to open %s\n", path);
-			already_warned = 1;
+		lf->value = value;
+	}
+
+out:
+	pthread_mutex_unlock(&lf->lock);
+	return err;
+}
+
+static void timespec_add_ms(struct timespec *ts, int ms)
+{
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (ms % 1000) * 1000000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+static int timespec_after(struct timespec const *a, struct timespec const *b)
+{
+	if (a->tv_sec != b->tv_sec)
+		return a->tv_sec > b->tv_sec;
+	return a->tv_nsec > b->tv_nsec;
+}
+
+/* Must be called with g_blink.lock held */
+static void blink_arm(struct timespec const *deadline)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value = *deadline;
+	if (timerfd_settime(g_blink.timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+		ALOGE("timerfd_settime failed: %s", strerror(errno));
+}
+
+static void *blink_thread(void *arg)
+{
+	uint64_t expirations;
+	struct timespec now;
+	int ms;
+
+	for (;;) {
+		if (read(g_blink.timer_fd, &expirations, sizeof(expirations)) < 0) {
+			if (errno == EINTR)
+				continue;
+			ALOGE("led blink timer failed: %s", strerror(errno));
+			pthread_mutex_lock(&g_blink.lock);
+			/* like a failed thread start: steady on */
+			if (g_blink.current.on_ms)
+				write_int(&g_led, 1);
+			break;
 		}
-		return -errno;
+
+		pthread_mutex_lock(&g_blink.lock);
+		if (!g_blink.current.on_ms)
+			break;
+
+		g_blink.on = !g_blink.on;
+		write_int(&g_led, g_blink.on);
+
+		ms = g_blink.on ? g_blink.current.on_ms : g_blink.current.off_ms;
+		timespec_add_ms(&g_blink.next_edge, ms);
+
+		/* the edge after this one is already due: we fell behind by
+		 * more than a period, restart from now */
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (timespec_after(&now, &g_blink.next_edge)) {
+			g_blink.next_edge = now;
+			timespec_add_ms(&g_blink.next_edge, ms);
+		}
+
+		blink_arm(&g_blink.next_edge);
+		pthread_mutex_unlock(&g_blink.lock);
+	}
+
+	/* nothing blinks without the thread, so the next blink_update()
+	 * must start the pattern again instead of finding it running */
+	memset(&g_blink.current, 0, sizeof(g_blink.current));
+	g_blink.thread_running = 0;
+	pthread_mutex_unlock(&g_blink.lock);
+	return NULL;
+}
+
+/* Must be called with g_blink.lock held */
+static int blink_start_thread(void)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	int err = 0;
+
+	if (g_blink.timer_fd < 0) {
+		g_blink.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+		if (g_blink.timer_fd < 0) {
+			ALOGE("timerfd_create failed: %s", strerror(errno));
+			return -errno;
+		}
+	}
+
+	if (g_blink.thread_running)
+		return 0;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, blink_thread, NULL) != 0) {
+		ALOGE("failed to create led blink thread");
+		err = -EAGAIN;
+	} else {
+		g_blink.thread_running = 1;
 	}
+	pthread_attr_destroy(&attr);
+
+	return err;
+}
+
+/* Applies the highest priority lit pattern to the LED.
+ * Must be called with g_blink.lock held */
+static int blink_update(void)
+{
+	struct led_pattern const *p = NULL;
+	struct timespec now;
+	int i;
+
+	for (i = LED_SOURCE_COUNT - 1; i >= 0; i--) {
+		if (g_blink.patterns[i].lit) {
+			p = &g_blink.patterns[i];
+			break;
+		}
+	}
+
+	if (p && p->on_ms > 0 && p->off_ms > 0) {
+		if (g_blink.current.on_ms == p->on_ms &&
+				g_blink.current.off_ms == p->off_ms)
+			return 0;
+
+		if (blink_start_thread() == 0) {
+			g_blink.current = *p;
+			g_blink.on = 1;
+			clock_gettime(CLOCK_MONOTONIC, &g_blink.next_edge);
+			timespec_add_ms(&g_blink.next_edge, p->on_ms);
+			blink_arm(&g_blink.next_edge);
+			return write_int(&g_led, 1);
+		}
+		/* no thread, fall back to steady on */
+	}
+
+	if (g_blink.current.on_ms) {
+		memset(&g_blink.current, 0, sizeof(g_blink.current));
+		/* wake the thread right away so it can exit */
+		if (g_blink.thread_running) {
+			now.tv_sec = 0;
+			now.tv_nsec = 1;
+			blink_arm(&now);
+		}
+	}
+
+	return write_int(&g_led, p ? 1 : 0);
 }
 
 static int rgb_to_brightness(struct light_state_t const *state)
@@ -65,13 +297,12 @@ static int rgb_to_brightness(struct light_state_t const *state)
 		+ (150*((color>>8) & 0x00ff)) + (29*(color & 0x00ff))) >> 8;
 }
 
-static int set_light_notifications(struct light_device_t* dev,
-			struct light_state_t const* state)
+static int set_led_pattern(int source, struct light_state_t const* state)
 {
+	struct led_pattern *p = &g_blink.patterns[source];
 	int brightness =  rgb_to_brightness(state);
 	int v = 0;
-	int ret = 0;
-	pthread_mutex_lock(&g_lock);
+	int err;
 
 	if (brightness+state->color == 0 || brightness > 100) {
 		if (state->color & 0x00ffffff)
@@ -79,23 +310,43 @@ static int set_light_notifications(struct light_device_t* dev,
 	} else
 		v = 0;
 
-	ALOGI("color %u fm %u status %u is lit %u brightness", state->color, state->flashMode, v, (state->color & 0x00ffffff), brightness);
-	ret = write_int(LED_FILE, v);
-	pthread_mutex_unlock(&g_lock);
-	return ret;
+	ALOGI("source %d color %u fm %u on %d off %d status %u brightness %d", source, state->color,
+		state->flashMode, state->flashOnMS, state->flashOffMS, v, brightness);
+
+	pthread_mutex_lock(&g_blink.lock);
+	p->lit = v;
+	/* there is no hardware blinking, time both modes in software */
+	if (v && state->flashMode != LIGHT_FLASH_NONE) {
+		p->on_ms = state->flashOnMS;
+		p->off_ms = state->flashOffMS;
+	} else {
+		p->on_ms = 0;
+		p->off_ms = 0;
+	}
+	err = blink_update();
+	pthread_mutex_unlock(&g_blink.lock);
+
+	return err;
+}
+
+static int set_light_notifications(struct light_device_t* dev,
+			struct light_state_t const* state)
+{
+	return set_led_pattern(LED_SOURCE_NOTIFICATIONS, state);
+}
+
+static int set_light_attention(struct light_device_t* dev,
+			struct light_state_t const* state)
+{
+	return set_led_pattern(LED_SOURCE_ATTENTION, state);
 }
 
 static int set_light_backlight(struct light_device_t *dev,
 			struct light_state_t const *state)
 {
-	int err = 0;
 	int brightness = rgb_to_brightness(state);
 
-	pthread_mutex_lock(&g_lock);
-	err = write_int(LCD_FILE, brightness);
-
-	pthread_mutex_unlock(&g_lock);
-	return err;
+	return write_int(&g_lcd, brightness);
 }
 
 static int close_lights(struct light_device_t *dev)
@@ -119,11 +370,11 @@ static int open_lights(const struct hw_module_t *module, char const *name,
 		set_light = set_light_backlight;
 	else if (0 == strcmp(LIGHT_ID_NOTIFICATIONS, name))
 		set_light = set_light_notifications;
+	else if (0 == strcmp(LIGHT_ID_ATTENTION, name))
+		set_light = set_light_attention;
 	else
 		return -EINVAL;
 
-	pthread_mutex_init(&g_lock, NULL);
-
 	struct light_device_t *dev = malloc(sizeof(struct light_device_t));
 	memset(dev, 0, sizeof(*dev));
 